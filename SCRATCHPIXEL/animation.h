@@ -0,0 +1,107 @@
+#ifndef ANIMATION_H
+#define ANIMATION_H
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+
+#include "scene.h"
+
+//[comment]
+// A keyframed track. Values between two keys are linearly interpolated, values
+// before the first key (or after the last one) are held constant.
+//[/comment]
+class Track
+{
+public:
+    void addKey(float frame, const Vec3f &value) { keys[frame] = value; }
+    bool empty() const { return keys.empty(); }
+    Vec3f evaluate(float frame) const
+    {
+        std::map<float, Vec3f>::const_iterator hi = keys.lower_bound(frame);
+        if (hi == keys.end()) return keys.rbegin()->second;
+        if (hi == keys.begin() || hi->first == frame) return hi->second;
+        std::map<float, Vec3f>::const_iterator lo = hi;
+        --lo;
+        float t = (frame - lo->first) / (hi->first - lo->first);
+        return lo->second * (1 - t) + hi->second * t;
+    }
+private:
+    std::map<float, Vec3f> keys;
+};
+
+//[comment]
+// An animation is a camera path (eye and target tracks) plus one position track
+// per animated sphere. It can be read from a text file with one key per line:
+//
+//     frames <count>
+//     camera <frame> <from x y z> <to x y z>
+//     sphere <frame> <index> <center x y z>
+//
+// Lines starting with '#' are comments. When no file is given, turntable() builds
+// a camera orbiting around the scene, which is what we use for look-dev.
+//[/comment]
+class Animation
+{
+public:
+    Animation() : frames(1) {}
+    unsigned frames;
+    bool load(const char *path)
+    {
+        std::ifstream ifs(path);
+        if (!ifs) return false;
+        std::string line;
+        while (std::getline(ifs, line)) {
+            std::istringstream iss(line);
+            std::string keyword;
+            if (!(iss >> keyword) || keyword[0] == '#') continue;
+            float frame;
+            Vec3f a, b;
+            if (keyword == "frames") {
+                if (!(iss >> frames)) return false;
+            }
+            else if (keyword == "camera") {
+                if (!(iss >> frame >> a.x >> a.y >> a.z >> b.x >> b.y >> b.z)) return false;
+                eye.addKey(frame, a);
+                target.addKey(frame, b);
+            }
+            else if (keyword == "sphere") {
+                unsigned index;
+                if (!(iss >> frame >> index >> a.x >> a.y >> a.z)) return false;
+                if (index >= spheres.size()) spheres.resize(index + 1);
+                spheres[index].addKey(frame, a);
+            }
+            else
+                return false;
+        }
+        return true;
+    }
+    void turntable(unsigned count, const Vec3f &center, float radius, float height)
+    {
+        frames = count;
+        for (unsigned i = 0; i <= count; ++i) {
+            float angle = 2 * M_PI * i / float(count);
+            eye.addKey(i, center + Vec3f(sin(angle) * radius, height, cos(angle) * radius));
+        }
+        target.addKey(0, center);
+    }
+    //[comment]
+    // Write the state of the scene at the given frame into the spheres and camera.
+    // Spheres that have no track keep their rest position.
+    //[/comment]
+    void evaluate(unsigned frame, const std::vector<Sphere> &rest, std::vector<Sphere> &spheres_out, Camera &cam) const
+    {
+        spheres_out = rest;
+        for (unsigned i = 0; i < spheres.size() && i < spheres_out.size(); ++i)
+            if (!spheres[i].empty()) spheres_out[i].center = spheres[i].evaluate(frame);
+        if (!eye.empty())
+            cam = Camera::lookAt(eye.evaluate(frame), target.empty() ? Vec3f(0, 0, -1) : target.evaluate(frame), Vec3f(0, 1, 0), cam.fov);
+    }
+private:
+    Track eye, target;
+    std::vector<Track> spheres;
+};
+
+#endif
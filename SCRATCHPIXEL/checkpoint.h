@@ -0,0 +1,224 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <cstdint>
+#include <unistd.h>
+
+#include "pathtracer.h"
+
+//[comment]
+// Checkpoints of a long render (-checkpoint file [seconds]). Every interval the
+// renderer copies the state of the frame it is on into the snapshot buffer and
+// hands it to the checkpoint thread, which writes it to file.tmp, syncs it and
+// renames it over file: a crash or a kill leaves either the old checkpoint or
+// the new one, never half of one. The render threads only pay for the copy,
+// which happens between two passes of the path tracer; while the previous
+// snapshot is still being written no new one is taken (nothing ever waits on
+// the disk).
+// A checkpoint holds the index of the frame, the PixelEstimate of every pixel
+// (accumulated sums, Welford statistics, number of samples and the primary hit)
+// and a hash of the job: the size of the image, the path tracing settings and
+// the scene of every frame. The sample count of a pixel is also the position of
+// its random sequence (the numbers only depend on the pixel, the sample and the
+// frame, see PathSampler), so resuming from a checkpoint adds exactly the samples
+// an uninterrupted render would have added, and gives the same image.
+// Frames before the checkpointed one are not rendered again: a checkpoint of
+// frame N is only written once frames 0..N - 1 are on disk (framesWritten()).
+// Pixels are only saved in the path tracing mode, the checkpoints of the other
+// mode (and those taken at the start of a frame) only hold the frame index.
+//[/comment]
+class Checkpoint
+{
+public:
+    Checkpoint() : interval(60), job(0), stop(false), busy(false), written(0),
+        resumeFrame(0), resumePixels(false), snapshotFrame(0), snapshotPixels(false) {}
+    ~Checkpoint()
+    {
+        if (!thread.joinable()) return;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        thread.join();
+    }
+    bool enabled() const { return !path.empty(); }
+    //[comment]
+    // Start checkpointing to file every seconds, npixels PixelEstimate each, for
+    // the job of the given hash. If file holds a checkpoint of the same job, it is
+    // loaded for resume(). Returns false if the file cannot be written.
+    //[/comment]
+    bool open(const std::string &file, double seconds, uint64_t jobHash, unsigned npixels)
+    {
+        path = file;
+        interval = seconds;
+        job = jobHash;
+        snapshot.resize(npixels);
+        load();
+        FILE *f = fopen((path + ".tmp").c_str(), "wb");
+        if (!f) return false;
+        fclose(f);
+        remove((path + ".tmp").c_str());
+        last = std::chrono::steady_clock::now();
+        thread = std::thread(&Checkpoint::writerLoop, this);
+        return true;
+    }
+    //[comment]
+    // Frame the loaded checkpoint resumes at, 0 if there was none
+    //[/comment]
+    unsigned resumeAt() const { return resumeFrame; }
+    //[comment]
+    // The saved pixels of frame if the checkpoint has them, NULL otherwise (only
+    // once: the buffer is then used for the snapshots)
+    //[/comment]
+    const PixelEstimate *resume(unsigned frame)
+    {
+        if (!resumePixels || frame != resumeFrame) return NULL;
+        resumePixels = false;
+        return snapshot.data();
+    }
+    //[comment]
+    // Is it time for a checkpoint, and is the snapshot buffer free?
+    //[/comment]
+    bool due()
+    {
+        if (!enabled() || std::chrono::steady_clock::now() - last < std::chrono::duration<double>(interval)) return false;
+        std::lock_guard<std::mutex> lock(mutex);
+        return !busy;
+    }
+    //[comment]
+    // Where the renderer copies the pixels of a snapshot, once due() said so
+    //[/comment]
+    PixelEstimate *buffer() { return snapshot.data(); }
+    //[comment]
+    // Hand the snapshot of frame to the checkpoint thread, with the pixels copied
+    // to buffer() or without any
+    //[/comment]
+    void submit(unsigned frame, bool pixels)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            snapshotFrame = frame;
+            snapshotPixels = pixels;
+            busy = true;
+        }
+        last = std::chrono::steady_clock::now();
+        wake.notify_all();
+    }
+    //[comment]
+    // Called once frames 0..n - 1 are on disk
+    //[/comment]
+    void framesWritten(unsigned n)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            written = n;
+        }
+        wake.notify_all();
+    }
+    //[comment]
+    // The job is done: wait for the last write and remove the checkpoint, so
+    // that the next render of the same job starts over
+    //[/comment]
+    void complete()
+    {
+        if (!enabled()) return;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            idle.wait(lock, [&] { return !busy; });
+        }
+        remove(path.c_str());
+    }
+private:
+    struct Header
+    {
+        char magic[8];
+        uint32_t version, pixelBytes, frame;
+        uint64_t job;
+        uint32_t pixels, npixels;
+    };
+    static const uint32_t VERSION = 1;
+    void load()
+    {
+        FILE *f = fopen(path.c_str(), "rb");
+        if (!f) return;
+        Header h;
+        bool ok = fread(&h, sizeof(h), 1, f) == 1 && !memcmp(h.magic, "RTCKPT\r\n", 8) && h.version == VERSION
+            && h.pixelBytes == sizeof(PixelEstimate) && h.job == job && h.npixels == snapshot.size();
+        if (ok && h.pixels)
+            ok = fread(snapshot.data(), sizeof(PixelEstimate), snapshot.size(), f) == snapshot.size();
+        fclose(f);
+        if (!ok) {
+            fprintf(stderr, "checkpoint %s is not of this job, starting over\n", path.c_str());
+            return;
+        }
+        resumeFrame = h.frame;
+        resumePixels = h.pixels && !snapshot.empty();
+        fprintf(stderr, "resuming from checkpoint %s at frame %u%s\n", path.c_str(), h.frame,
+            resumePixels ? "" : " (start)");
+    }
+    bool write(unsigned frame, bool pixels)
+    {
+        Header h;
+        memset(&h, 0, sizeof(h));
+        memcpy(h.magic, "RTCKPT\r\n", 8);
+        h.version = VERSION;
+        h.pixelBytes = sizeof(PixelEstimate);
+        h.frame = frame;
+        h.job = job;
+        h.pixels = pixels;
+        h.npixels = snapshot.size();
+        std::string tmp = path + ".tmp";
+        FILE *f = fopen(tmp.c_str(), "wb");
+        if (!f) return false;
+        bool ok = fwrite(&h, sizeof(h), 1, f) == 1
+            && (!pixels || fwrite(snapshot.data(), sizeof(PixelEstimate), snapshot.size(), f) == snapshot.size());
+        // the data must be on disk before the rename makes it the checkpoint
+        ok = fflush(f) == 0 && fsync(fileno(f)) == 0 && ok;
+        ok = fclose(f) == 0 && ok;
+        if (ok) ok = rename(tmp.c_str(), path.c_str()) == 0;
+        else remove(tmp.c_str());
+        return ok;
+    }
+    void writerLoop()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        for (;;) {
+            // a checkpoint of frame N may only replace the last one once the
+            // frames before N are written
+            wake.wait(lock, [&] { return stop || (busy && written >= snapshotFrame); });
+            if (stop) return;
+            unsigned frame = snapshotFrame;
+            bool pixels = snapshotPixels;
+            lock.unlock();
+            if (!write(frame, pixels)) fprintf(stderr, "cannot write checkpoint %s\n", path.c_str());
+            lock.lock();
+            busy = false;
+            idle.notify_all();
+        }
+    }
+    std::string path;
+    double interval;
+    uint64_t job;
+    std::vector<PixelEstimate> snapshot;
+    std::chrono::steady_clock::time_point last;
+    std::thread thread;
+    std::mutex mutex;
+    std::condition_variable wake, idle;
+    bool stop, busy;
+    unsigned written;
+    unsigned resumeFrame;
+    bool resumePixels;
+    unsigned snapshotFrame;
+    bool snapshotPixels;
+};
+
+#endif
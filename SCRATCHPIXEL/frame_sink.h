@@ -0,0 +1,187 @@
+#ifndef FRAME_SINK_H
+#define FRAME_SINK_H
+
+#include <string>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <algorithm>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+
+#include "scene.h"
+
+enum SinkFormat { SINK_PPM, SINK_Y4M, SINK_RGB };
+
+//[comment]
+// Where the resolved frames go. SINK_PPM writes one file per frame (the path of
+// the frame), the two stream formats write every frame to the same file
+// descriptor, stdout ("-") or a named pipe, for an encoder to read as they come:
+//
+//     raytracer -frames 250 -stream y4m | ffmpeg -i - out.mp4
+//     raytracer -frames 250 -stream rgb | ffmpeg -f rawvideo -pix_fmt rgb24 -s 640x480 -i - out.mp4
+//
+// y4m is YUV4MPEG2 in 4:2:0 (BT.601, studio range, chroma sited at the centre
+// of every 2x2 block), rgb is the bare 24 bit pixels of the PPM files.
+// The writer blocks when the encoder is slower than the renderer, and the
+// renderer then blocks on the writer (RenderContext keeps at most depth frames),
+// so nothing piles up in memory.
+// On a pipe the frames are handed over with vmsplice(): the pipe refers to the
+// pages of the frame instead of copying them. The reader may still be reading
+// those pages when vmsplice() returns, so this is only done when a frame is at
+// least as large as the pipe and when depth >= 2: once the next frame (another
+// buffer) is in the pipe, nothing of the previous one can be left in it.
+//[/comment]
+class FrameSink
+{
+public:
+    FrameSink() : format(SINK_PPM), width(0), height(0), fd(-1), splice(false), spliced(false) {}
+    ~FrameSink() { close(); }
+    //[comment]
+    // Open the stream (nothing to do for PPM files). Opening a named pipe waits
+    // for the encoder to open the other end.
+    //[/comment]
+    bool open(SinkFormat f, const std::string &path, unsigned w, unsigned h, unsigned fps, unsigned depth)
+    {
+        format = f;
+        width = w;
+        height = h;
+        if (format == SINK_PPM) return true;
+        // a dead encoder must show up as EPIPE, not kill the renderer
+        signal(SIGPIPE, SIG_IGN);
+        fd = path == "-" ? STDOUT_FILENO : ::open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) return false;
+        struct stat st;
+        if (depth >= 2 && fstat(fd, &st) == 0 && S_ISFIFO(st.st_mode)) {
+            // fewer wakeups with a pipe as large as a frame, if we may (the
+            // kernel rounds the size up to a power of two)
+            int size = 1 << 20;
+            while (size > 4096 && (size_t)size > frameBytes()) size >>= 1;
+            fcntl(fd, F_SETPIPE_SZ, size);
+            size = fcntl(fd, F_GETPIPE_SZ);
+            splice = size > 0 && frameBytes() >= (size_t)size;
+        }
+        if (format == SINK_Y4M) {
+            char header[128];
+            int n = snprintf(header, sizeof(header), "YUV4MPEG2 W%u H%u F%u:1 Ip A1:1 C420jpeg XYSCSS=420JPEG\n",
+                width, height, fps);
+            return writeAll(header, n);
+        }
+        return true;
+    }
+    //[comment]
+    // Wait until the reader has drained the pages we spliced (they are about
+    // to be freed), then close the stream
+    //[/comment]
+    void close()
+    {
+        if (fd < 0) return;
+        struct pollfd p = { fd, 0, 0 };
+        int pending;
+        while (spliced && ioctl(fd, FIONREAD, &pending) == 0 && pending > 0
+            && !(poll(&p, 1, 1) > 0 && (p.revents & (POLLERR | POLLHUP))))
+            ;
+        if (fd != STDOUT_FILENO) ::close(fd);
+        fd = -1;
+    }
+    //[comment]
+    // Size of a resolved frame
+    //[/comment]
+    size_t frameBytes() const
+    {
+        if (format == SINK_Y4M) return width * height + 2 * chromaWidth() * chromaHeight();
+        return width * height * 3;
+    }
+    //[comment]
+    // Clamp the frame to bytes in the layout of the sink. The chroma of a 2x2
+    // block is that of the average of its 8 bit pixels.
+    //[/comment]
+    void resolve(const Vec3f *image, unsigned char *out) const
+    {
+        if (format != SINK_Y4M) {
+            for (unsigned i = 0; i < width * height; ++i) {
+                *out++ = toByte(image[i].x);
+                *out++ = toByte(image[i].y);
+                *out++ = toByte(image[i].z);
+            }
+            return;
+        }
+        unsigned char *u = out + width * height, *v = u + chromaWidth() * chromaHeight();
+        for (unsigned y = 0; y < height; y += 2) {
+            for (unsigned x = 0; x < width; x += 2) {
+                int r = 0, g = 0, b = 0, n = 0;
+                for (unsigned yy = y; yy < std::min(y + 2, height); ++yy) {
+                    for (unsigned xx = x; xx < std::min(x + 2, width); ++xx) {
+                        const Vec3f &c = image[yy * width + xx];
+                        int cr = toByte(c.x), cg = toByte(c.y), cb = toByte(c.z);
+                        out[yy * width + xx] = (unsigned char)(((66 * cr + 129 * cg + 25 * cb + 128) >> 8) + 16);
+                        r += cr; g += cg; b += cb; ++n;
+                    }
+                }
+                r /= n; g /= n; b /= n;
+                *u++ = (unsigned char)(((-38 * r - 74 * g + 112 * b + 128) >> 8) + 128);
+                *v++ = (unsigned char)(((112 * r - 94 * g - 18 * b + 128) >> 8) + 128);
+            }
+        }
+    }
+    //[comment]
+    // Write a resolved frame, to path for PPM files
+    //[/comment]
+    bool write(const unsigned char *bytes, const std::string &path)
+    {
+        if (format == SINK_PPM) {
+            // keep the binary mode if you compile under Windows
+            FILE *f = fopen(path.c_str(), "wb");
+            if (!f) return false;
+            fprintf(f, "P6\n%u %u\n255\n", width, height);
+            bool ok = fwrite(bytes, 1, frameBytes(), f) == frameBytes();
+            return fclose(f) == 0 && ok;
+        }
+        if (format == SINK_Y4M && !writeAll("FRAME\n", 6)) return false;
+        return splice ? spliceAll(bytes, frameBytes()) : writeAll(bytes, frameBytes());
+    }
+private:
+    static unsigned char toByte(float x) { return (unsigned char)(std::min(float(1), x) * 255); }
+    unsigned chromaWidth() const { return (width + 1) / 2; }
+    unsigned chromaHeight() const { return (height + 1) / 2; }
+    bool writeAll(const void *data, size_t n)
+    {
+        const char *p = (const char *)data;
+        while (n) {
+            ssize_t k = ::write(fd, p, n);
+            if (k < 0 && errno == EINTR) continue;
+            if (k <= 0) return false;
+            p += k;
+            n -= k;
+        }
+        return true;
+    }
+    bool spliceAll(const void *data, size_t n)
+    {
+        struct iovec iov = { (void *)data, n };
+        while (iov.iov_len) {
+            ssize_t k = vmsplice(fd, &iov, 1, 0);
+            if (k < 0 && errno == EINTR) continue;
+            if (k < 0 && errno == EINVAL) {
+                splice = false;
+                return writeAll(iov.iov_base, iov.iov_len);
+            }
+            if (k <= 0) return false;
+            spliced = true;
+            iov.iov_base = (char *)iov.iov_base + k;
+            iov.iov_len -= k;
+        }
+        return true;
+    }
+    SinkFormat format;
+    unsigned width, height;
+    int fd;
+    bool splice, spliced;
+};
+
+#endif
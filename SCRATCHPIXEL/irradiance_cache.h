@@ -0,0 +1,172 @@
+#ifndef IRRADIANCE_CACHE_H
+#define IRRADIANCE_CACHE_H
+
+#include <atomic>
+#include <memory>
+#include <cmath>
+#include <cstdint>
+#include <algorithm>
+
+#include "scene.h"
+
+//[comment]
+// Irradiance cache (Ward, Rubinstein and Clear, "A Ray Tracing Solution for
+// Diffuse Interreflection"). Indirect light changes slowly over a diffuse
+// surface, so it is only gathered (many hemisphere rays) at a few points, the
+// records, and the hits in between interpolate it. A record is valid around
+// its point up to a distance proportional to the harmonic mean distance of the
+// surfaces its rays met (radius): close to other surfaces the light changes
+// faster. The weight of record i at point p with normal n is
+//
+//     w = 1 / (|p - pi| / Ri + sqrt(1 - n.ni))
+//
+// and the records with w > 1 / accuracy are averaged (none: the caller gathers
+// a new record). Records in front of p (seen from the surface) are left out.
+//
+// The records are kept in a hashed grid of several levels: a record goes into
+// the cells of the level whose cells are at least as large as its valid region,
+// at most 8 of them, and a lookup reads the cell of p at every level in use.
+// Every render thread inserts without a lock: the record and its cell nodes
+// come from arrays allocated once (an atomic counter hands out the slots),
+// and a node is pushed at the head of its bucket with a compare and swap, after
+// it was written. Nothing is ever removed until clear(), which runs between
+// frames. Once the arrays are full new records are simply not kept.
+//[/comment]
+class IrradianceCache
+{
+public:
+    static const unsigned LEVELS = 12;
+    static const unsigned BUCKETS = 1 << 16;
+    IrradianceCache() : accuracy(0), minRadius(0), maxRadius(0), capacity(0), nodeCapacity(0),
+        nrecords(0), nnodes(0), levels(0) {}
+    //[comment]
+    // Enable the cache: records are valid over accuracy * radius, with the radius
+    // clamped to [minR, maxR] (scene units), and at most maxRecords are kept
+    //[/comment]
+    void configure(float a, float minR, float maxR, unsigned maxRecords)
+    {
+        accuracy = a;
+        minRadius = minR;
+        maxRadius = maxR;
+        if (capacity != maxRecords) {
+            capacity = maxRecords;
+            nodeCapacity = 4 * maxRecords;
+            records.reset(new Record[capacity]);
+            nodes.reset(new Node[nodeCapacity]);
+            buckets.reset(new std::atomic<Node *>[BUCKETS]);
+        }
+        clear();
+    }
+    bool enabled() const { return accuracy > 0; }
+    unsigned size() const { return std::min(nrecords.load(std::memory_order_relaxed), capacity); }
+    //[comment]
+    // Forget every record (no thread may be using the cache)
+    //[/comment]
+    void clear()
+    {
+        for (unsigned i = 0; i < BUCKETS; ++i) buckets[i].store(NULL, std::memory_order_relaxed);
+        nrecords.store(0, std::memory_order_relaxed);
+        nnodes.store(0, std::memory_order_relaxed);
+        levels.store(0, std::memory_order_relaxed);
+    }
+    //[comment]
+    // Interpolate the records valid at p (normal n) into value, false if none is
+    //[/comment]
+    bool lookup(const Vec3f &p, const Vec3f &n, Vec3f &value) const
+    {
+        Vec3f sum = 0;
+        float weights = 0;
+        unsigned used = levels.load(std::memory_order_acquire);
+        for (unsigned level = 0; used >> level; ++level) {
+            if (!((used >> level) & 1)) continue;
+            int cell[3];
+            cellOf(p, level, cell);
+            for (const Node *node = buckets[bucket(level, cell)].load(std::memory_order_acquire); node; node = node->next) {
+                if (node->level != level || node->cell[0] != cell[0] || node->cell[1] != cell[1] || node->cell[2] != cell[2])
+                    continue;
+                const Record &r = *node->record;
+                Vec3f d = p - r.p;
+                float e = d.length() / r.radius + sqrt(std::max(0.0f, 1 - n.dot(r.n)));
+                if (e >= accuracy || d.dot(n + r.n) < -0.1f * r.radius) continue;
+                float w = 1 / std::max(e, 1e-4f);
+                sum += r.value * w;
+                weights += w;
+            }
+        }
+        if (weights <= 0) return false;
+        value = sum * (1 / weights);
+        return true;
+    }
+    //[comment]
+    // Add a record gathered at p (normal n): value is the mean indirect radiance
+    // arriving over the hemisphere, distance the harmonic mean distance of its rays
+    //[/comment]
+    void insert(const Vec3f &p, const Vec3f &n, const Vec3f &value, float distance)
+    {
+        unsigned index = nrecords.fetch_add(1, std::memory_order_relaxed);
+        if (index >= capacity) return;
+        Record &r = records[index];
+        r.p = p;
+        r.n = n;
+        r.value = value;
+        r.radius = std::min(std::max(distance, minRadius), maxRadius);
+        // the smallest level whose cells hold the valid region in 2 x 2 x 2 of them
+        float reach = accuracy * r.radius;
+        unsigned level = 0;
+        while (level + 1 < LEVELS && cellSize(level) < 2 * reach) ++level;
+        int lo[3], hi[3];
+        cellOf(p - Vec3f(reach), level, lo);
+        cellOf(p + Vec3f(reach), level, hi);
+        for (int x = lo[0]; x <= hi[0]; ++x)
+            for (int y = lo[1]; y <= hi[1]; ++y)
+                for (int z = lo[2]; z <= hi[2]; ++z) {
+                    unsigned k = nnodes.fetch_add(1, std::memory_order_relaxed);
+                    if (k >= nodeCapacity) return;
+                    Node &node = nodes[k];
+                    node.record = &r;
+                    node.level = level;
+                    node.cell[0] = x;
+                    node.cell[1] = y;
+                    node.cell[2] = z;
+                    std::atomic<Node *> &head = buckets[bucket(level, node.cell)];
+                    node.next = head.load(std::memory_order_relaxed);
+                    while (!head.compare_exchange_weak(node.next, &node, std::memory_order_release, std::memory_order_relaxed)) {}
+                }
+        levels.fetch_or(1u << level, std::memory_order_release);
+    }
+private:
+    struct Record
+    {
+        Vec3f p, n, value;
+        float radius;
+    };
+    struct Node
+    {
+        const Record *record;
+        Node *next;
+        unsigned level;
+        int cell[3];
+    };
+    float cellSize(unsigned level) const { return 2 * accuracy * minRadius * float(1u << level); }
+    void cellOf(const Vec3f &p, unsigned level, int *cell) const
+    {
+        float inv = 1 / cellSize(level);
+        cell[0] = int(floorf(p.x * inv));
+        cell[1] = int(floorf(p.y * inv));
+        cell[2] = int(floorf(p.z * inv));
+    }
+    static unsigned bucket(unsigned level, const int *cell)
+    {
+        uint32_t h = uint32_t(cell[0]) * 73856093u ^ uint32_t(cell[1]) * 19349663u
+            ^ uint32_t(cell[2]) * 83492791u ^ level * 2654435761u;
+        return (h ^ (h >> 16)) & (BUCKETS - 1);
+    }
+    float accuracy, minRadius, maxRadius;
+    unsigned capacity, nodeCapacity;
+    std::unique_ptr<Record[]> records;
+    std::unique_ptr<Node[]> nodes;
+    std::unique_ptr<std::atomic<Node *>[]> buckets;
+    std::atomic<unsigned> nrecords, nnodes, levels;
+};
+
+#endif
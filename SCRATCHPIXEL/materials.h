@@ -0,0 +1,195 @@
+#ifndef MATERIALS_H
+#define MATERIALS_H
+
+#include <vector>
+#include <algorithm>
+
+#include "scene.h"
+
+//[comment]
+// This variable controls the maximum recursion depth
+//[/comment]
+#define MAX_RAY_DEPTH 5
+
+inline float mix(const float &a, const float &b, const float &mix)
+{
+    return b * mix + a * (1 - mix);
+}
+
+//[comment]
+// Everything the shading kernels need to know about a ray/sphere intersection.
+// pixel is only used by the batched kernels (index in the framebuffer).
+//[/comment]
+struct Hit
+{
+    Vec3f phit, nhit, raydir;               /// point, normal (facing the ray) and ray direction
+    const Sphere *sphere;                   /// the sphere that was hit
+    bool inside;                            /// true if the ray started inside the sphere
+    unsigned pixel;                         /// framebuffer index (batched kernels only)
+};
+
+//[comment]
+// Find the nearest sphere hit by the ray, NULL if the ray escapes the scene
+//[/comment]
+inline const Sphere *nearestSphere(const Vec3f &rayorig, const Vec3f &raydir, const std::vector<Sphere> &spheres, float &tnear)
+{
+    const Sphere* sphere = NULL;
+    tnear = INFINITY;
+    // find intersection of this ray with the sphere in the scene
+    for (unsigned i = 0; i < spheres.size(); ++i) {
+        float t0 = INFINITY, t1 = INFINITY;
+        if (spheres[i].intersect(rayorig, raydir, t0, t1)) {
+            if (t0 < 0) t0 = t1;
+            if (t0 < tnear) {
+                tnear = t0;
+                sphere = &spheres[i];
+            }
+        }
+    }
+    return sphere;
+}
+
+//[comment]
+// Find the nearest sphere hit by the ray and fill the hit record. Returns false
+// if the ray escapes the scene.
+//[/comment]
+inline bool intersectScene(const Vec3f &rayorig, const Vec3f &raydir, const std::vector<Sphere> &spheres, Hit &hit)
+{
+    float tnear;
+    const Sphere* sphere = nearestSphere(rayorig, raydir, spheres, tnear);
+    if (!sphere) return false;
+    hit.sphere = sphere;
+    hit.raydir = raydir;
+    hit.phit = rayorig + raydir * tnear; // point of intersection
+    hit.nhit = hit.phit - sphere->center; // normal at the intersection point
+    hit.nhit = vec_normalize_shading(hit.nhit); // normalize normal direction
+    // If the normal and the view direction are not opposite to each other
+    // reverse the normal direction. That also means we are inside the sphere so set
+    // the inside bool to true.
+    hit.inside = false;
+    if (raydir.dot(hit.nhit) > 0) hit.nhit = -hit.nhit, hit.inside = true;
+    return true;
+}
+
+Vec3f trace(const Vec3f &rayorig, const Vec3f &raydir, const std::vector<Sphere> &spheres, const int &depth);
+
+//[comment]
+// One shading kernel per material class. The material flags and the specular
+// exponent are template parameters, so every instantiation is compiled with its
+// own constant folded code: the diffuse kernel has no reflection code at all,
+// the Blinn-Phong kernel computes its power with a fixed number of multiplies,
+// and no kernel tests transparency or reflection at run time. The only branch
+// left is the recursion depth limit, which is the same for every hit of a ray
+// generation.
+//[/comment]
+template<bool Reflective, bool Transparent, unsigned SpecPower>
+struct MaterialKernel
+{
+    static Vec3f shade(const Hit &hit, const std::vector<Sphere> &spheres, const int &depth)
+    {
+        const Sphere *sphere = hit.sphere;
+        const Vec3f &phit = hit.phit, &nhit = hit.nhit, &raydir = hit.raydir;
+        Vec3f surfaceColor = 0; // color of the ray/surfaceof the object intersected by the ray
+        float bias = 1e-4; // add some bias to the point from which we will be tracing
+        if (Reflective && depth < MAX_RAY_DEPTH) {
+            float facingratio = -raydir.dot(nhit);
+            // change the mix value to tweak the effect
+            float fresneleffect = mix(rt_pow_shading(1 - facingratio, 3), 1, 0.1);
+            // compute reflection direction (not need to normalize because all vectors
+            // are already normalized)
+            Vec3f refldir = raydir - nhit * 2 * raydir.dot(nhit);
+            refldir.normalize();
+            Vec3f reflection = trace(phit + nhit * bias, refldir, spheres, depth + 1);
+            surfaceColor = reflection * fresneleffect;
+            // a dielectric also transmits light (refraction ray)
+            if (Transparent) {
+                float ior = 1.1, eta = (hit.inside) ? ior : 1 / ior; // are we inside or outside the surface?
+                float cosi = -nhit.dot(raydir);
+                float k = 1 - eta * eta * (1 - cosi * cosi);
+                Vec3f refrdir = raydir * eta + nhit * (eta *  cosi - sqrt(k));
+                refrdir.normalize();
+                Vec3f refraction = trace(phit - nhit * bias, refrdir, spheres, depth + 1);
+                surfaceColor += refraction * (1 - fresneleffect) * sphere->transparency;
+            }
+            surfaceColor = surfaceColor * sphere->surfaceColor;
+        }
+        else
+        {
+            // diffuse (and specular) lighting, no need to raytrace any further
+            for (unsigned i = 0; i < spheres.size(); ++i)
+            {
+                if (spheres[i].emissionColor.x > 0)
+                {
+                    // this is a light
+                    Vec3f transmission = 1;
+                    Vec3f lightDirection = spheres[i].center - phit;
+                    lightDirection.normalize();
+                    for (unsigned j = 0; j < spheres.size(); ++j) {
+                        if (i != j) {
+                            float t0, t1;
+                            if (spheres[j].intersect(phit + nhit * bias, lightDirection, t0, t1)) {
+                                transmission = 0;
+                                break;
+                            }
+                        }
+                    }
+                    surfaceColor += sphere->surfaceColor * transmission *
+                    std::max(float(0), nhit.dot(lightDirection)) * spheres[i].emissionColor;
+                    if (SpecPower > 0) {
+                        // Blinn-Phong highlight: half vector between the light and the eye
+                        Vec3f halfway = lightDirection - raydir;
+                        halfway.normalize();
+                        surfaceColor += transmission * spheres[i].emissionColor *
+                            rt_powi(std::max(float(0), nhit.dot(halfway)), SpecPower);
+                    }
+                }
+            }
+        }
+        return surfaceColor + sphere->emissionColor;
+    }
+    //[comment]
+    // Shade a batch of primary hits that all use this material
+    //[/comment]
+    static void shadeBatch(const Hit *hits, unsigned count, const std::vector<Sphere> &spheres, Vec3f *image)
+    {
+        for (unsigned i = 0; i < count; ++i)
+            image[hits[i].pixel] = shade(hits[i], spheres, 0);
+    }
+};
+
+//[comment]
+// The material classes used by the scenes. Sphere::material is an index in this
+// list (see scene.h); add a line here and a case in the two tables below to
+// create a new one, e.g. a Blinn-Phong with a tighter highlight.
+//[/comment]
+static const unsigned BLINN_PHONG_POWER = 60;
+
+typedef MaterialKernel<false, false, 0>  DiffuseMaterial;
+typedef MaterialKernel<false, false, BLINN_PHONG_POWER> BlinnPhongMaterial;
+typedef MaterialKernel<true,  false, 0>  MirrorMaterial;
+typedef MaterialKernel<true,  true,  0>  DielectricMaterial;
+
+//[comment]
+// Shade a single hit (secondary rays). Reflected and refracted rays are too
+// incoherent to be worth batching, so they dispatch on the material here.
+//[/comment]
+inline Vec3f shadeHit(const Hit &hit, const std::vector<Sphere> &spheres, const int &depth)
+{
+    switch (hit.sphere->material) {
+        case MATERIAL_BLINN_PHONG: return BlinnPhongMaterial::shade(hit, spheres, depth);
+        case MATERIAL_MIRROR:      return MirrorMaterial::shade(hit, spheres, depth);
+        case MATERIAL_DIELECTRIC:  return DielectricMaterial::shade(hit, spheres, depth);
+        default:                   return DiffuseMaterial::shade(hit, spheres, depth);
+    }
+}
+
+typedef void (*ShadeBatchFn)(const Hit *, unsigned, const std::vector<Sphere> &, Vec3f *);
+
+static const ShadeBatchFn shadeBatch[MATERIAL_COUNT] = {
+    DiffuseMaterial::shadeBatch,
+    BlinnPhongMaterial::shadeBatch,
+    MirrorMaterial::shadeBatch,
+    DielectricMaterial::shadeBatch
+};
+
+#endif
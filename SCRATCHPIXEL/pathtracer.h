@@ -0,0 +1,351 @@
+#ifndef PATHTRACER_H
+#define PATHTRACER_H
+
+#include <cstdlib>
+#include <cmath>
+#include <cstring>
+#include <vector>
+#include <algorithm>
+
+#include "scene.h"
+#include "materials.h"
+#include "irradiance_cache.h"
+#include <rt_rng.h>
+#include <rt_sampler.h>
+
+//[comment]
+// Settings of the path tracing mode. Pixels are sampled in passes of
+// samplesPerPass samples; after minSamples a pixel stops as soon as the standard
+// error of its mean luminance drops below threshold (relative to the luminance),
+// and never takes more than maxSamples.
+// denoise runs the edge-aware filter of rt_denoise.h on the finished frame.
+// sampler picks where the random numbers of the paths come from.
+// cacheAccuracy > 0 takes the indirect light of the first diffuse hit of every
+// path from an irradiance cache (irradiance_cache.h): the smaller, the more
+// records and the closer to the path traced result.
+//[/comment]
+enum SamplerKind
+{
+    SAMPLER_BLUE_NOISE,     /// Sobol in the Morton order of the pixels (rt_sampler.h)
+    SAMPLER_SOBOL,          /// Sobol scrambled per pixel
+    SAMPLER_RANDOM          /// Philox white noise (rt_rng.h)
+};
+
+struct PathOptions
+{
+    PathOptions() : minSamples(16), maxSamples(1024), samplesPerPass(8), threshold(0.02), denoise(false), sampler(SAMPLER_BLUE_NOISE),
+        cacheAccuracy(0) {}
+    unsigned minSamples, maxSamples, samplesPerPass;
+    float threshold;
+    bool denoise;
+    SamplerKind sampler;
+    float cacheAccuracy;
+};
+
+//[comment]
+// Paths are at least this long before Russian roulette may stop them
+//[/comment]
+#define PATH_RR_DEPTH 3
+
+//[comment]
+// What the primary ray of a pixel hit, to guide the denoiser: id is the index
+// of the sphere, -1 for the background
+//[/comment]
+struct PathAux
+{
+    Vec3f normal, albedo;
+    float depth;
+    int id;
+};
+
+//[comment]
+// Running mean and variance of the luminance of a pixel (Welford's algorithm)
+// and the sum of its samples. count is also the index of the next sample, which
+// with the pixel and the frame picks its random numbers (rt_rng.h); aux is the
+// primary hit of the first sample.
+//[/comment]
+struct PixelEstimate
+{
+    Vec3f sum;
+    float mean, m2;
+    unsigned count;
+    bool done;
+    PathAux aux;
+    void reset()
+    {
+        sum = 0;
+        mean = m2 = 0;
+        count = 0;
+        done = false;
+    }
+    void add(const Vec3f &c)
+    {
+        sum += c;
+        float y = 0.2126 * c.x + 0.7152 * c.y + 0.0722 * c.z;
+        float delta = y - mean;
+        mean += delta / ++count;
+        m2 += delta * (y - mean);
+    }
+    //[comment]
+    // Converged once the standard error of the mean is small compared to the
+    // mean, or when the pixel is so bright it will be clamped to white anyway
+    //[/comment]
+    bool converged(const PathOptions &opts) const
+    {
+        if (count >= opts.maxSamples) return true;
+        if (count < opts.minSamples) return false;
+        float stderror = sqrt(m2 / ((count - 1) * float(count)));
+        return stderror <= opts.threshold * std::max(mean, 0.05f) || mean - 3 * stderror > 1;
+    }
+    //[comment]
+    // Variance of the mean luminance
+    //[/comment]
+    float variance() const { return count > 1 ? m2 / ((count - 1) * float(count)) : 0; }
+};
+
+//[comment]
+// The random numbers of a path sample. Every use has its own dimension so that
+// the low-discrepancy samplers stratify each decision separately: dimensions 0
+// and 1 jitter the pixel, then every bounce takes a block of dimensions (see
+// pathDimensions()). The first light and the cosine bounce of a diffuse hit share
+// its first set of four; Russian roulette, the Fresnel choice and the other
+// lights come next, so they only cost a second set when they are used.
+//[/comment]
+#define PATH_DIM_CAMERA 4
+enum { DIM_LIGHT, DIM_BOUNCE = 2, DIM_ROULETTE = 4, DIM_FRESNEL, DIM_MORE_LIGHTS };
+
+struct PathSampler
+{
+    SamplerKind kind;
+    t_sampler sobol;
+    t_rng rng;
+    //[comment]
+    // morton is the pixel's rt_sampler_morton() index for the blue noise order
+    //[/comment]
+    void init(SamplerKind k, unsigned pixel, uint32_t morton, unsigned sample, unsigned frame, int log2spp)
+    {
+        kind = k;
+        if (kind == SAMPLER_RANDOM) rt_rng_init(&rng, pixel, sample, frame);
+        else if (kind == SAMPLER_SOBOL) rt_sampler_init(&sobol, pixel, sample, frame);
+        else rt_sampler_init_zorder(&sobol, morton, sample, log2spp, frame);
+    }
+    void seek(unsigned dim)
+    {
+        if (kind == SAMPLER_RANDOM) rt_rng_seek(&rng, dim);
+        else rt_sampler_seek(&sobol, dim);
+    }
+    float next() { return kind == SAMPLER_RANDOM ? rt_rng_float(&rng) : rt_sampler_float(&sobol); }
+};
+
+//[comment]
+// Number of dimensions a bounce takes, rounded to the sets of four of rt_sampler.h
+//[/comment]
+inline unsigned pathDimensions(const std::vector<Sphere> &spheres)
+{
+    unsigned lights = 0;
+    for (unsigned i = 0; i < spheres.size(); ++i)
+        if (spheres[i].emissionColor.x > 0 || spheres[i].emissionColor.y > 0 || spheres[i].emissionColor.z > 0) ++lights;
+    unsigned more = lights > 1 ? 2 * (lights - 1) : 0;
+    return (DIM_MORE_LIGHTS + more + 3) & ~3u;
+}
+
+//[comment]
+// Orthonormal basis around n (Duff et al., "Building an Orthonormal Basis, Revisited")
+//[/comment]
+inline void basis(const Vec3f &n, Vec3f &b1, Vec3f &b2)
+{
+    float sign = copysignf(1.0f, n.z);
+    float a = -1.0f / (sign + n.z);
+    float b = n.x * n.y * a;
+    b1 = Vec3f(1.0f + sign * n.x * n.x * a, sign * b, -sign * n.x);
+    b2 = Vec3f(b, sign + n.y * n.y * a, -n.y);
+}
+
+//[comment]
+// Cosine weighted direction around n, pdf = cos / pi
+//[/comment]
+inline Vec3f sampleCosine(const Vec3f &n, float u, float v)
+{
+    Vec3f b1, b2;
+    basis(n, b1, b2);
+    float r = sqrt(u), phi = 2 * M_PI * v;
+    return b1 * (r * cos(phi)) + b2 * (r * sin(phi)) + n * sqrt(std::max(0.0f, 1 - r * r));
+}
+
+//[comment]
+// Next-event estimation: sample a direction in the cone of every emissive sphere
+// seen from the hit point and add its direct contribution if nothing is in the
+// way. Returns the reflected radiance (diffuse, plus the normalized Blinn-Phong
+// lobe for that material). dim is the first dimension of the bounce.
+//[/comment]
+inline Vec3f sampleLights(const Hit &hit, const std::vector<Sphere> &spheres, PathSampler &sampler, unsigned dim)
+{
+    Vec3f direct = 0;
+    Vec3f origin = hit.phit + hit.nhit * 1e-4;
+    unsigned lights = 0;
+    for (unsigned i = 0; i < spheres.size(); ++i) {
+        const Sphere &light = spheres[i];
+        if (light.emissionColor.x <= 0 && light.emissionColor.y <= 0 && light.emissionColor.z <= 0)
+            continue;
+        unsigned lightDim = dim + (lights++ ? DIM_MORE_LIGHTS + 2 * (lights - 2) : unsigned(DIM_LIGHT));
+        if (&light == hit.sphere) continue;
+        Vec3f w = light.center - origin;
+        float dist2 = w.dot(w);
+        if (dist2 <= light.radius2) continue;
+        w = w * (1 / sqrt(dist2));
+        // uniform direction in the cone subtended by the sphere
+        float cosmax = sqrt(1 - light.radius2 / dist2);
+        sampler.seek(lightDim);
+        float costheta = 1 - sampler.next() * (1 - cosmax);
+        float sintheta = sqrt(std::max(0.0f, 1 - costheta * costheta)), phi = 2 * M_PI * sampler.next();
+        Vec3f b1, b2;
+        basis(w, b1, b2);
+        Vec3f l = b1 * (sintheta * cos(phi)) + b2 * (sintheta * sin(phi)) + w * costheta;
+        float cosl = hit.nhit.dot(l);
+        if (cosl <= 0) continue;
+        float t;
+        if (nearestSphere(origin, l, spheres, t) != &light) continue;
+        // brdf * cos / pdf with pdf = 1 / (2 pi (1 - cosmax))
+        float weight = cosl * 2 * (1 - cosmax);
+        Vec3f brdf = hit.sphere->surfaceColor;
+        if (hit.sphere->material == MATERIAL_BLINN_PHONG) {
+            Vec3f halfway = l - hit.raydir;
+            halfway.normalize();
+            brdf += Vec3f((BLINN_PHONG_POWER + 8) / 8.0f * rt_powi(std::max(0.0f, hit.nhit.dot(halfway)), BLINN_PHONG_POWER));
+        }
+        direct += brdf * light.emissionColor * weight;
+    }
+    return direct;
+}
+
+//[comment]
+// Settings of the irradiance cache: the radius of a record is clamped to
+// [IRRADIANCE_MIN_RADIUS, IRRADIANCE_MAX_RADIUS] (scene units), and a record
+// gathers IRRADIANCE_STRATA^2 paths, one per cell of a stratified grid of the
+// cosine weighted hemisphere.
+//[/comment]
+#define IRRADIANCE_MIN_RADIUS 0.1f
+#define IRRADIANCE_MAX_RADIUS 8.0f
+#define IRRADIANCE_RECORDS (1 << 17)
+#define IRRADIANCE_STRATA 12
+
+inline Vec3f tracePath(Vec3f rayorig, Vec3f raydir, const std::vector<Sphere> &spheres, PathSampler &sampler,
+    PathAux *aux = NULL, IrradianceCache *cache = NULL, bool specular = true);
+
+//[comment]
+// Indirect light arriving at a diffuse hit (the mean over the cosine weighted
+// hemisphere, without the light next-event estimation already sampled), from
+// the cache, or gathered and added to it. The paths of a record take their
+// random numbers from its position, so the same record comes out of the same
+// point whichever pixel needs it first.
+//[/comment]
+inline Vec3f cachedIndirect(const Hit &hit, const std::vector<Sphere> &spheres, IrradianceCache &cache)
+{
+    Vec3f value;
+    if (cache.lookup(hit.phit, hit.nhit, value)) return value;
+    uint32_t bits[3];
+    memcpy(bits, &hit.phit, sizeof(bits));
+    uint32_t key = bits[0] * 0x9E3779B1u ^ bits[1] * 0x85EBCA77u ^ bits[2] * 0xC2B2AE3Du;
+    Vec3f origin = hit.phit + hit.nhit * 1e-4, sum = 0;
+    float inverse = 0;
+    for (unsigned j = 0; j < IRRADIANCE_STRATA * IRRADIANCE_STRATA; ++j) {
+        PathSampler sampler;
+        sampler.init(SAMPLER_RANDOM, key, 0, j, 0, 0);
+        float u = (j % IRRADIANCE_STRATA + sampler.next()) / IRRADIANCE_STRATA;
+        float v = (j / IRRADIANCE_STRATA + sampler.next()) / IRRADIANCE_STRATA;
+        PathAux aux;
+        sum += tracePath(origin, sampleCosine(hit.nhit, u, v), spheres, sampler, &aux, NULL, false);
+        if (aux.id >= 0) inverse += 1 / std::max(aux.depth, 1e-4f);
+    }
+    float rays = IRRADIANCE_STRATA * IRRADIANCE_STRATA;
+    value = sum * (1 / rays);
+    cache.insert(hit.phit, hit.nhit, value, inverse > 0 ? rays / inverse : IRRADIANCE_MAX_RADIUS);
+    return value;
+}
+
+//[comment]
+// One path sample. Diffuse surfaces get their direct light from next-event
+// estimation and continue with a cosine weighted bounce, mirrors and dielectrics
+// follow their specular direction (a dielectric picks reflection or refraction
+// with the probability of the same Fresnel mix trace() uses). Emission is only
+// added when it could not have been sampled by next-event estimation. After
+// PATH_RR_DEPTH bounces Russian roulette ends the path with a probability that
+// grows as its throughput drops, instead of the hard MAX_RAY_DEPTH cut.
+// If aux is not NULL it receives the primary hit. With a cache, the path ends
+// at its first diffuse hit with the indirect light of cachedIndirect().
+// specular = false leaves out the emission of the first hit (the path starts
+// at a diffuse bounce).
+//[/comment]
+inline Vec3f tracePath(Vec3f rayorig, Vec3f raydir, const std::vector<Sphere> &spheres, PathSampler &sampler,
+    PathAux *aux, IrradianceCache *cache, bool specular)
+{
+    Vec3f radiance = 0, throughput = 1;
+    float bias = 1e-4;
+    unsigned stride = pathDimensions(spheres);
+    for (unsigned depth = 0; ; ++depth) {
+        unsigned dim = PATH_DIM_CAMERA + depth * stride;
+        Hit hit;
+        if (!intersectScene(rayorig, raydir, spheres, hit)) {
+            radiance += throughput * Vec3f(2); // same background as trace()
+            if (aux && depth == 0) aux->normal = 0, aux->albedo = 1, aux->depth = 0, aux->id = -1;
+            break;
+        }
+        const Sphere *sphere = hit.sphere;
+        if (aux && depth == 0) {
+            aux->normal = hit.nhit;
+            aux->albedo = sphere->surfaceColor;
+            aux->depth = (hit.phit - rayorig).length();
+            aux->id = int(sphere - &spheres[0]);
+        }
+        if (specular) radiance += throughput * sphere->emissionColor;
+        if (depth >= PATH_RR_DEPTH) {
+            float survive = std::min(std::max(throughput.x, std::max(throughput.y, throughput.z)), 0.95f);
+            sampler.seek(dim + DIM_ROULETTE);
+            if (sampler.next() >= survive) break;
+            throughput = throughput * (1 / survive);
+        }
+        const Vec3f &nhit = hit.nhit;
+        if (sphere->material == MATERIAL_MIRROR || sphere->material == MATERIAL_DIELECTRIC) {
+            float facingratio = -raydir.dot(nhit);
+            float fresneleffect = mix(rt_pow_shading(1 - facingratio, 3), 1, 0.1);
+            bool reflect = true;
+            if (sphere->material == MATERIAL_DIELECTRIC) {
+                float ior = 1.1, eta = (hit.inside) ? ior : 1 / ior;
+                float k = 1 - eta * eta * (1 - facingratio * facingratio);
+                sampler.seek(dim + DIM_FRESNEL);
+                if (k >= 0 && sampler.next() >= fresneleffect) {
+                    reflect = false;
+                    raydir = raydir * eta + nhit * (eta * facingratio - sqrt(k));
+                    raydir.normalize();
+                    rayorig = hit.phit - nhit * bias;
+                    throughput = throughput * sphere->surfaceColor * sphere->transparency;
+                }
+                else throughput = throughput * sphere->surfaceColor;
+            }
+            else throughput = throughput * sphere->surfaceColor * fresneleffect;
+            if (reflect) {
+                raydir = raydir - nhit * 2 * raydir.dot(nhit);
+                raydir.normalize();
+                rayorig = hit.phit + nhit * bias;
+            }
+            specular = true;
+        }
+        else {
+            radiance += throughput * sampleLights(hit, spheres, sampler, dim);
+            throughput = throughput * sphere->surfaceColor;
+            if (cache) {
+                radiance += throughput * cachedIndirect(hit, spheres, *cache);
+                break;
+            }
+            rayorig = hit.phit + nhit * bias;
+            sampler.seek(dim + DIM_BOUNCE);
+            float u = sampler.next(), v = sampler.next();
+            raydir = sampleCosine(nhit, u, v);
+            specular = false;
+        }
+        if (throughput.x <= 0 && throughput.y <= 0 && throughput.z <= 0) break;
+    }
+    return radiance;
+}
+
+#endif
@@ -2,7 +2,8 @@
 // A very basic raytracer example.
 // [/header]
 // [compile]
-// c++ -o raytracer -O3 -Wall raytracer.cpp
+// c++ -o raytracer -O3 -march=native -Wall -pthread -I../includes raytracer.cpp
+// add -DRT_FAST_MATH for the fast-math shading path (see includes/rt_vec.h)
 // [/compile]
 // [ignore]
 // Copyright (C) 2012  www.scratchapixel.com
@@ -27,102 +28,43 @@
 #include <vector>
 #include <iostream>
 #include <cassert>
+#include <cstring>
+#include <string>
+#include <chrono>
 
-#if defined __linux__ || defined __APPLE__
-// "Compiled for Linux
-#else
-// Windows doesn't define these values by default, Linux does
-#define M_PI 3.141592653589793
-#define INFINITY 1e8
-#endif
-
-template<typename T>
-class Vec3
-{
-public:
-    T x, y, z;
-    Vec3() : x(T(0)), y(T(0)), z(T(0)) {}
-    Vec3(T xx) : x(xx), y(xx), z(xx) {}
-    Vec3(T xx, T yy, T zz) : x(xx), y(yy), z(zz) {}
-    Vec3& normalize()
-    {
-        T nor2 = length2();
-        if (nor2 > 0) {
-            T invNor = 1 / sqrt(nor2);
-            x *= invNor, y *= invNor, z *= invNor;
-        }
-        return *this;
-    }
-    Vec3<T> operator * (const T &f) const { return Vec3<T>(x * f, y * f, z * f); }
-    Vec3<T> operator * (const Vec3<T> &v) const { return Vec3<T>(x * v.x, y * v.y, z * v.z); }
-    T dot(const Vec3<T> &v) const { return x * v.x + y * v.y + z * v.z; }
-    Vec3<T> operator - (const Vec3<T> &v) const { return Vec3<T>(x - v.x, y - v.y, z - v.z); }
-    Vec3<T> operator + (const Vec3<T> &v) const { return Vec3<T>(x + v.x, y + v.y, z + v.z); }
-    Vec3<T>& operator += (const Vec3<T> &v) { x += v.x, y += v.y, z += v.z; return *this; }
-    Vec3<T>& operator *= (const Vec3<T> &v) { x *= v.x, y *= v.y, z *= v.z; return *this; }
-    Vec3<T> operator - () const { return Vec3<T>(-x, -y, -z); }
-    T length2() const { return x * x + y * y + z * z; }
-    T length() const { return sqrt(length2()); }
-    friend std::ostream & operator << (std::ostream &os, const Vec3<T> &v)
-    {
-        os << "[" << v.x << " " << v.y << " " << v.z << "]";
-        return os;
-    }
-};
-
-typedef Vec3<float> Vec3f;
-
-class Sphere
-{
-public:
-    Vec3f center;                           /// position of the sphere
-    float radius, radius2;                  /// sphere radius and radius^2
-    Vec3f surfaceColor, emissionColor;      /// surface color and emission (light)
-    float transparency, reflection;         /// surface transparency and reflectivity
-    Sphere(
-        const Vec3f &c,
-        const float &r,
-        const Vec3f &sc,
-        const float &refl = 0,
-        const float &transp = 0,
-        const Vec3f &ec = 0) :
-        center(c), radius(r), radius2(r * r), surfaceColor(sc), emissionColor(ec),
-        transparency(transp), reflection(refl)
-    { /* empty */ }
-    //[comment]
-    // Compute a ray-sphere intersection using the geometric solution
-    //[/comment]
-    bool intersect(const Vec3f &rayorig, const Vec3f &raydir, float &t0, float &t1) const
-    {
-        Vec3f l = center - rayorig;
-        float tca = l.dot(raydir);
-        if (tca < 0) return false;
-        float d2 = l.dot(l) - tca * tca;
-        if (d2 > radius2) return false;
-        float thc = sqrt(radius2 - d2);
-        t0 = tca - thc;
-        t1 = tca + thc;
-        
-        return true;
-    }
-};
+#include "scene.h"
+#include "animation.h"
+#include "render_context.h"
+#include <rt_perf.h>
 
 //[comment]
-// This variable controls the maximum recursion depth
+// Command line settings
 //[/comment]
-#define MAX_RAY_DEPTH 5
-
-float mix(const float &a, const float &b, const float &mix)
+struct Options
 {
-    return b * mix + a * (1 - mix);
-}
+    Options() : width(640), height(480), threads(0), affinity(RT_AFFINITY_NONE), animate(false), pathTrace(false),
+        output("./untitled.ppm"), stream(SINK_PPM), fps(25), depth(2), order(RT_CURVE_ROWS), perf(false),
+        checkpointSeconds(60) {}
+    unsigned width, height, threads;
+    t_affinity affinity;
+    bool animate, pathTrace;
+    PathOptions path;
+    std::string output;
+    SinkFormat stream;
+    unsigned fps, depth;
+    t_curve order;
+    bool perf;
+    std::string checkpoint;
+    double checkpointSeconds;
+};
 
 //[comment]
 // This is the main trace function. It takes a ray as argument (defined by its origin
 // and direction). We test if this ray intersects any of the geometry in the scene.
 // If the ray intersects an object, we compute the intersection point, the normal
 // at the intersection point, and shade this point using this information.
-// Shading depends on the surface property (is it transparent, reflective, diffuse).
+// Shading depends on the surface property (is it transparent, reflective, diffuse):
+// each material class has its own kernel in materials.h.
 // The function returns a color for the ray. If the ray intersects an object that
 // is the color of the object at the intersection point, otherwise it returns
 // the background color.
@@ -134,127 +76,194 @@ Vec3f trace(
     const int &depth)
 {
     //if (raydir.length() != 1) std::cerr << "Error " << raydir << std::endl;
-    float tnear = INFINITY;
-    const Sphere* sphere = NULL;
-    // find intersection of this ray with the sphere in the scene
-    for (unsigned i = 0; i < spheres.size(); ++i) {
-        float t0 = INFINITY, t1 = INFINITY;
-        if (spheres[i].intersect(rayorig, raydir, t0, t1)) {
-            if (t0 < 0) t0 = t1;
-            if (t0 < tnear) {
-                tnear = t0;
-                sphere = &spheres[i];
-            }
-        }
-    }
+    Hit hit;
     // if there's no intersection return black or background color
-    if (!sphere) return Vec3f(2);
-    Vec3f surfaceColor = 0; // color of the ray/surfaceof the object intersected by the ray
-    Vec3f phit = rayorig + raydir * tnear; // point of intersection
-    Vec3f nhit = phit - sphere->center; // normal at the intersection point
-    nhit.normalize(); // normalize normal direction
-    // If the normal and the view direction are not opposite to each other
-    // reverse the normal direction. That also means we are inside the sphere so set
-    // the inside bool to true. Finally reverse the sign of IdotN which we want
-    // positive.
-    float bias = 1e-4; // add some bias to the point from which we will be tracing
-    bool inside = false;
-    if (raydir.dot(nhit) > 0) nhit = -nhit, inside = true;
-    if ((sphere->transparency > 0 || sphere->reflection > 0) && depth < MAX_RAY_DEPTH) {
-        float facingratio = -raydir.dot(nhit);
-        // change the mix value to tweak the effect
-        float fresneleffect = mix(pow(1 - facingratio, 3), 1, 0.1);
-        // compute reflection direction (not need to normalize because all vectors
-        // are already normalized)
-        Vec3f refldir = raydir - nhit * 2 * raydir.dot(nhit);
-        refldir.normalize();
-        Vec3f reflection = trace(phit + nhit * bias, refldir, spheres, depth + 1);
-        Vec3f refraction = 0;
-        // if the sphere is also transparent compute refraction ray (transmission)
-        if (sphere->transparency) {
-            float ior = 1.1, eta = (inside) ? ior : 1 / ior; // are we inside or outside the surface?
-            float cosi = -nhit.dot(raydir);
-            float k = 1 - eta * eta * (1 - cosi * cosi);
-            Vec3f refrdir = raydir * eta + nhit * (eta *  cosi - sqrt(k));
-            refrdir.normalize();
-            refraction = trace(phit - nhit * bias, refrdir, spheres, depth + 1);
-        }
-        // the result is a mix of reflection and refraction (if the sphere is transparent)
-        surfaceColor = (
-            reflection * fresneleffect +
-            refraction * (1 - fresneleffect) * sphere->transparency) * sphere->surfaceColor;
-    }
-    else
-    {
-        // it's a diffuse object, no need to raytrace any further
-        for (unsigned i = 0; i < spheres.size(); ++i)
-        {
-            if (spheres[i].emissionColor.x > 0)
-            {
-                // this is a light
-                Vec3f transmission = 1;
-                Vec3f lightDirection = spheres[i].center - phit;
-                lightDirection.normalize();
-                for (unsigned j = 0; j < spheres.size(); ++j) {
-                    if (i != j) {
-                        float t0, t1;
-                        if (spheres[j].intersect(phit + nhit * bias, lightDirection, t0, t1)) {
-                            transmission = 0;
-                            break;
-                        }
-                    }
-                }
-                surfaceColor += sphere->surfaceColor * transmission *
-                std::max(float(0), nhit.dot(lightDirection)) * spheres[i].emissionColor;
-            }
+    if (!intersectScene(rayorig, raydir, spheres, hit)) return Vec3f(2);
+    return shadeHit(hit, spheres, depth);
+}
+
+//[comment]
+// Hash (FNV-1a) of the scene of every frame and of where the frames go, to
+// tell whether a checkpoint belongs to this render
+//[/comment]
+uint64_t jobHash(const std::vector<Sphere> &spheres, const Animation &anim, const Options &opts)
+{
+    uint64_t hash = 14695981039346656037ull;
+    auto mix = [&](const void *p, size_t n) {
+        for (size_t i = 0; i < n; ++i) hash = (hash ^ ((const unsigned char *)p)[i]) * 1099511628211ull;
+    };
+    auto vec = [&](const Vec3f &v) { mix(&v.x, 4); mix(&v.y, 4); mix(&v.z, 4); };
+    mix(&anim.frames, sizeof(anim.frames));
+    mix(opts.output.c_str(), opts.output.size() + 1);
+    mix(&opts.stream, sizeof(opts.stream));
+    std::vector<Sphere> frameSpheres;
+    Camera cam;
+    for (unsigned frame = 0; frame < anim.frames; ++frame) {
+        anim.evaluate(frame, spheres, frameSpheres, cam);
+        vec(cam.origin);
+        vec(cam.forward);
+        vec(cam.up);
+        mix(&cam.fov, 4);
+        for (const Sphere &s : frameSpheres) {
+            vec(s.center);
+            vec(s.surfaceColor);
+            vec(s.emissionColor);
+            mix(&s.radius, 4);
+            mix(&s.transparency, 4);
+            mix(&s.reflection, 4);
+            mix(&s.material, sizeof(s.material));
         }
     }
-    
-    return surfaceColor + sphere->emissionColor;
+    return hash;
 }
 
 //[comment]
 // Main rendering function. We compute a camera ray for each pixel of the image
 // trace it and return a color. If the ray hits a sphere, we return the color of the
 // sphere at the intersection point, else we return the background color.
+// Every frame of the animation is rendered through the same RenderContext so the
+// threads and framebuffers are only set up once; frame N is written to disk (or
+// to the stream) while frame N + 1 is traced.
 //[/comment]
-void render(const std::vector<Sphere> &spheres)
+bool render(const std::vector<Sphere> &spheres, const Animation &anim, const Options &opts, double &rays)
 {
-    unsigned width = 640, height = 480;
-    Vec3f *image = new Vec3f[width * height], *pixel = image;
-    float invWidth = 1 / float(width), invHeight = 1 / float(height);
-    float fov = 30, aspectratio = width / float(height);
-    float angle = tan(M_PI * 0.5 * fov / 180.);
-    // Trace rays
-    for (unsigned y = 0; y < height; ++y) {
-        for (unsigned x = 0; x < width; ++x, ++pixel) {
-            float xx = (2 * ((x + 0.5) * invWidth) - 1) * angle * aspectratio;
-            float yy = (1 - 2 * ((y + 0.5) * invHeight)) * angle;
-            Vec3f raydir(xx, yy, -1);
-            raydir.normalize();
-            *pixel = trace(Vec3f(0), raydir, spheres, 0);
+    RenderContext context(opts.width, opts.height, opts.threads, opts.affinity, opts.depth, opts.order);
+    if (opts.stream != SINK_PPM && !context.setStream(opts.stream, opts.output, opts.fps)) {
+        std::cerr << "cannot open stream " << opts.output << std::endl;
+        return false;
+    }
+    if (opts.pathTrace) context.setPathTracing(opts.path);
+    if (!opts.checkpoint.empty()
+        && !context.setCheckpoint(opts.checkpoint, opts.checkpointSeconds, jobHash(spheres, anim, opts))) {
+        std::cerr << "cannot write checkpoint " << opts.checkpoint << std::endl;
+        return false;
+    }
+    std::vector<Sphere> frameSpheres;
+    Camera cam;
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (unsigned frame = 0; frame < anim.frames; ++frame) {
+        anim.evaluate(frame, spheres, frameSpheres, cam);
+        std::string path = opts.output;
+        if (opts.animate && opts.stream == SINK_PPM) {
+            char name[32];
+            snprintf(name, sizeof(name), "%04u.ppm", frame);
+            path += name;
         }
+        if (!context.renderFrame(frameSpheres, cam, path)) break;
     }
-    // Save result to a PPM image (keep these flags if you compile under Windows)
-    std::ofstream ofs("./untitled.ppm", std::ios::out | std::ios::binary);
-    ofs << "P6\n" << width << " " << height << "\n255\n";
-    for (unsigned i = 0; i < width * height; ++i) {
-        ofs << (unsigned char)(std::min(float(1), image[i].x) * 255) <<
-               (unsigned char)(std::min(float(1), image[i].y) * 255) <<
-               (unsigned char)(std::min(float(1), image[i].z) * 255);
+    if (!context.finish()) {
+        std::cerr << "cannot write " << opts.output << std::endl;
+        return false;
     }
-    ofs.close();
-    delete [] image;
+    context.completeCheckpoint();
+    rays = double(opts.width) * opts.height * anim.frames;
+    if (opts.pathTrace) {
+        rays *= context.samplesPerPixel();
+        fprintf(stderr, "path tracing: %.1f samples per pixel on average (max %u)\n",
+            context.samplesPerPixel(), opts.path.maxSamples);
+        if (opts.path.cacheAccuracy > 0)
+            fprintf(stderr, "irradiance cache: %u records\n", context.irradianceRecords());
+    }
+    if (opts.animate) {
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        fprintf(stderr, "%u frames in %.2fs on %u threads (%.0f frames/hour)\n",
+            anim.frames, seconds, context.threads(), anim.frames * 3600 / seconds);
+    }
+    return true;
 }
 
 //[comment]
 // In the main function, we will create the scene which is composed of 5 spheres
 // and 1 light (which is also a sphere). Then, once the scene description is complete
 // we render that scene, by calling the render() function.
+// Without arguments a single frame is written to ./untitled.ppm. Animation mode:
+//
+//     raytracer -frames 1000 [-anim path.txt] [-o prefix] [-size w h] [-threads n]
+//
+// renders a turntable (or the keyframes of path.txt) to prefix0000.ppm, prefix0001.ppm...
+// -pt switches to the path tracer (global illumination); -spp n caps the samples
+// per pixel and -threshold e sets the relative noise level at which a pixel stops.
+// -denoise filters the path traced frames before they are written (rt_denoise.h).
+// -icache a interpolates the indirect light of diffuse surfaces from an
+// irradiance cache (irradiance_cache.h) with accuracy a (0.2 is a good start).
+// -sampler bluenoise|sobol|random picks the sample sequence of the path tracer.
+// -affinity compact|scatter|nosmt pins the worker threads to cpus (rt_affinity.h):
+// scatter spreads them over the sockets first, nosmt leaves the SMT siblings out.
+// -stream y4m|rgb sends every frame to one stream for a video encoder instead
+// (frame_sink.h): stdout, or the file or named pipe given with -o. -fps sets
+// the frame rate of the y4m header, -queue n how many frames may be in flight.
+// -order rows|morton|hilbert is the order the tiles and the pixels of a tile
+// are traced in (rt_curve.h), -perf prints the last level cache misses of the
+// render per camera ray (rt_perf.h) to compare them.
+// -checkpoint file [seconds] saves the progress of the render to file every
+// seconds (60 by default, see checkpoint.h); running the same command again
+// after a crash or a kill resumes from there. It does not go with -stream: the
+// frames before the checkpoint are not rendered again, and a stream cannot
+// keep them (its file is truncated when it is opened, stdout cannot send them
+// again).
 //[/comment]
 int main(int argc, char **argv)
 {
-    srand48(13);
+    Options opts;
+    Animation anim;
+    const char *animPath = NULL;
+    unsigned frames = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (!strcmp(argv[i], "-frames") && i + 1 < argc) frames = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-anim") && i + 1 < argc) animPath = argv[++i];
+        else if (!strcmp(argv[i], "-o") && i + 1 < argc) opts.output = argv[++i];
+        else if (!strcmp(argv[i], "-threads") && i + 1 < argc) opts.threads = atoi(argv[++i]);
+        else if (!strcmp(argv[i], "-pt")) opts.pathTrace = true;
+        else if (!strcmp(argv[i], "-spp") && i + 1 < argc) opts.path.maxSamples = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-threshold") && i + 1 < argc) opts.path.threshold = atof(argv[++i]);
+        else if (!strcmp(argv[i], "-denoise")) opts.path.denoise = true;
+        else if (!strcmp(argv[i], "-icache") && i + 1 < argc) opts.path.cacheAccuracy = std::max(0.0, atof(argv[++i]));
+        else if (!strcmp(argv[i], "-sampler") && i + 1 < argc) {
+            ++i;
+            if (!strcmp(argv[i], "random")) opts.path.sampler = SAMPLER_RANDOM;
+            else if (!strcmp(argv[i], "sobol")) opts.path.sampler = SAMPLER_SOBOL;
+            else opts.path.sampler = SAMPLER_BLUE_NOISE;
+        }
+        else if (!strcmp(argv[i], "-affinity") && i + 1 < argc && rt_affinity_parse(argv[i + 1]) >= 0)
+            opts.affinity = (t_affinity)rt_affinity_parse(argv[++i]);
+        else if (!strcmp(argv[i], "-stream") && i + 1 < argc && (!strcmp(argv[i + 1], "y4m") || !strcmp(argv[i + 1], "rgb")))
+            opts.stream = !strcmp(argv[++i], "y4m") ? SINK_Y4M : SINK_RGB;
+        else if (!strcmp(argv[i], "-order") && i + 1 < argc && rt_curve_parse(argv[i + 1]) >= 0)
+            opts.order = (t_curve)rt_curve_parse(argv[++i]);
+        else if (!strcmp(argv[i], "-perf")) opts.perf = true;
+        else if (!strcmp(argv[i], "-checkpoint") && i + 1 < argc) {
+            opts.checkpoint = argv[++i];
+            if (i + 1 < argc && atof(argv[i + 1]) > 0) opts.checkpointSeconds = atof(argv[++i]);
+        }
+        else if (!strcmp(argv[i], "-fps") && i + 1 < argc) opts.fps = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-queue") && i + 1 < argc) opts.depth = std::max(1, atoi(argv[++i]));
+        else if (!strcmp(argv[i], "-size") && i + 2 < argc) {
+            opts.width = atoi(argv[++i]);
+            opts.height = atoi(argv[++i]);
+        }
+        else {
+            std::cerr << "usage: " << argv[0] << " [-frames n] [-anim path] [-o prefix] [-size w h] [-threads n] [-pt] [-spp n] [-threshold e] [-denoise] [-icache a] [-sampler s] [-affinity policy] [-stream y4m|rgb] [-fps n] [-queue n] [-order curve] [-perf] [-checkpoint file [seconds]]" << std::endl;
+            return 1;
+        }
+    }
+    if (animPath) {
+        if (!anim.load(animPath)) {
+            std::cerr << "cannot read animation " << animPath << std::endl;
+            return 1;
+        }
+        opts.animate = true;
+    }
+    else if (frames > 0) {
+        anim.turntable(frames, Vec3f(0, 0, -20), 20, 5);
+        opts.animate = true;
+    }
+    if (!opts.checkpoint.empty() && opts.stream != SINK_PPM) {
+        std::cerr << "-checkpoint cannot be used with -stream" << std::endl;
+        return 1;
+    }
+    if (frames > 0) anim.frames = frames;
+    if (opts.stream != SINK_PPM && opts.output == "./untitled.ppm") opts.output = "-";
+    else if (opts.animate && opts.output == "./untitled.ppm") opts.output = "frame";
     std::vector<Sphere> spheres;
     // position, radius, surface color, reflectivity, transparency, emission color
     spheres.push_back(Sphere(Vec3f( 0.0, -10004, -20), 10000, Vec3f(0.20, 0.20, 0.20), 0, 0.0));
@@ -264,7 +273,15 @@ int main(int argc, char **argv)
     spheres.push_back(Sphere(Vec3f(-5.5,      0, -15),     3, Vec3f(0.90, 0.90, 0.90), 0, 0.0));
     // light
     spheres.push_back(Sphere(Vec3f( 0.0,     20, -30),     3, Vec3f(0.00, 0.00, 0.00), 0, 0.0, Vec3f(3)));
-    render(spheres);
+    // the counters also count the render threads, once render() has joined them
+    t_perf perf = {{-1, -1}};
+    if (opts.perf) rt_perf_open(&perf);
+    double rays = 0;
+    if (!render(spheres, anim, opts, rays)) return 1;
+    if (opts.perf) {
+        rt_perf_report(&perf, "render", rays);
+        rt_perf_close(&perf);
+    }
     
     return 0;
-}
\ No newline at end of file
+}
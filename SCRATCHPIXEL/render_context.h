@@ -0,0 +1,423 @@
+#ifndef RENDER_CONTEXT_H
+#define RENDER_CONTEXT_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <algorithm>
+
+#include "scene.h"
+#include "materials.h"
+#include "pathtracer.h"
+#include "threadpool.h"
+#include "frame_sink.h"
+#include "checkpoint.h"
+#include <rt_denoise.h>
+#include <rt_curve.h>
+
+//[comment]
+// Everything that must survive from one frame to the next: the worker threads,
+// depth framebuffers (2 by default) and the writer thread. Frames are pipelined:
+// while the writer thread resolves frame N (clamp to bytes, hand it to the sink)
+// the workers are already tracing frame N + 1 into another framebuffer.
+// renderFrame() only blocks when the writer is depth - 1 frames behind, which
+// bounds the memory a slow sink (an encoder reading a pipe) can hold up.
+// The per-pixel arrays are first touched tile by tile by the worker that owns
+// the tile (see ThreadPool), so with pinned threads every worker mostly reads
+// and writes memory of its own NUMA node.
+// Tiles are handed out, and the pixels of a tile traced, in the order of a
+// curve of rt_curve.h: rows, or a Morton or Hilbert curve that keeps
+// consecutive rays (and the tiles of a worker) close together.
+// With setCheckpoint() the state of the frame being traced is saved from time
+// to time (checkpoint.h), and a render of the same job resumes from it.
+//[/comment]
+class RenderContext
+{
+public:
+    static const unsigned TILE_SIZE = 32;
+    RenderContext(unsigned w, unsigned h, unsigned nthreads = 0, t_affinity affinity = RT_AFFINITY_NONE,
+        unsigned depth = 2, t_curve order = RT_CURVE_ROWS) :
+        width(w), height(h), pool(nthreads, affinity), nslots(std::max(1u, depth)), slots(new Slot[nslots]),
+        current(0), stop(false), failed(false), pathTracing(false), frameIndex(0), pathSamples(0), framesDone(0)
+    {
+        denoiser.planes = NULL;
+        denoiser.id = NULL;
+        tilesx = (width + TILE_SIZE - 1) / TILE_SIZE;
+        tilesy = (height + TILE_SIZE - 1) / TILE_SIZE;
+        tileOrder.resize(tilesx * tilesy);
+        rt_curve_order(order, tilesx, tilesy, &tileOrder[0]);
+        rt_curve_order(order, TILE_SIZE, TILE_SIZE, pixelOrder);
+        sink.open(SINK_PPM, "", width, height, 0, nslots);
+        for (unsigned i = 0; i < nslots; ++i) {
+            slots[i].image.allocate(width * height);
+            slots[i].bytes.resize(sink.frameBytes());
+            slots[i].pending = false;
+        }
+        forEachSpan([&](unsigned begin, unsigned end) {
+            for (unsigned i = 0; i < nslots; ++i) slots[i].image.construct(begin, end);
+        }, false);
+        writer = std::thread(&RenderContext::writerLoop, this);
+    }
+    ~RenderContext()
+    {
+        finish();
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        queued.notify_all();
+        writer.join();
+        sink.close();
+        rt_denoise_free(&denoiser);
+    }
+    unsigned threads() const { return pool.size(); }
+    //[comment]
+    // Send the frames to a stream instead of PPM files (see frame_sink.h), before
+    // the first frame
+    //[/comment]
+    bool setStream(SinkFormat format, const std::string &path, unsigned fps)
+    {
+        if (!sink.open(format, path, width, height, fps, nslots)) return false;
+        for (unsigned i = 0; i < nslots; ++i) slots[i].bytes.resize(sink.frameBytes());
+        return true;
+    }
+    //[comment]
+    // Switch to the path tracer for every following frame
+    //[/comment]
+    void setPathTracing(const PathOptions &opts)
+    {
+        pathOptions = opts;
+        pathTracing = true;
+        if (!estimates.size()) {
+            estimates.allocate(width * height);
+            forEachSpan([&](unsigned begin, unsigned end) { estimates.construct(begin, end); }, false);
+        }
+        // the blue noise order needs the Morton index of the pixel and room for
+        // every sample it may take (a pass can overshoot maxSamples) in 32 bits
+        samplerKind = opts.sampler;
+        for (mortonBits = 0; (1u << mortonBits) < std::max(width, height); ++mortonBits) {}
+        for (log2spp = 0; (1u << log2spp) < opts.maxSamples + opts.samplesPerPass; ++log2spp) {}
+        if (samplerKind == SAMPLER_BLUE_NOISE && 2 * mortonBits + log2spp > 32) samplerKind = SAMPLER_SOBOL;
+        if (opts.denoise && !denoiser.planes && !rt_denoise_init(&denoiser, width, height))
+            pathOptions.denoise = false;
+        if (opts.cacheAccuracy > 0)
+            irradiance.configure(opts.cacheAccuracy, IRRADIANCE_MIN_RADIUS, IRRADIANCE_MAX_RADIUS, IRRADIANCE_RECORDS);
+        cachedSpheres.clear();
+    }
+    //[comment]
+    // Save checkpoints to path every seconds, after setPathTracing() if it is
+    // used, before the first frame. job is a hash of everything the frames
+    // depend on besides the settings of the context: a checkpoint of another
+    // job is ignored. The frames before the checkpointed one are then skipped.
+    //[/comment]
+    bool setCheckpoint(const std::string &path, double seconds, uint64_t job)
+    {
+        uint64_t hash = job;
+        auto mix = [&](uint64_t v) { hash = (hash ^ v) * 1099511628211ull; };
+        mix(width);
+        mix(height);
+        mix(pathTracing);
+        if (pathTracing) {
+            uint32_t threshold, accuracy;
+            memcpy(&threshold, &pathOptions.threshold, 4);
+            memcpy(&accuracy, &pathOptions.cacheAccuracy, 4);
+            mix(pathOptions.minSamples);
+            mix(pathOptions.maxSamples);
+            mix(pathOptions.samplesPerPass);
+            mix(threshold);
+            mix(pathOptions.denoise);
+            mix(samplerKind);
+            mix(accuracy);
+        }
+        if (!checkpoint.open(path, seconds, hash, pathTracing ? width * height : 0)) return false;
+        framesDone = checkpoint.resumeAt();
+        return true;
+    }
+    //[comment]
+    // Every frame is written: the checkpoint is not needed anymore
+    //[/comment]
+    void completeCheckpoint() { checkpoint.complete(); }
+    //[comment]
+    // Average number of path samples per pixel over all the frames traced so far
+    // (not those a checkpoint skipped)
+    //[/comment]
+    double samplesPerPixel() const
+    {
+        unsigned frames = frameIndex - std::min(frameIndex, checkpoint.resumeAt());
+        return frames ? pathSamples / (double(width) * height * frames) : 0;
+    }
+    //[comment]
+    // Number of records in the irradiance cache
+    //[/comment]
+    unsigned irradianceRecords() const { return irradiance.size(); }
+    //[comment]
+    // Trace one frame and queue it for writing to the given path (ignored by
+    // streams). Returns false once the sink failed, e.g. the encoder went away.
+    //[/comment]
+    bool renderFrame(const std::vector<Sphere> &spheres, const Camera &cam, const std::string &path)
+    {
+        Slot &slot = slots[current];
+        current = (current + 1) % nslots;
+        {
+            // wait for the writer to be done with this framebuffer
+            std::unique_lock<std::mutex> lock(mutex);
+            written.wait(lock, [&] { return !slot.pending; });
+            if (failed) return false;
+        }
+        if (frameIndex < checkpoint.resumeAt()) {
+            ++frameIndex;
+            return true;
+        }
+        if (checkpoint.due()) checkpoint.submit(frameIndex, false);
+        slot.spheres = spheres;
+        slot.camera = cam;
+        slot.path = path;
+        if (pathTracing)
+            renderPaths(slot);
+        else
+            forEachTile([&](unsigned tile) { traceTile(slot, tile); });
+        ++frameIndex;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slot.pending = true;
+            queue.push_back(&slot);
+        }
+        queued.notify_one();
+        return true;
+    }
+    //[comment]
+    // Wait until every queued frame has been written, false if one could not be
+    //[/comment]
+    bool finish()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        written.wait(lock, [&] { return queue.empty(); });
+        return !failed;
+    }
+private:
+    struct Slot
+    {
+        std::vector<Sphere> spheres;
+        Camera camera;
+        FirstTouchArray<Vec3f> image;
+        std::vector<unsigned char> bytes;
+        std::string path;
+        bool pending;
+    };
+    //[comment]
+    // Trace a tile in two steps: first intersect every primary ray and sort the
+    // hits by material (counting sort), then hand each group to its material
+    // kernel. Each kernel loops over hits of a single material so the shading
+    // loops never branch on the surface type.
+    //[/comment]
+    void traceTile(Slot &slot, unsigned tile)
+    {
+        unsigned x0 = (tile % tilesx) * TILE_SIZE, y0 = (tile / tilesx) * TILE_SIZE;
+        unsigned x1 = std::min(x0 + TILE_SIZE, width), y1 = std::min(y0 + TILE_SIZE, height);
+        Hit hits[TILE_SIZE * TILE_SIZE], sorted[TILE_SIZE * TILE_SIZE];
+        unsigned count[MATERIAL_COUNT] = {0}, start[MATERIAL_COUNT];
+        unsigned nhits = 0;
+        for (unsigned k = 0; k < TILE_SIZE * TILE_SIZE; ++k) {
+            unsigned x = x0 + pixelOrder[k] % TILE_SIZE, y = y0 + pixelOrder[k] / TILE_SIZE;
+            if (x >= x1 || y >= y1) continue;
+            Hit &hit = hits[nhits];
+            if (!intersectScene(slot.camera.origin, slot.camera.rayDirection(x, y, width, height), slot.spheres, hit)) {
+                slot.image[y * width + x] = Vec3f(2);
+                continue;
+            }
+            hit.pixel = y * width + x;
+            ++count[hit.sphere->material];
+            ++nhits;
+        }
+        for (unsigned m = 0, offset = 0; m < MATERIAL_COUNT; offset += count[m++]) start[m] = offset;
+        for (unsigned i = 0; i < nhits; ++i) sorted[start[hits[i].sphere->material]++] = hits[i];
+        for (unsigned m = 0, offset = 0; m < MATERIAL_COUNT; offset += count[m++])
+            if (count[m]) shadeBatch[m](sorted + offset, count[m], slot.spheres, &slot.image[0]);
+    }
+    //[comment]
+    // Adaptive path tracing: every pass adds samplesPerPass samples to the pixels
+    // that have not converged yet, until none is left. Converged pixels cost
+    // nothing, so the samples go where the noise is.
+    // The irradiance cache only depends on the spheres: it is kept from one
+    // frame to the next while they do not change (a camera path). It is not part
+    // of the checkpoints: a resumed frame gathers its records again, so with the
+    // cache it only matches an uninterrupted render up to the interpolation.
+    //[/comment]
+    void renderPaths(Slot &slot)
+    {
+        if (irradiance.enabled() && !sameSpheres(slot.spheres, cachedSpheres)) {
+            irradiance.clear();
+            cachedSpheres = slot.spheres;
+        }
+        if (const PixelEstimate *saved = checkpoint.resume(frameIndex))
+            forEachSpan([&](unsigned begin, unsigned end) { std::copy(saved + begin, saved + end, &estimates[begin]); });
+        else
+            forEachSpan([&](unsigned begin, unsigned end) {
+                for (unsigned i = begin; i < end; ++i) estimates[i].reset();
+            });
+        for (;;) {
+            std::atomic<unsigned> active(0);
+            forEachTile([&](unsigned tile) { active += pathTile(slot, tile); });
+            if (!active) break;
+            if (checkpoint.due()) {
+                PixelEstimate *snapshot = checkpoint.buffer();
+                forEachSpan([&](unsigned begin, unsigned end) { std::copy(&estimates[0] + begin, &estimates[0] + end, snapshot + begin); });
+                checkpoint.submit(frameIndex, true);
+            }
+        }
+        std::atomic<unsigned long long> samples(0);
+        forEachSpan([&](unsigned begin, unsigned end) {
+            unsigned long long count = 0;
+            for (unsigned i = begin; i < end; ++i) {
+                slot.image[i] = estimates[i].sum * (1.0f / estimates[i].count);
+                count += estimates[i].count;
+            }
+            samples += count;
+        });
+        pathSamples += samples;
+        if (pathOptions.denoise) denoise(slot);
+    }
+    //[comment]
+    // Filter the frame guided by the primary hits. Each step of the filter reads
+    // the whole output of the previous one, so the steps run one after the other
+    // and the rows of a step are split in bands between the workers.
+    //[/comment]
+    void denoise(Slot &slot)
+    {
+        // the planes are first touched here, by the same workers (with the rows
+        // order, the bands of a worker cover the rows of its tiles)
+        pool.parallelFor(tilesy, [&](unsigned band) {
+            for (unsigned i = band * TILE_SIZE * width; i < std::min((band + 1) * TILE_SIZE, height) * width; ++i) {
+                const PathAux &aux = estimates[i].aux;
+                rt_denoise_set(&denoiser, i, slot.image[i], estimates[i].variance(), aux.normal, aux.depth, aux.albedo, aux.id);
+            }
+        }, false);
+        for (int step = 0; step < denoiser.iterations; ++step)
+            pool.parallelFor(tilesy, [&](unsigned band) {
+                rt_denoise_rows(&denoiser, step, band * TILE_SIZE, std::min((band + 1) * TILE_SIZE, height));
+            });
+        pool.parallelFor(tilesy, [&](unsigned band) {
+            for (unsigned i = band * TILE_SIZE * width; i < std::min((band + 1) * TILE_SIZE, height) * width; ++i)
+                slot.image[i] = rt_denoise_get(&denoiser, i);
+        }, false);
+    }
+    //[comment]
+    // One pass over a tile, returns the number of pixels still sampling
+    //[/comment]
+    unsigned pathTile(Slot &slot, unsigned tile)
+    {
+        unsigned x0 = (tile % tilesx) * TILE_SIZE, y0 = (tile / tilesx) * TILE_SIZE;
+        unsigned x1 = std::min(x0 + TILE_SIZE, width), y1 = std::min(y0 + TILE_SIZE, height);
+        unsigned active = 0;
+        for (unsigned k = 0; k < TILE_SIZE * TILE_SIZE; ++k) {
+            unsigned x = x0 + pixelOrder[k] % TILE_SIZE, y = y0 + pixelOrder[k] / TILE_SIZE;
+            if (x >= x1 || y >= y1) continue;
+            PixelEstimate &e = estimates[y * width + x];
+            if (e.done) continue;
+            uint32_t morton = samplerKind == SAMPLER_BLUE_NOISE ? rt_sampler_morton(x, y, mortonBits, frameIndex) : 0;
+            for (unsigned s = 0; s < pathOptions.samplesPerPass; ++s) {
+                // the random numbers of a sample only depend on (pixel, sample, frame)
+                PathSampler sampler;
+                sampler.init(samplerKind, y * width + x, morton, e.count, frameIndex, log2spp);
+                // jitter the sample inside the pixel (rayDirection() aims at the center)
+                float dx = sampler.next() - 0.5f, dy = sampler.next() - 0.5f;
+                Vec3f raydir = slot.camera.rayDirection(x + dx, y + dy, width, height);
+                e.add(tracePath(slot.camera.origin, raydir, slot.spheres, sampler, e.count ? NULL : &e.aux,
+                    irradiance.enabled() ? &irradiance : NULL));
+            }
+            e.done = e.converged(pathOptions);
+            if (!e.done) ++active;
+        }
+        return active;
+    }
+    static bool sameSpheres(const std::vector<Sphere> &a, const std::vector<Sphere> &b)
+    {
+        if (a.size() != b.size()) return false;
+        for (unsigned i = 0; i < a.size(); ++i) {
+            const Sphere &s = a[i], &t = b[i];
+            if (s.center.x != t.center.x || s.center.y != t.center.y || s.center.z != t.center.z
+                || s.radius != t.radius || s.material != t.material
+                || s.transparency != t.transparency || s.reflection != t.reflection
+                || s.surfaceColor.x != t.surfaceColor.x || s.surfaceColor.y != t.surfaceColor.y || s.surfaceColor.z != t.surfaceColor.z
+                || s.emissionColor.x != t.emissionColor.x || s.emissionColor.y != t.emissionColor.y || s.emissionColor.z != t.emissionColor.z)
+                return false;
+        }
+        return true;
+    }
+    //[comment]
+    // Call f(tile) on every tile, in the order of the curve: the workers take
+    // consecutive runs of it, so the tiles of a worker are close together too
+    //[/comment]
+    template<typename F>
+    void forEachTile(const F &f, bool stealing = true)
+    {
+        pool.parallelFor(tilesx * tilesy, [&](unsigned k) { f(tileOrder[k]); }, stealing);
+    }
+    //[comment]
+    // Call f(begin, end) on the pixel range of every row of every tile, a tile on
+    // the worker that owns it when stealing is false (first touch)
+    //[/comment]
+    template<typename F>
+    void forEachSpan(const F &f, bool stealing = true)
+    {
+        forEachTile([&](unsigned tile) {
+            unsigned x0 = (tile % tilesx) * TILE_SIZE, y0 = (tile / tilesx) * TILE_SIZE;
+            unsigned x1 = std::min(x0 + TILE_SIZE, width), y1 = std::min(y0 + TILE_SIZE, height);
+            for (unsigned y = y0; y < y1; ++y) f(y * width + x0, y * width + x1);
+        }, stealing);
+    }
+    void writerLoop()
+    {
+        for (;;) {
+            Slot *slot;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                queued.wait(lock, [&] { return stop || !queue.empty(); });
+                if (queue.empty()) return;
+                slot = queue.front();
+            }
+            // after a failure the frames are dropped, the renderer stops at the next one
+            bool ok = false;
+            if (!failed) {
+                sink.resolve(&slot->image[0], &slot->bytes[0]);
+                ok = sink.write(&slot->bytes[0], slot->path);
+            }
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                queue.pop_front();
+                slot->pending = false;
+                if (!ok) failed = true;
+            }
+            written.notify_all();
+            if (ok) checkpoint.framesWritten(++framesDone);
+        }
+    }
+    unsigned width, height, tilesx, tilesy;
+    std::vector<int> tileOrder;
+    int pixelOrder[TILE_SIZE * TILE_SIZE];
+    ThreadPool pool;
+    unsigned nslots;
+    std::unique_ptr<Slot[]> slots;
+    FrameSink sink;
+    unsigned current;
+    std::thread writer;
+    std::mutex mutex;
+    std::condition_variable queued, written;
+    std::deque<Slot *> queue;
+    bool stop, failed;
+    bool pathTracing;
+    PathOptions pathOptions;
+    FirstTouchArray<PixelEstimate> estimates;
+    t_denoise denoiser;
+    IrradianceCache irradiance;
+    std::vector<Sphere> cachedSpheres;
+    SamplerKind samplerKind;
+    int mortonBits, log2spp;
+    unsigned frameIndex;
+    double pathSamples;
+    Checkpoint checkpoint;
+    unsigned framesDone;
+};
+
+#endif
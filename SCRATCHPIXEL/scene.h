@@ -0,0 +1,112 @@
+#ifndef SCENE_H
+#define SCENE_H
+
+#include <cmath>
+#include <iostream>
+#include <rt_vec.h>
+
+#if defined __linux__ || defined __APPLE__
+// "Compiled for Linux
+#else
+// Windows doesn't define these values by default, Linux does
+#define M_PI 3.141592653589793
+#define INFINITY 1e8
+#endif
+
+//[comment]
+// The vector class is the one shared with the other renderers of this repository
+// (includes/rt_vec.h): a 16 byte aligned float vector with inline, constexpr maths.
+//[/comment]
+typedef t_vec Vec3f;
+
+//[comment]
+// Material classes, one shading kernel each (see materials.h). By default a
+// sphere picks its class from its reflection and transparency values.
+//[/comment]
+enum Material
+{
+    MATERIAL_DIFFUSE,
+    MATERIAL_BLINN_PHONG,
+    MATERIAL_MIRROR,
+    MATERIAL_DIELECTRIC,
+    MATERIAL_COUNT
+};
+
+class Sphere
+{
+public:
+    Vec3f center;                           /// position of the sphere
+    float radius, radius2;                  /// sphere radius and radius^2
+    Vec3f surfaceColor, emissionColor;      /// surface color and emission (light)
+    float transparency, reflection;         /// surface transparency and reflectivity
+    Material material;                      /// shading kernel used for this sphere
+    Sphere(
+        const Vec3f &c,
+        const float &r,
+        const Vec3f &sc,
+        const float &refl = 0,
+        const float &transp = 0,
+        const Vec3f &ec = 0) :
+        center(c), radius(r), radius2(r * r), surfaceColor(sc), emissionColor(ec),
+        transparency(transp), reflection(refl),
+        material(transp > 0 ? MATERIAL_DIELECTRIC : refl > 0 ? MATERIAL_MIRROR : MATERIAL_DIFFUSE)
+    { /* empty */ }
+    //[comment]
+    // Compute a ray-sphere intersection using the geometric solution
+    //[/comment]
+    bool intersect(const Vec3f &rayorig, const Vec3f &raydir, float &t0, float &t1) const
+    {
+        Vec3f l = center - rayorig;
+        float tca = l.dot(raydir);
+        if (tca < 0) return false;
+        float d2 = l.dot(l) - tca * tca;
+        if (d2 > radius2) return false;
+        float thc = sqrt(radius2 - d2);
+        t0 = tca - thc;
+        t1 = tca + thc;
+        
+        return true;
+    }
+};
+
+//[comment]
+// A pinhole camera. The default camera sits at the origin and looks down the -z
+// axis, which is exactly the setup the original render() function used. lookAt()
+// builds an orthonormal basis so the camera can be moved along a path.
+//[/comment]
+class Camera
+{
+public:
+    Vec3f origin;                           /// position of the eye
+    Vec3f right, up, forward;               /// camera basis (forward points into the scene)
+    float fov;                              /// vertical field of view in degrees
+    Camera() : origin(0), right(1, 0, 0), up(0, 1, 0), forward(0, 0, -1), fov(30) {}
+    static Camera lookAt(const Vec3f &from, const Vec3f &to, const Vec3f &worldUp = Vec3f(0, 1, 0), float fov = 30)
+    {
+        Camera cam;
+        cam.origin = from;
+        cam.forward = to - from;
+        cam.forward.normalize();
+        cam.right = cam.forward.cross(worldUp);
+        cam.right.normalize();
+        cam.up = cam.right.cross(cam.forward);
+        cam.fov = fov;
+        return cam;
+    }
+    //[comment]
+    // Compute the direction of the primary ray going through the pixel (x, y)
+    //[/comment]
+    Vec3f rayDirection(float x, float y, unsigned width, unsigned height) const
+    {
+        float angle = tan(M_PI * 0.5 * fov / 180.);
+        float aspectratio = width / float(height);
+        float invWidth = 1 / float(width), invHeight = 1 / float(height);
+        float xx = (2 * ((x + 0.5) * invWidth) - 1) * angle * aspectratio;
+        float yy = (1 - 2 * ((y + 0.5) * invHeight)) * angle;
+        Vec3f raydir = right * xx + up * yy + forward;
+        raydir.normalize();
+        return raydir;
+    }
+};
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <functional>
+#include <vector>
+#include <memory>
+#include <new>
+#include <cstdlib>
+
+#include <rt_affinity.h>
+
+//[comment]
+// A persistent pool of worker threads. The threads are created once and are kept
+// alive for the whole life of the pool, so rendering many frames does not pay for
+// thread creation every time. parallelFor() hands out the indices [0, count) to
+// the workers (the calling thread helps too, as worker 0) and returns when all of
+// them are done.
+// Worker w owns the same slice [count * w / size, count * (w + 1) / size) every
+// call and takes its own indices first before it steals from the other slices,
+// so a tile is traced by the same worker frame after frame. With an affinity
+// policy (rt_affinity.h) the workers are pinned to their cpus, and running the
+// first-touch of the memory as parallelFor(count, f, false) (no stealing) puts
+// the pages of every slice on the node of the worker that will use them.
+// The calling thread is only pinned for the time of a parallelFor(): pinned for
+// good, it would hand the cpu of worker 0 to every thread it starts afterwards
+// (the frame writer of RenderContext).
+//[/comment]
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned nthreads = 0, t_affinity affinity = RT_AFFINITY_NONE) :
+        job(NULL), generation(0), busy(0), steal(true), stop(false)
+    {
+        if (nthreads == 0) nthreads = std::thread::hardware_concurrency();
+        if (nthreads == 0) nthreads = 1;
+        int order[RT_AFFINITY_MAX_CPUS];
+        cpus.assign(order, order + rt_affinity_plan(affinity, order, RT_AFFINITY_MAX_CPUS));
+        slices.reset(new Slice[nthreads]);
+        CPU_ZERO(&callerCpus);
+        if (!cpus.empty() && sched_getaffinity(0, sizeof(callerCpus), &callerCpus) != 0) cpus.clear();
+        // the calling thread works as well, so spawn one thread less
+        for (unsigned i = 1; i < nthreads; ++i)
+            workers.push_back(std::thread(&ThreadPool::workerLoop, this, i));
+    }
+    ~ThreadPool()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stop = true;
+        }
+        wake.notify_all();
+        for (unsigned i = 0; i < workers.size(); ++i)
+            workers[i].join();
+    }
+    unsigned size() const { return workers.size() + 1; }
+    //[comment]
+    // Cpu worker w is pinned to, -1 if the threads are not pinned
+    //[/comment]
+    int cpu(unsigned w) const { return cpus.empty() ? -1 : cpus[w % cpus.size()]; }
+    void parallelFor(unsigned n, const std::function<void(unsigned)> &f, bool stealing = true)
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            job = &f;
+            steal = stealing;
+            for (unsigned w = 0; w < size(); ++w) {
+                slices[w].next = (unsigned long long)n * w / size();
+                slices[w].end = (unsigned long long)n * (w + 1) / size();
+            }
+            busy = workers.size();
+            ++generation;
+        }
+        wake.notify_all();
+        pin(0);
+        run(f, 0);
+        if (!cpus.empty()) sched_setaffinity(0, sizeof(callerCpus), &callerCpus);
+        std::unique_lock<std::mutex> lock(mutex);
+        done.wait(lock, [this] { return busy == 0; });
+        job = NULL;
+    }
+private:
+    //[comment]
+    // The indices of a worker, padded to a cache line so the workers do not
+    // fight over the line holding each other's counter
+    //[/comment]
+    struct Slice
+    {
+        std::atomic<unsigned> next;
+        unsigned end;
+        char pad[64 - sizeof(std::atomic<unsigned>) - sizeof(unsigned)];
+    };
+    void pin(unsigned w)
+    {
+        if (!cpus.empty()) rt_affinity_pin(cpu(w));
+    }
+    void run(const std::function<void(unsigned)> &f, unsigned w)
+    {
+        unsigned n = steal ? size() : 1;
+        for (unsigned k = 0; k < n; ++k) {
+            Slice &slice = slices[(w + k) % size()];
+            for (unsigned i = slice.next++; i < slice.end; i = slice.next++)
+                f(i);
+        }
+    }
+    void workerLoop(unsigned w)
+    {
+        pin(w);
+        unsigned seen = 0;
+        for (;;) {
+            const std::function<void(unsigned)> *f;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                wake.wait(lock, [&] { return stop || generation != seen; });
+                if (stop) return;
+                seen = generation;
+                f = job;
+            }
+            run(*f, w);
+            std::lock_guard<std::mutex> lock(mutex);
+            if (--busy == 0) done.notify_one();
+        }
+    }
+    std::vector<std::thread> workers;
+    std::vector<int> cpus;
+    cpu_set_t callerCpus;
+    std::unique_ptr<Slice[]> slices;
+    std::mutex mutex;
+    std::condition_variable wake, done;
+    const std::function<void(unsigned)> *job;
+    unsigned generation, busy;
+    bool steal;
+    bool stop;
+};
+
+//[comment]
+// An array whose pages are not touched when it is allocated: construct() each
+// part from the thread that will use it (see ThreadPool above) and the pages
+// land on that thread's NUMA node. std::vector would zero the whole array from
+// the thread that resizes it, which puts all of it on one node.
+//[/comment]
+template<typename T>
+class FirstTouchArray
+{
+public:
+    FirstTouchArray() : data(NULL), n(0) {}
+    ~FirstTouchArray() { free(data); }
+    void allocate(size_t count)
+    {
+        free(data);
+        data = (T *)malloc(sizeof(T) * count);
+        n = count;
+    }
+    void construct(size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; ++i) new (&data[i]) T();
+    }
+    size_t size() const { return n; }
+    T &operator [] (size_t i) { return data[i]; }
+    const T &operator [] (size_t i) const { return data[i]; }
+private:
+    FirstTouchArray(const FirstTouchArray &);
+    FirstTouchArray &operator = (const FirstTouchArray &);
+    T *data;
+    size_t n;
+};
+
+#endif
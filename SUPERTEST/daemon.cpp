@@ -0,0 +1,404 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <list>
+#include <unordered_map>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+#include <signal.h>
+#include <stdint.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+using namespace std;
+
+#include "raytrace.h"
+
+ // Mode -daemon: un processus qui reste lance et rend des images a la demande,
+ // recues sur une socket Unix. Un rendu en ligne de commande paie a chaque fois
+ // le demarrage du processus, la lecture de la scene et la construction du BVH,
+ // qui dominent pour une petite image d'apercu. Le daemon garde:
+ // - ses threads de rendu, qui se partagent les tuiles de tous les rendus;
+ // - les dernieres scenes lues, BVH compris, retrouvees par le contenu du
+ //   fichier (hache puis compare): une scene modifiee est relue, une scene
+ //   deja vue ne coute que le hachage.
+ // Un client envoie un JOB par rendu, autant qu'il veut sur la meme connexion:
+ //   JOB    : daemonJob, puis la scene (chemin ou contenu), puis le chemin du
+ //            TGA a ecrire (vide: le daemon n'ecrit rien)
+ // et recoit en retour:
+ //   READY  : jobReport (taille de l'image, scene en cache ou non)
+ //   TILE   : tileJob puis w * h pixels BGR, au fur et a mesure, si demande
+ //   DONE   : jobReport complet (temps de chargement, de trace, total)
+ //   ERROR  : un message, la connexion reste utilisable
+ // Chaque connexion a son thread; ses tuiles passent par la file commune.
+
+ enum { MSG_JOB = 1, MSG_READY = 2, MSG_TILE = 3, MSG_DONE = 4, MSG_ERROR = 5 };
+ enum { JOB_PATH = 0, JOB_BLOB = 1 };
+ const uint32_t MAX_JOB_SIZE = 64 << 20;
+ const int MAX_IMAGE_SIZE = 16384;
+
+ struct daemonJob {
+   int32_t source;            // JOB_PATH ou JOB_BLOB
+   int32_t x, y, w, h;        // fenetre rendue, en pixels de la scene
+                              // (w = 0: toute l'image de la scene)
+   int32_t order;             // t_curve
+   int32_t stream;            // 1: les tuiles sont renvoyees au client
+   uint32_t sceneSize, outputSize;
+ };
+
+ struct jobReport {
+   int32_t w, h, cached;
+   float load, trace, total;  // secondes
+ };
+
+ static double now()
+ {
+   return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+ }
+
+ // FNV-1a sur 64 bits
+ static uint64_t hashBlob(const string &blob)
+ {
+   uint64_t h = 14695981039346656037ull;
+   for (size_t i = 0; i < blob.size(); ++i)
+     h = (h ^ (unsigned char)blob[i]) * 1099511628211ull;
+   return h;
+ }
+
+ // scenes deja lues, la plus recente en tete de lru. Deux connexions qui
+ // ratent la meme scene en meme temps la lisent chacune, la derniere gagne.
+ struct cachedScene {
+   uint64_t hash;
+   string blob;
+   shared_ptr<const scene> myScene;
+ };
+
+ struct sceneCache {
+   mutex lock;
+   size_t capacity;
+   list<cachedScene> lru;
+   unordered_map<uint64_t, list<cachedScene>::iterator> index;
+ };
+
+ static shared_ptr<const scene> findScene(sceneCache &cache, const string &blob, bool &cached)
+ {
+   uint64_t h = hashBlob(blob);
+   {
+     lock_guard<mutex> guard(cache.lock);
+     unordered_map<uint64_t, list<cachedScene>::iterator>::iterator it = cache.index.find(h);
+     if (it != cache.index.end() && it->second->blob == blob) {
+       cache.lru.splice(cache.lru.begin(), cache.lru, it->second);
+       cached = true;
+       return cache.lru.front().myScene;
+     }
+   }
+   cached = false;
+   shared_ptr<scene> myScene(new scene);
+   istringstream sceneFile(blob);
+   if (!init(sceneFile, *myScene) || !validScene(*myScene))
+     return shared_ptr<const scene>();
+   lock_guard<mutex> guard(cache.lock);
+   unordered_map<uint64_t, list<cachedScene>::iterator>::iterator it = cache.index.find(h);
+   if (it != cache.index.end()) {
+     cache.lru.erase(it->second);
+     cache.index.erase(it);
+   }
+   cachedScene entry = { h, blob, myScene };
+   cache.lru.push_front(entry);
+   cache.index[h] = cache.lru.begin();
+   while (cache.lru.size() > cache.capacity) {
+     cache.index.erase(cache.lru.back().hash);
+     cache.lru.pop_back();
+   }
+   return myScene;
+ }
+
+ // un rendu en cours: les threads de rendu y deposent leurs tuiles, le thread
+ // de la connexion les renvoie dans l'ordre ou elles finissent
+ struct renderJob {
+   shared_ptr<const scene> myScene;
+   int x, y;
+   vector<tileJob> tiles;
+   vector<vector<unsigned char> > pixels;
+   bool cancelled;            // client perdu: les tuiles restantes sont sautees
+   mutex lock;
+   condition_variable ready;
+   deque<int> finished;
+ };
+
+ struct tilePool {
+   mutex lock;
+   condition_variable work;
+   deque<pair<shared_ptr<renderJob>, int> > todo;
+   vector<thread> threads;
+ };
+
+ static void poolThread(tilePool *pool)
+ {
+   for (;;) {
+     unique_lock<mutex> guard(pool->lock);
+     pool->work.wait(guard, [pool] { return !pool->todo.empty(); });
+     shared_ptr<renderJob> job = pool->todo.front().first;
+     int id = pool->todo.front().second;
+     pool->todo.pop_front();
+     guard.unlock();
+     const tileJob &t = job->tiles[id];
+     bool cancelled;
+     {
+       lock_guard<mutex> jobGuard(job->lock);
+       cancelled = job->cancelled;
+     }
+     if (!cancelled)
+       renderTile(*job->myScene, job->x + t.x0, job->y + t.y0, t.w, t.h, &job->pixels[id][0], (t_curve)t.order);
+     lock_guard<mutex> jobGuard(job->lock);
+     job->finished.push_back(id);
+     job->ready.notify_one();
+   }
+ }
+
+ struct daemonState {
+   sceneCache cache;
+   tilePool pool;
+ };
+
+ static bool sendError(int fd, const string &text)
+ {
+   return sendMsg(fd, MSG_ERROR, text.data(), text.size());
+ }
+
+ static bool readFile(const string &name, string &blob)
+ {
+   ifstream file(name.c_str(), ios_base::binary);
+   if (!file)
+     return false;
+   blob.assign(istreambuf_iterator<char>(file), istreambuf_iterator<char>());
+   return !file.bad();
+ }
+
+ // un JOB: faux si la connexion est perdue, une erreur du job est renvoyee
+ // au client
+ static bool runJob(daemonState &d, int fd, const vector<char> &payload)
+ {
+   daemonJob req;
+   if (payload.size() < sizeof(req))
+     return sendError(fd, "job incomplet");
+   memcpy(&req, &payload[0], sizeof(req));
+   if (payload.size() != sizeof(req) + (uint64_t)req.sceneSize + req.outputSize)
+     return sendError(fd, "job incomplet");
+   double start = now();
+   string sceneData(payload.data() + sizeof(req), req.sceneSize);
+   string outputName(payload.data() + sizeof(req) + req.sceneSize, req.outputSize);
+   string blob;
+   if (req.source == JOB_BLOB)
+     blob.swap(sceneData);
+   else if (!readFile(sceneData, blob))
+     return sendError(fd, "scene illisible: " + sceneData);
+   bool cached;
+   shared_ptr<renderJob> job(new renderJob);
+   job->myScene = findScene(d.cache, blob, cached);
+   if (!job->myScene)
+     return sendError(fd, "scene invalide");
+   if (req.w == 0) {
+     req.x = req.y = 0;
+     req.w = job->myScene->sizex;
+     req.h = job->myScene->sizey;
+   }
+   if (req.w <= 0 || req.h <= 0 || req.w > MAX_IMAGE_SIZE || req.h > MAX_IMAGE_SIZE)
+     return sendError(fd, "taille d'image invalide");
+   if (req.order < RT_CURVE_ROWS || req.order > RT_CURVE_HILBERT)
+     req.order = RT_CURVE_ROWS;
+   jobReport report = { req.w, req.h, cached, float(now() - start), 0, 0 };
+   if (!sendMsg(fd, MSG_READY, &report, sizeof(report)))
+     return false;
+
+   // tuiles dans l'ordre de la courbe, comme pour -workers
+   double traceStart = now();
+   int tilesx = (req.w + TILE_SIZE - 1) / TILE_SIZE;
+   int tilesy = (req.h + TILE_SIZE - 1) / TILE_SIZE;
+   vector<int> order(tilesx * tilesy);
+   rt_curve_order((t_curve)req.order, tilesx, tilesy, &order[0]);
+   job->x = req.x;
+   job->y = req.y;
+   job->cancelled = false;
+   job->tiles.resize(order.size());
+   job->pixels.resize(order.size());
+   for (unsigned k = 0; k < order.size(); ++k) {
+     int x = order[k] % tilesx * TILE_SIZE, y = order[k] / tilesx * TILE_SIZE;
+     tileJob t = { (int32_t)k, x, y, min(TILE_SIZE, req.w - x), min(TILE_SIZE, req.h - y), req.order };
+     job->tiles[k] = t;
+     job->pixels[k].resize(t.w * t.h * 3);
+   }
+   {
+     lock_guard<mutex> guard(d.pool.lock);
+     for (unsigned k = 0; k < order.size(); ++k)
+       d.pool.todo.push_back(make_pair(job, (int)k));
+   }
+   d.pool.work.notify_all();
+
+   // on attend toutes les tuiles, meme celles d'un client perdu: un thread
+   // de rendu peut encore ecrire dans job
+   vector<unsigned char> image(outputName.empty() ? 0 : req.w * req.h * 3);
+   bool alive = true;
+   for (size_t received = 0; received < order.size(); ) {
+     int id;
+     {
+       unique_lock<mutex> guard(job->lock);
+       job->ready.wait(guard, [&job] { return !job->finished.empty(); });
+       id = job->finished.front();
+       job->finished.pop_front();
+     }
+     received++;
+     const tileJob &t = job->tiles[id];
+     if (alive && req.stream && !sendMsg(fd, MSG_TILE, &t, sizeof(t), &job->pixels[id][0], job->pixels[id].size())) {
+       alive = false;
+       lock_guard<mutex> guard(job->lock);
+       job->cancelled = true;
+     }
+     for (int y = 0; y < t.h && !image.empty(); ++y)
+       memcpy(&image[((t.y0 + y) * req.w + t.x0) * 3], &job->pixels[id][y * t.w * 3], t.w * 3);
+     vector<unsigned char>().swap(job->pixels[id]);
+   }
+   if (!alive)
+     return false;
+   report.trace = float(now() - traceStart);
+   if (!image.empty() && !writeTGA(outputName.c_str(), req.w, req.h, &image[0]))
+     return sendError(fd, "ecriture impossible: " + outputName);
+   report.total = float(now() - start);
+   return sendMsg(fd, MSG_DONE, &report, sizeof(report));
+ }
+
+ static void serveClient(daemonState *d, int fd)
+ {
+   uint32_t type;
+   vector<char> payload;
+   while (recvMsg(fd, type, payload, MAX_JOB_SIZE))
+     if (type != MSG_JOB || !runJob(*d, fd, payload))
+       break;
+   close(fd);
+ }
+
+ static const char *daemonSocket = NULL;
+
+ static void stopDaemon(int)
+ {
+   unlink(daemonSocket);
+   _exit(0);
+ }
+
+ static bool socketAddress(const char* socketName, sockaddr_un &addr)
+ {
+   memset(&addr, 0, sizeof(addr));
+   addr.sun_family = AF_UNIX;
+   if (strlen(socketName) >= sizeof(addr.sun_path))
+     return false;
+   strcpy(addr.sun_path, socketName);
+   return true;
+ }
+
+ int runDaemon(const char* socketName, int nbThreads, int nbScenes)
+ {
+   signal(SIGPIPE, SIG_IGN);
+   sockaddr_un addr;
+   int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (fd < 0 || !socketAddress(socketName, addr))
+     return -1;
+   unlink(socketName);
+   if (bind(fd, (sockaddr *)&addr, sizeof(addr)) < 0 || listen(fd, 16) < 0) {
+     perror(socketName);
+     return -1;
+   }
+   daemonSocket = socketName;
+   signal(SIGINT, stopDaemon);
+   signal(SIGTERM, stopDaemon);
+
+   daemonState *d = new daemonState;
+   d->cache.capacity = max(1, nbScenes);
+   if (nbThreads <= 0)
+     nbThreads = max(1u, thread::hardware_concurrency());
+   for (int i = 0; i < nbThreads; ++i)
+     d->pool.threads.push_back(thread(poolThread, &d->pool));
+   fprintf(stderr, "daemon: %s, %d threads, %d scenes in cache\n", socketName, nbThreads, (int)d->cache.capacity);
+   for (;;) {
+     int client = accept(fd, NULL, NULL);
+     if (client < 0)
+       continue;
+     thread(serveClient, d, client).detach();
+   }
+ }
+
+ // client de test: envoie un rendu, recoit les tuiles et ecrit le TGA. Avec
+ // remote, le daemon lit la scene et ecrit l'image lui-meme (meme machine).
+ static string absolutePath(const char* name)
+ {
+   char cwd[PATH_MAX];
+   if (name[0] == '/' || !getcwd(cwd, sizeof(cwd)))
+     return name;
+   return string(cwd) + "/" + name;
+ }
+
+ int runClient(const char* socketName, const char* inputName, const char* outputName,
+   const int window[4], bool remote, t_curve order)
+ {
+   double start = now();
+   sockaddr_un addr;
+   int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+   if (fd < 0 || !socketAddress(socketName, addr))
+     return -1;
+   if (connect(fd, (sockaddr *)&addr, sizeof(addr)) < 0) {
+     perror(socketName);
+     return -1;
+   }
+   string sceneData, output;
+   if (remote) {
+     sceneData = absolutePath(inputName);
+     output = absolutePath(outputName);
+   }
+   else if (!readFile(inputName, sceneData))
+     return -1;
+   daemonJob req = { remote ? JOB_PATH : JOB_BLOB, window[0], window[1], window[2], window[3], order,
+     !remote, (uint32_t)sceneData.size(), (uint32_t)output.size() };
+   string body = sceneData + output;
+   if (!sendMsg(fd, MSG_JOB, &req, sizeof(req), body.data(), body.size()))
+     return -1;
+   uint32_t type;
+   vector<char> payload;
+   vector<unsigned char> image;
+   jobReport report;
+   while (recvMsg(fd, type, payload)) {
+     if (type == MSG_ERROR) {
+       fprintf(stderr, "daemon: %s\n", string(payload.begin(), payload.end()).c_str());
+       return -1;
+     }
+     if ((type == MSG_READY || type == MSG_DONE) && payload.size() == sizeof(report)) {
+       memcpy(&report, &payload[0], sizeof(report));
+       image.resize(remote ? 0 : report.w * report.h * 3);
+       if (type == MSG_READY)
+         continue;
+       close(fd);
+       fprintf(stderr, "%dx%d, scene %s (%.2f ms), trace %.2f ms, daemon %.2f ms, client %.2f ms\n",
+         report.w, report.h, report.cached ? "en cache" : "lue", report.load * 1e3, report.trace * 1e3,
+         report.total * 1e3, (now() - start) * 1e3);
+       return remote || writeTGA(outputName, report.w, report.h, &image[0]) ? 0 : -1;
+     }
+     tileJob t;
+     if (type != MSG_TILE || payload.size() < sizeof(t) || image.empty()
+       || (memcpy(&t, &payload[0], sizeof(t)), t.x0 < 0) || t.y0 < 0 || t.w <= 0 || t.h <= 0
+       || t.x0 + t.w > report.w || t.y0 + t.h > report.h || payload.size() != sizeof(t) + t.w * t.h * 3)
+       break;
+     for (int y = 0; y < t.h; ++y)
+       memcpy(&image[((t.y0 + y) * report.w + t.x0) * 3], &payload[sizeof(t) + y * t.w * 3], t.w * 3);
+   }
+   fprintf(stderr, "daemon: connexion perdue\n");
+   return -1;
+ }
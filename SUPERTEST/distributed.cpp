@@ -0,0 +1,314 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <deque>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+#include <signal.h>
+#include <poll.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+using namespace std;
+
+#include "raytrace.h"
+
+ // Rendu reparti: le coordinateur decoupe l'image en tuiles et les distribue
+ // a des processus "a.out -worker" lances en local, relies par une socketpair.
+ // Chaque message est un entete {type, taille} suivi de sa charge utile.
+ //   SCENE  : le fichier de scene tel quel
+ //   TILE   : id, x0, y0, w, h
+ //   RESULT : id, x0, y0, w, h puis w * h pixels BGR
+ // Une tuile donnee a un worker mort retourne dans la file, une tuile qui
+ // traine trop longtemps est redonnee a un worker libre (le premier resultat
+ // recu gagne).
+
+ enum { MSG_SCENE = 1, MSG_TILE = 2, MSG_RESULT = 3 };
+ const int TILES_IN_FLIGHT = 2;
+
+ static bool writeAll(int fd, const void *buf, size_t len)
+ {
+   const char *p = (const char *)buf;
+   while (len > 0) {
+     ssize_t n = write(fd, p, len);
+     if (n <= 0)
+       return false;
+     p += n;
+     len -= n;
+   }
+   return true;
+ }
+
+ static bool readAll(int fd, void *buf, size_t len)
+ {
+   char *p = (char *)buf;
+   while (len > 0) {
+     ssize_t n = read(fd, p, len);
+     if (n <= 0)
+       return false;
+     p += n;
+     len -= n;
+   }
+   return true;
+ }
+
+ bool sendMsg(int fd, uint32_t type, const void *a, uint32_t alen, const void *b, uint32_t blen)
+ {
+   msgHeader hdr = { type, alen + blen };
+   return writeAll(fd, &hdr, sizeof(hdr)) && writeAll(fd, a, alen) && (blen == 0 || writeAll(fd, b, blen));
+ }
+
+ bool recvMsg(int fd, uint32_t &type, vector<char> &payload, uint32_t maxSize)
+ {
+   msgHeader hdr;
+   if (!readAll(fd, &hdr, sizeof(hdr)) || hdr.size > maxSize)
+     return false;
+   type = hdr.type;
+   payload.resize(hdr.size);
+   return hdr.size == 0 || readAll(fd, &payload[0], hdr.size);
+ }
+
+ static double now()
+ {
+   return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+ }
+
+ int runWorker(int fd)
+ {
+   signal(SIGPIPE, SIG_IGN);
+   scene myScene;
+   bool ready = false;
+   uint32_t type;
+   vector<char> payload;
+   vector<unsigned char> pixels;
+   while (recvMsg(fd, type, payload)) {
+     if (type == MSG_SCENE) {
+       istringstream sceneFile(string(payload.begin(), payload.end()));
+       ready = init(sceneFile, myScene);
+       if (!ready)
+         return -1;
+     }
+     else if (type == MSG_TILE && ready && payload.size() == sizeof(tileJob)) {
+       tileJob job;
+       memcpy(&job, &payload[0], sizeof(job));
+       pixels.resize(job.w * job.h * 3);
+       renderTile(myScene, job.x0, job.y0, job.w, job.h, &pixels[0], (t_curve)job.order);
+       if (!sendMsg(fd, MSG_RESULT, &job, sizeof(job), &pixels[0], pixels.size()))
+         return -1;
+     }
+     else
+       return -1;
+   }
+   return 0;
+ }
+
+ struct workerState {
+   pid_t pid;
+   int fd;
+   bool alive;
+   vector<int> inFlight;
+   vector<double> started;
+   int tiles;
+   long pixels;
+   double busy;
+ };
+
+ static bool spawnWorker(const char* self, workerState &w)
+ {
+   int sv[2];
+   if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+     return false;
+   w.pid = fork();
+   if (w.pid < 0)
+     return false;
+   if (w.pid == 0) {
+     close(sv[0]);
+     dup2(sv[1], 0);
+     close(sv[1]);
+     execl(self, self, "-worker", (char *)NULL);
+     _exit(127);
+   }
+   close(sv[1]);
+   w.fd = sv[0];
+   w.alive = true;
+   w.tiles = 0;
+   w.pixels = 0;
+   w.busy = 0;
+   return true;
+ }
+
+ static void killWorker(workerState &w)
+ {
+   if (w.alive)
+     close(w.fd);
+   w.alive = false;
+ }
+
+ int runCoordinator(const char* inputName, const char* outputName, int nbWorkers, const char* self,
+   t_curve order)
+ {
+   signal(SIGPIPE, SIG_IGN);
+   ifstream sceneFile(inputName, ios_base::binary);
+   if (!sceneFile || nbWorkers <= 0)
+     return -1;
+   string blob((istreambuf_iterator<char>(sceneFile)), istreambuf_iterator<char>());
+   scene myScene;
+   istringstream check(blob);
+   if (!init(check, myScene))
+     return -1;
+
+   // decoupage en tuiles, distribuees dans l'ordre de la courbe : les tuiles
+   // d'un meme worker se suivent a l'ecran, et donc dans la scene
+   int tilesx = (myScene.sizex + TILE_SIZE - 1) / TILE_SIZE;
+   int tilesy = (myScene.sizey + TILE_SIZE - 1) / TILE_SIZE;
+   vector<int> tiles(tilesx * tilesy);
+   rt_curve_order(order, tilesx, tilesy, &tiles[0]);
+   vector<tileJob> jobs;
+   for (unsigned k = 0; k < tiles.size(); ++k) {
+     int x = tiles[k] % tilesx * TILE_SIZE, y = tiles[k] / tilesx * TILE_SIZE;
+     tileJob job = { (int32_t)jobs.size(), x, y, min(TILE_SIZE, myScene.sizex - x), min(TILE_SIZE, myScene.sizey - y), order };
+     jobs.push_back(job);
+   }
+   vector<int> running(jobs.size(), 0);
+   vector<bool> done(jobs.size(), false);
+   deque<int> todo;
+   for (unsigned i = 0; i < jobs.size(); ++i)
+     todo.push_back(i);
+   size_t remaining = jobs.size();
+   vector<unsigned char> image(myScene.sizex * myScene.sizey * 3);
+
+   vector<workerState> workers(nbWorkers);
+   for (int i = 0; i < nbWorkers; ++i)
+     if (!spawnWorker(self, workers[i]) || !sendMsg(workers[i].fd, MSG_SCENE, blob.data(), blob.size()))
+       killWorker(workers[i]);
+
+   double start = now(), tileTime = 0;
+   int tileCount = 0;
+   vector<char> payload;
+   while (remaining > 0) {
+     // distribution des tuiles
+     for (int i = 0; i < nbWorkers; ++i) {
+       workerState &w = workers[i];
+       while (w.alive && (int)w.inFlight.size() < TILES_IN_FLIGHT && !todo.empty()) {
+         int id = todo.front();
+         todo.pop_front();
+         if (done[id])
+           continue;
+         if (!sendMsg(w.fd, MSG_TILE, &jobs[id], sizeof(tileJob))) {
+           todo.push_front(id);
+           break;
+         }
+         w.inFlight.push_back(id);
+         w.started.push_back(now());
+         running[id]++;
+       }
+     }
+     // tuiles qui trainent: on les envoie directement a un worker inoccupe
+     // (par la file, le worker lent pourrait la reprendre lui-meme)
+     double limit = max(0.5, 4 * (tileCount ? tileTime / tileCount : 0.0));
+     for (int i = 0; i < nbWorkers && todo.empty(); ++i) {
+       workerState &idle = workers[i];
+       for (int j = 0; j < nbWorkers && idle.alive && idle.inFlight.empty(); ++j) {
+         workerState &slow = workers[j];
+         for (unsigned t = 0; j != i && slow.alive && t < slow.inFlight.size(); ++t) {
+           int id = slow.inFlight[t];
+           if (done[id] || running[id] > 1 || now() - slow.started[t] < limit)
+             continue;
+           if (!sendMsg(idle.fd, MSG_TILE, &jobs[id], sizeof(tileJob)))
+             break;
+           fprintf(stderr, "tile %d late on worker %d, reassigned to worker %d\n", id, j, i);
+           idle.inFlight.push_back(id);
+           idle.started.push_back(now());
+           running[id]++;
+           break;
+         }
+       }
+     }
+     vector<pollfd> fds;
+     vector<int> owner;
+     for (int i = 0; i < nbWorkers; ++i)
+       if (workers[i].alive) {
+         pollfd p = { workers[i].fd, POLLIN, 0 };
+         fds.push_back(p);
+         owner.push_back(i);
+       }
+     if (fds.empty()) {
+       fprintf(stderr, "all workers died, %zu tiles left\n", remaining);
+       return -1;
+     }
+     if (poll(&fds[0], fds.size(), 100) < 0)
+       continue;
+     for (unsigned k = 0; k < fds.size(); ++k) {
+       if (!fds[k].revents)
+         continue;
+       workerState &w = workers[owner[k]];
+       uint32_t type;
+       tileJob job;
+       if (!recvMsg(w.fd, type, payload) || type != MSG_RESULT || payload.size() < sizeof(tileJob)
+         || (memcpy(&job, &payload[0], sizeof(job)), job.id < 0) || job.id >= (int)jobs.size()
+         || payload.size() != sizeof(tileJob) + jobs[job.id].w * jobs[job.id].h * 3) {
+         // worker mort: ses tuiles retournent dans la file
+         fprintf(stderr, "worker %d (pid %d) lost, requeuing %zu tiles\n", owner[k], (int)w.pid, w.inFlight.size());
+         for (unsigned t = 0; t < w.inFlight.size(); ++t)
+           if (--running[w.inFlight[t]] == 0 && !done[w.inFlight[t]])
+             todo.push_front(w.inFlight[t]);
+         w.inFlight.clear();
+         w.started.clear();
+         killWorker(w);
+         continue;
+       }
+       vector<int>::iterator it = find(w.inFlight.begin(), w.inFlight.end(), job.id);
+       if (it != w.inFlight.end()) {
+         double elapsed = now() - w.started[it - w.inFlight.begin()];
+         w.busy += elapsed;
+         tileTime += elapsed;
+         tileCount++;
+         w.started.erase(w.started.begin() + (it - w.inFlight.begin()));
+         w.inFlight.erase(it);
+         running[job.id]--;
+       }
+       if (done[job.id])
+         continue;
+       const tileJob &ref = jobs[job.id];
+       const unsigned char *src = (const unsigned char *)&payload[sizeof(tileJob)];
+       for (int y = 0; y < ref.h; ++y)
+         memcpy(&image[((ref.y0 + y) * myScene.sizex + ref.x0) * 3], src + y * ref.w * 3, ref.w * 3);
+       done[job.id] = true;
+       remaining--;
+       w.tiles++;
+       w.pixels += ref.w * ref.h;
+     }
+   }
+   double elapsed = now() - start;
+
+   // fin: on ferme les connexions, les workers encore occupes sont tues
+   for (int i = 0; i < nbWorkers; ++i)
+     killWorker(workers[i]);
+   for (int i = 0; i < nbWorkers; ++i) {
+     if (workers[i].pid <= 0)
+       continue;
+     int status;
+     double deadline = now() + 1.0;
+     while (waitpid(workers[i].pid, &status, WNOHANG) == 0) {
+       if (now() > deadline) {
+         kill(workers[i].pid, SIGKILL);
+         waitpid(workers[i].pid, &status, 0);
+         break;
+       }
+       usleep(1000);
+     }
+   }
+   for (int i = 0; i < nbWorkers; ++i) {
+     workerState &w = workers[i];
+     fprintf(stderr, "worker %d (pid %d): %d tiles, %.2f Mpixels/s busy, %.2f Mpixels/s wall\n", i, (int)w.pid,
+       w.tiles, w.busy > 0 ? w.pixels / w.busy / 1e6 : 0.0, w.pixels / elapsed / 1e6);
+   }
+   fprintf(stderr, "%zu tiles in %.3fs\n", jobs.size(), elapsed);
+   return writeTGA(outputName, myScene.sizex, myScene.sizey, &image[0]) ? 0 : -1;
+ }
@@ -1,22 +1,91 @@
 #include <iostream>
 #include <fstream>
+#include <string>
 #include <vector>
 #include <cmath>
 #include <limits>
 #include <algorithm>
+#include <cstring>
+#include <cstdlib>
 using namespace std;
 
 #include "raytrace.h"
+#include <rt_denoise.h>
+#include <rt_perf.h>
 
- bool init(char* inputName, scene &myScene) 
+ // rotation d'angle degrs autour de l'axe (x, y, z), formule de Rodrigues
+ static void axisAngle(float x, float y, float z, float angle, float rot[9])
+ {
+   float len = sqrtf(x * x + y * y + z * z);
+   if (len == 0.0f)
+     x = y = 0.0f, z = len = 1.0f;
+   x /= len;
+   y /= len;
+   z /= len;
+   float c = cosf(angle * float(M_PI) / 180.0f), s = sinf(angle * float(M_PI) / 180.0f), d = 1.0f - c;
+   float m[9] = {
+     c + x * x * d,     x * y * d - z * s, x * z * d + y * s,
+     y * x * d + z * s, c + y * y * d,     y * z * d - x * s,
+     z * x * d - y * s, z * y * d + x * s, c + z * z * d };
+   memcpy(rot, m, sizeof(m));
+ }
+
+ // aprs les lumires, des prototypes et leurs instances, dans n'importe
+ // quel ordre jusqu' la fin du fichier :
+ //   prototype n                     suivi de n sphres dans son repre
+ //   instance p x y z s ax ay az a   le prototype p,  l'chelle s, tourn
+ //                                   de a degrs autour de (ax, ay, az) et
+ //                                   pos en (x, y, z)
+ static bool readInstances(istream &sceneFile, scene &myScene)
+ {
+   string keyword;
+   while (sceneFile >> keyword)
+   {
+     if (keyword == "prototype")
+     {
+       int nbSphere;
+       if (!(sceneFile >> nbSphere) || nbSphere < 0)
+         return false;
+       myScene.protoTab.push_back(prototype());
+       vector<sphere> &sph = myScene.protoTab.back().sphTab;
+       sph.resize(nbSphere);
+       for (int i = 0; i < nbSphere; i++)
+         sceneFile >> sph[i];
+     }
+     else if (keyword == "instance")
+     {
+       instance inst;
+       float x, y, z, angle;
+       sceneFile >> inst.proto >> inst.pos >> inst.scale >> x >> y >> z >> angle;
+       if (!sceneFile || !(inst.scale > 0.0f))
+         return false;
+       axisAngle(x, y, z, angle, inst.rot);
+       myScene.instTab.push_back(inst);
+     }
+     else
+       return false;
+     if (!sceneFile)
+       return false;
+   }
+   if (!sceneFile.eof())
+     return false;
+   // un prototype peut suivre ses instances : les indices ne se vrifient
+   // qu' la fin, mais avant que buildInstances() ne s'en serve
+   for (unsigned int i = 0; i < myScene.instTab.size(); ++i)
+     if (myScene.instTab[i].proto < 0 || myScene.instTab[i].proto >= int(myScene.protoTab.size()))
+       return false;
+   return true;
+ }
+
+ // lecture des tables seule, sans construire le BVH
+ bool readScene(istream &sceneFile, scene &myScene) 
  {
    int nbMat, nbSphere, nbLight;
    int i;
-   ifstream sceneFile(inputName);
-   if (!sceneFile)
-     return  false;
    sceneFile >> myScene.sizex >> myScene.sizey;
    sceneFile >> nbMat >> nbSphere >> nbLight;
+   if (!sceneFile || nbMat < 0 || nbSphere < 0 || nbLight < 0)
+     return false;
    myScene.matTab.resize(nbMat); 
    myScene.sphTab.resize(nbSphere); 
    myScene.lgtTab.resize(nbLight); 
@@ -26,10 +95,46 @@ using namespace std;
      sceneFile >> myScene.sphTab[i];
    for (i=0; i < nbLight; i++)
      sceneFile >> myScene.lgtTab[i];
+   return !sceneFile.fail() && readInstances(sceneFile, myScene);
+ } 
+
+ // tailles de l'image et matires des sphres dans les tables, ce que
+ // readScene() ne vrifie pas
+ bool validScene(const scene &myScene)
+ {
+   if (myScene.sizex <= 0 || myScene.sizey <= 0)
+     return false;
+   for (unsigned int i = 0; i < myScene.sphTab.size(); ++i)
+     if (myScene.sphTab[i].material < 0 || myScene.sphTab[i].material >= int(myScene.matTab.size()))
+       return false;
+   for (unsigned int p = 0; p < myScene.protoTab.size(); ++p)
+     for (unsigned int i = 0; i < myScene.protoTab[p].sphTab.size(); ++i)
+       if (myScene.protoTab[p].sphTab[i].material < 0
+         || myScene.protoTab[p].sphTab[i].material >= int(myScene.matTab.size()))
+         return false;
+   return true;
+ }
+
+ bool init(istream &sceneFile, scene &myScene) 
+ {
+   if (!readScene(sceneFile, myScene))
+     return false;
+   buildBVH(myScene);
+   buildInstances(myScene);
    return true;
  } 
 
- bool hitSphere(const ray &r, const sphere &s, float &t) 
+ bool init(const char* inputName, scene &myScene) 
+ {
+   ifstream sceneFile(inputName);
+   if (!sceneFile)
+     return  false;
+   return init(sceneFile, myScene);
+ } 
+
+ // les impacts plus proches que tmin sont ignors (le rayon repart de la
+ // surface qu'il vient de toucher)
+ bool hitSphere(const ray &r, const sphere &s, float &t, float tmin = 0.1f) 
  { 
    // intersection rayon/sphere 
    vecteur dist = s.pos - r.start; 
@@ -40,12 +145,12 @@ using namespace std;
    float t0 = B - sqrtf(D); 
    float t1 = B + sqrtf(D);
    bool retvalue = false;  
-   if ((t0 > 0.1f) && (t0 < t)) 
+   if ((t0 > tmin) && (t0 < t)) 
    {
      t = t0;
      retvalue = true; 
    } 
-   if ((t1 > 0.1f) && (t1 < t)) 
+   if ((t1 > tmin) && (t1 < t)) 
    {
      t = t1; 
      retvalue = true; 
@@ -53,56 +158,392 @@ using namespace std;
    return retvalue; 
  }
 
- bool draw(char* outputName, scene &myScene) 
+ // bote englobante d'une sphre, avec une marge pour que le test de la bote
+ // ne rate jamais un rayon que hitSphere accepterait
+ static void sphereBounds(const sphere &s, point &lo, point &hi)
  {
-   ofstream imageFile(outputName,ios_base::binary);
-   if (!imageFile)
-     return false; 
-   // Ajout du header TGA
-   imageFile.put(0).put(0);
-   imageFile.put(2);        /* RGB non compresse */
+   float r = s.size + 1e-3f * (1.0f + s.size);
+   lo = point(s.pos.x - r, s.pos.y - r, s.pos.z - r);
+   hi = point(s.pos.x + r, s.pos.y + r, s.pos.z + r);
+ }
 
-   imageFile.put(0).put(0);
-   imageFile.put(0).put(0);
-   imageFile.put(0);
+ static void growBounds(point &lo, point &hi, const point &l, const point &h)
+ {
+   lo = point(min(lo.x, l.x), min(lo.y, l.y), min(lo.z, l.z));
+   hi = point(max(hi.x, h.x), max(hi.y, h.y), max(hi.z, h.z));
+ }
 
-   imageFile.put(0).put(0); /* origine X */ 
-   imageFile.put(0).put(0); /* origine Y */
+ // un BVH range des lments (les sphres de la scne ou d'un prototype, les
+ // instances) que l'on ne voit qu' travers bounds(i, lo, hi), leur bote, et
+ // center(i), le point qui les place pour la dcoupe
+ template <class Bounds>
+ static void nodeBounds(vector<bvhNode> &bvh, const vector<int> &index, int n, const Bounds &bounds)
+ {
+   bvhNode &node = bvh[n];
+   point lo, hi;
+   if (node.count == 0)
+   {
+     node.lo = bvh[node.first].lo;
+     node.hi = bvh[node.first].hi;
+     growBounds(node.lo, node.hi, bvh[node.first + 1].lo, bvh[node.first + 1].hi);
+     return;
+   }
+   bounds(index[node.first], node.lo, node.hi);
+   for (int k = 1; k < node.count; ++k)
+   {
+     bounds(index[node.first + k], lo, hi);
+     growBounds(node.lo, node.hi, lo, hi);
+   }
+ }
 
-   imageFile.put((myScene.sizex & 0x00FF)).put((myScene.sizex & 0xFF00) / 256);
-   imageFile.put((myScene.sizey & 0x00FF)).put((myScene.sizey & 0xFF00) / 256);
-   imageFile.put(24);       /* 24 bit bitmap */ 
-   imageFile.put(0); 
-   // fin du header TGA
+ // dcoupe [first, last) de index au milieu de l'axe o les centres
+ // s'talent le plus, jusqu' deux lments par feuille
+ template <class Center, class Bounds>
+ static void buildNode(vector<bvhNode> &bvh, vector<int> &index, int n, int first, int last,
+   const Center &center, const Bounds &bounds)
+ {
+   bvh[n].first = first;
+   bvh[n].count = last - first;
+   if (last - first > 2)
+   {
+     point lo = center(index[first]), hi = lo;
+     for (int k = first + 1; k < last; ++k)
+       growBounds(lo, hi, center(index[k]), center(index[k]));
+     vecteur extent = hi - lo;
+     int axis = extent.x > extent.y ? (extent.x > extent.z ? 0 : 2) : (extent.y > extent.z ? 1 : 2);
+     int middle = (first + last) / 2;
+     nth_element(index.begin() + first, index.begin() + middle, index.begin() + last, [&](int a, int b) {
+         return (&center(a).x)[axis] < (&center(b).x)[axis];
+       });
+     int child = bvh.size();
+     bvh.resize(child + 2);
+     bvh[n].first = child;
+     bvh[n].count = 0;
+     buildNode(bvh, index, child, first, middle, center, bounds);
+     buildNode(bvh, index, child + 1, middle, last, center, bounds);
+   }
+   nodeBounds(bvh, index, n, bounds);
+ }
+
+ template <class Center, class Bounds>
+ static void buildTree(vector<bvhNode> &bvh, vector<int> &index, int count, const Center &center,
+   const Bounds &bounds)
+ {
+   bvh.clear();
+   index.resize(count);
+   for (int i = 0; i < count; ++i)
+     index[i] = i;
+   if (count == 0)
+     return;
+   bvh.reserve(2 * count);
+   bvh.resize(1);
+   buildNode(bvh, index, 0, 0, count, center, bounds);
+ }
+
+ static void buildSpheres(vector<bvhNode> &bvh, vector<int> &index, const vector<sphere> &sph)
+ {
+   buildTree(bvh, index, sph.size(), [&](int i) -> const point & { return sph[i].pos; },
+     [&](int i, point &lo, point &hi) { sphereBounds(sph[i], lo, hi); });
+ }
+
+ void buildBVH(scene &myScene)
+ {
+   buildSpheres(myScene.bvh, myScene.bvhIndex, myScene.sphTab);
+ }
+
+ // les sphres ont boug mais sont toujours aussi nombreuses : mme arbre,
+ // botes recalcules des feuilles vers la racine
+ void refitBVH(scene &myScene)
+ {
+   const vector<sphere> &sph = myScene.sphTab;
+   for (int n = myScene.bvh.size() - 1; n >= 0; --n)
+     nodeBounds(myScene.bvh, myScene.bvhIndex, n,
+       [&](int i, point &lo, point &hi) { sphereBounds(sph[i], lo, hi); });
+ }
+
+ // point q du prototype dans le repre de la scne
+ static point toScene(const instance &inst, const point &q)
+ {
+   const float *m = inst.rot;
+   return inst.pos + inst.scale * vecteur(m[0] * q.x + m[1] * q.y + m[2] * q.z,
+     m[3] * q.x + m[4] * q.y + m[5] * q.z, m[6] * q.x + m[7] * q.y + m[8] * q.z);
+ }
+
+ // bote de l'instance dans la scne : celle de la racine du prototype,
+ // tourne, puis la bote de cette bote
+ static void instanceBounds(const scene &myScene, const instance &inst, point &lo, point &hi)
+ {
+   const prototype &proto = myScene.protoTab[inst.proto];
+   if (proto.bvh.empty())
+   {
+     lo = hi = inst.pos;
+     return;
+   }
+   const bvhNode &root = proto.bvh[0];
+   point c = toScene(inst, point(0.5f * (root.lo.x + root.hi.x), 0.5f * (root.lo.y + root.hi.y),
+     0.5f * (root.lo.z + root.hi.z)));
+   vecteur e = 0.5f * inst.scale * (root.hi - root.lo);
+   const float *m = inst.rot;
+   // avec une marge pour les arrondis de la rotation
+   float rx = fabsf(m[0]) * e.x + fabsf(m[1]) * e.y + fabsf(m[2]) * e.z;
+   float ry = fabsf(m[3]) * e.x + fabsf(m[4]) * e.y + fabsf(m[5]) * e.z;
+   float rz = fabsf(m[6]) * e.x + fabsf(m[7]) * e.y + fabsf(m[8]) * e.z;
+   vecteur r(rx + 1e-3f * (1.0f + rx), ry + 1e-3f * (1.0f + ry), rz + 1e-3f * (1.0f + rz));
+   lo = c - r;
+   hi = c + r;
+ }
+
+ // un BVH par prototype, puis celui des instances au-dessus
+ void buildInstances(scene &myScene)
+ {
+   for (unsigned int p = 0; p < myScene.protoTab.size(); ++p)
+   {
+     prototype &proto = myScene.protoTab[p];
+     buildSpheres(proto.bvh, proto.bvhIndex, proto.sphTab);
+     proto.reach = 0.0f;
+     if (!proto.bvh.empty())
+     {
+       const bvhNode &root = proto.bvh[0];
+       vecteur far(max(-root.lo.x, root.hi.x), max(-root.lo.y, root.hi.y), max(-root.lo.z, root.hi.z));
+       proto.reach = sqrtf(far * far);
+     }
+   }
+   vector<point> lo(myScene.instTab.size()), hi(myScene.instTab.size()), center(myScene.instTab.size());
+   for (unsigned int i = 0; i < myScene.instTab.size(); ++i)
+   {
+     instanceBounds(myScene, myScene.instTab[i], lo[i], hi[i]);
+     center[i] = point(0.5f * (lo[i].x + hi[i].x), 0.5f * (lo[i].y + hi[i].y), 0.5f * (lo[i].z + hi[i].z));
+   }
+   buildTree(myScene.instBvh, myScene.instIndex, myScene.instTab.size(),
+     [&](int i) -> const point & { return center[i]; },
+     [&](int i, point &l, point &h) { l = lo[i]; h = hi[i]; });
+ }
+
+ static bool hitBox(const bvhNode &node, const ray &r, const vecteur &inv, float t)
+ {
+   float t0 = 0.0f, t1 = t;
+   for (int k = 0; k < 3; ++k)
+   {
+     float a = ((&node.lo.x)[k] - (&r.start.x)[k]) * (&inv.x)[k];
+     float b = ((&node.hi.x)[k] - (&r.start.x)[k]) * (&inv.x)[k];
+     t0 = max(t0, min(a, b));
+     t1 = min(t1, max(a, b));
+   }
+   return t0 <= t1;
+ }
+
+ // inverse de la direction, une composante nulle devient trs grande (et pas
+ // infinie : 0 * inf donnerait NaN pour un rayon dans le plan d'une face)
+ static vecteur inverseDir(const vecteur &d)
+ {
+   return vecteur(d.x != 0.0f ? 1.0f / d.x : 1e30f, d.y != 0.0f ? 1.0f / d.y : 1e30f,
+     d.z != 0.0f ? 1.0f / d.z : 1e30f);
+ }
+
+ // sphre la plus proche touche entre tmin et t dans un BVH de sphres, celui
+ // de la scne ou d'un prototype (t est mis  jour), -1 sinon. Comme la boucle
+ // sur toutes les sphres,  galit la sphre de plus petit indice l'emporte :
+ // l'image ne dpend pas de la forme de l'arbre.
+ static int nearestIn(const vector<bvhNode> &bvh, const vector<int> &index, const vector<sphere> &sph,
+   const ray &r, float &t, float tmin)
+ {
+   int best = -1;
+   int stack[64], top = 0;
+   vecteur inv = inverseDir(r.dir);
+   if (!bvh.empty())
+     stack[top++] = 0;
+   while (top)
+   {
+     const bvhNode &node = bvh[stack[--top]];
+     if (!hitBox(node, r, inv, t))
+       continue;
+     if (node.count == 0)
+     {
+       stack[top++] = node.first + 1;
+       stack[top++] = node.first;
+       continue;
+     }
+     for (int k = 0; k < node.count; ++k)
+     {
+       int i = index[node.first + k];
+       float ti = numeric_limits<float>::max();
+       if (hitSphere(r, sph[i], ti, tmin) && (ti < t || (ti == t && i < best)))
+       {
+         t = ti;
+         best = i;
+       }
+     }
+   }
+   return best;
+ }
+
+ // une sphre du BVH coupe-t-elle le rayon entre tmin et t ?
+ static bool occludedIn(const vector<bvhNode> &bvh, const vector<int> &index, const vector<sphere> &sph,
+   const ray &r, float t, float tmin)
+ {
+   int stack[64], top = 0;
+   vecteur inv = inverseDir(r.dir);
+   if (!bvh.empty())
+     stack[top++] = 0;
+   while (top)
+   {
+     const bvhNode &node = bvh[stack[--top]];
+     if (!hitBox(node, r, inv, t))
+       continue;
+     if (node.count == 0)
+     {
+       stack[top++] = node.first + 1;
+       stack[top++] = node.first;
+       continue;
+     }
+     for (int k = 0; k < node.count; ++k)
+     {
+       float ti = t;
+       if (hitSphere(r, sph[index[node.first + k]], ti, tmin))
+         return true;
+     }
+   }
+   return false;
+ }
+
+ // le rayon dans le repre du prototype de l'instance, o les distances sont
+ // divises par l'chelle. Son origine est d'abord avance de shift, juste
+ // avant le prototype : un rayon de vue part de 10000 units plus loin, et
+ // tourner une origine aussi lointaine coterait toute la prcision du calcul
+ // de l'impact. Une distance t le long du rayon devient (t - shift) / scale.
+ static ray toPrototype(const scene &myScene, const instance &inst, const ray &r, float &shift)
+ {
+   const float *m = inst.rot;
+   float inv = 1.0f / inst.scale;
+   shift = max(0.0f, (inst.pos - r.start) * r.dir - inst.scale * myScene.protoTab[inst.proto].reach);
+   vecteur d = (r.start + shift * r.dir) - inst.pos;
+   ray local;
+   local.start = point(inv * (m[0] * d.x + m[3] * d.y + m[6] * d.z), inv * (m[1] * d.x + m[4] * d.y + m[7] * d.z),
+     inv * (m[2] * d.x + m[5] * d.y + m[8] * d.z));
+   local.dir = vecteur(m[0] * r.dir.x + m[3] * r.dir.y + m[6] * r.dir.z,
+     m[1] * r.dir.x + m[4] * r.dir.y + m[7] * r.dir.z, m[2] * r.dir.x + m[5] * r.dir.y + m[8] * r.dir.z);
+   return local;
+ }
 
-   // balayage 
-   for (int y = 0; y < myScene.sizey; ++y) { 
-   for (int x = 0; x < myScene.sizex; ++x) {
+ // parcours du BVH des instances : visit(i) pour chaque instance dont la
+ // bote coupe le rayon avant t, qui rend false pour arrter
+ template <class Visit>
+ static void forInstances(const scene &myScene, const ray &r, const float &t, const Visit &visit)
+ {
+   int stack[64], top = 0;
+   vecteur inv = inverseDir(r.dir);
+   if (!myScene.instBvh.empty())
+     stack[top++] = 0;
+   while (top)
+   {
+     const bvhNode &node = myScene.instBvh[stack[--top]];
+     if (!hitBox(node, r, inv, t))
+       continue;
+     if (node.count == 0)
+     {
+       stack[top++] = node.first + 1;
+       stack[top++] = node.first;
+       continue;
+     }
+     for (int k = 0; k < node.count; ++k)
+       if (!visit(myScene.instIndex[node.first + k]))
+         return;
+   }
+ }
+
+ // sphre la plus proche touche avant t (t est mis  jour), -1 sinon, et
+ // hit reoit cette sphre dans le repre de la scne. Les sphres des
+ // instances rendent -2 - indice de l'instance.
+ static int nearestSphere(const scene &myScene, const ray &r, float &t, sphere &hit)
+ {
+   int best = nearestIn(myScene.bvh, myScene.bvhIndex, myScene.sphTab, r, t, 0.1f);
+   if (best >= 0)
+     hit = myScene.sphTab[best];
+   forInstances(myScene, r, t, [&](int i) {
+       const instance &inst = myScene.instTab[i];
+       const prototype &proto = myScene.protoTab[inst.proto];
+       float shift;
+       ray local = toPrototype(myScene, inst, r, shift);
+       float tl = (t - shift) / inst.scale;
+       int k = nearestIn(proto.bvh, proto.bvhIndex, proto.sphTab, local, tl, (0.1f - shift) / inst.scale);
+       if (k >= 0)
+       {
+         t = shift + tl * inst.scale;
+         best = -2 - i;
+         hit.pos = toScene(inst, proto.sphTab[k].pos);
+         hit.size = inst.scale * proto.sphTab[k].size;
+         hit.material = proto.sphTab[k].material;
+       }
+       return true;
+     });
+   return best;
+ }
+
+ // une sphre coupe-t-elle le rayon avant t ?
+ static bool occluded(const scene &myScene, const ray &r, float t)
+ {
+   if (occludedIn(myScene.bvh, myScene.bvhIndex, myScene.sphTab, r, t, 0.1f))
+     return true;
+   bool hidden = false;
+   forInstances(myScene, r, t, [&](int i) {
+       const instance &inst = myScene.instTab[i];
+       const prototype &proto = myScene.protoTab[inst.proto];
+       float shift;
+       ray local = toPrototype(myScene, inst, r, shift);
+       hidden = occludedIn(proto.bvh, proto.bvhIndex, proto.sphTab, local, (t - shift) / inst.scale,
+         (0.1f - shift) / inst.scale);
+       return !hidden;
+     });
+   return hidden;
+ }
+
+ // lancer de rayon pour un pixel, la couleur est rendue en flottants (RGB),
+ // aux, s'il n'est pas nul, reoit le premier impact et path le chemin suivi
+ void tracePixel(const scene &myScene, int x, int y, float rgb[3], pixelAux *aux, pathRecord *path)
+ {
      float red = 0, green = 0, blue = 0;
      float coef = 1.0f;
      int level = 0; 
      // lancer de rayon 
      ray viewRay = { {float(x), float(y), -10000.0f}, { 0.0f, 0.0f, 1.0f}};
+     if (path)
+     {
+       path->nbHit = 0;
+       path->escaped = false;
+     }
      do 
      { 
        // recherche de l'intersection la plus proche
        float t = 20000.0f;
-       int currentSphere= -1;
+       sphere hit = { point(), 0.0f, 0 };
+       int currentSphere = nearestSphere(myScene, viewRay, t, hit);
 
-       for (unsigned int i = 0; i < myScene.sphTab.size(); ++i) 
-       { 
-         if (hitSphere(viewRay, myScene.sphTab[i], t)) 
+       if (currentSphere == -1)
+       {
+         if (path)
          {
-           currentSphere = i;
+           path->points->push_back(viewRay.start + 20000.0f * viewRay.dir);
+           path->spheres->push_back(-1);
+           path->escaped = true;
+         }
+         if (aux && level == 0)
+         {
+           aux->red = aux->green = aux->blue = 1.0f;
+           aux->depth = 0.0f;
+           aux->id = -1;
          }
-       }
-
-       if (currentSphere == -1)
          break;
+       }
 
        point newStart = viewRay.start + t * viewRay.dir; 
+       if (path)
+       {
+         path->points->push_back(newStart);
+         path->spheres->push_back(currentSphere);
+         path->nbHit++;
+       }
        // la normale au point d'intersection 
-       vecteur n = newStart - myScene.sphTab[currentSphere].pos;
+       vecteur n = newStart - hit.pos;
        float temp = n * n;
        if (temp == 0.0f) 
          break; 
@@ -110,11 +551,20 @@ using namespace std;
        temp = 1.0f / sqrtf(temp); 
        n = temp * n; 
        
-       material currentMat = myScene.matTab[myScene.sphTab[currentSphere].material]; 
+       const material &currentMat = myScene.matTab[hit.material]; 
+       if (aux && level == 0)
+       {
+         aux->normal = n;
+         aux->depth = t;
+         aux->red = currentMat.red;
+         aux->green = currentMat.green;
+         aux->blue = currentMat.blue;
+         aux->id = currentSphere;
+       }
 
        // calcul de la valeur d'clairement au point 
        for (unsigned int j = 0; j < myScene.lgtTab.size(); ++j) {
-         light currentLight = myScene.lgtTab[j];
+         const light &currentLight = myScene.lgtTab[j];
          vecteur dist = currentLight.pos - newStart;
          if (n * dist <= 0.0f)
            continue;
@@ -125,30 +575,14 @@ using namespace std;
          lightRay.start = newStart;
          lightRay.dir = (1/t) * dist;
          // calcul des ombres 
-         bool inShadow = false; 
-         for (unsigned int i = 0; i < myScene.sphTab.size(); ++i) {
-           if (hitSphere(lightRay, myScene.sphTab[i], t)) {
-             inShadow = true;
-             break;
-           }
-         }
+         bool inShadow = occluded(myScene, lightRay, t);
          if (!inShadow) {
-          /*
            // lambert
-           float lambert = (lightRay.dir * n) * coef;
-           red += lambert * current.red * currentMat.red;
-           green += lambert * current.green * currentMat.green;
-           blue += lambert * current.blue * currentMat.blue;*/
-
-           vecteur currentLight_intensity = {0};
-           float currentMat_diffuse;
-           float currentMat_power;
-           vecteur currentMat_specular = {0};
-
-            float lambert = (lightRay.dir * n) * coef;
-            output.red += lambert * currentLight_intensity.x * currentMat_diffuse;
-            output.green += lambert * currentLight_intensity.y * currentMat_diffuse;
-            output.blue += lambert * currentLight_intensity.z *  currentMat_diffuse;
+           float fLightProjection = lightRay.dir * n;
+           float lambert = fLightProjection * coef;
+           red += lambert * currentLight.red * currentMat.red;
+           green += lambert * currentLight.green * currentMat.green;
+           blue += lambert * currentLight.blue * currentMat.blue;
 
             // Blinn 
             // La direction de Blinn est exactement  mi chemin entre le rayon
@@ -162,14 +596,16 @@ using namespace std;
             float temp = blinnDir * blinnDir;
             if (temp != 0.0f )
             {
-              float blinn = invsqrtf(temp) * max(fLightProjection - fViewProjection , 0.0f);
-              blinn = coef * powf(blinn, currentMat.power);
-              output += blinn * currentMat_specular  * currentLight_intensity;
+              float blinn = (1.0f / sqrtf(temp)) * max(fLightProjection - fViewProjection , 0.0f);
+              blinn = coef * powf(blinn, currentMat.power) * currentMat.specular;
+              red += blinn * currentLight.red;
+              green += blinn * currentLight.green;
+              blue += blinn * currentLight.blue;
             }
          }
        }
          
-       // on itre sur la prochaine reflexion
+       // on itre sur la prochaine reflexion
        coef *= currentMat.reflection;
        float reflet = 2.0f * (viewRay.dir * n);
        viewRay.start = newStart;
@@ -179,19 +615,167 @@ using namespace std;
      } 
      while ((coef > 0.0f) && (level < 10));   
 
-     imageFile.put((unsigned char)min(blue*255.0f,255.0f)).put((unsigned char)min(green*255.0f, 255.0f)).put((unsigned char)min(red*255.0f, 255.0f));
+     rgb[0] = red;
+     rgb[1] = green;
+     rgb[2] = blue;
+ }
+
+ // la couleur est rendue en BGR comme dans le TGA
+ void tracePixel(const scene &myScene, int x, int y, unsigned char *bgr)
+ {
+     float rgb[3];
+     tracePixel(myScene, x, y, rgb, 0);
+     bgr[0] = (unsigned char)min(rgb[2]*255.0f,255.0f);
+     bgr[1] = (unsigned char)min(rgb[1]*255.0f, 255.0f);
+     bgr[2] = (unsigned char)min(rgb[0]*255.0f, 255.0f);
+ }
+
+ // balayage d'un rectangle de l'image, w * h pixels BGR rangs ligne par ligne
+ // mais tracs dans l'ordre de la courbe (includes/rt_curve.h) : avec morton
+ // ou hilbert deux rayons conscutifs restent voisins et retrouvent dans le
+ // cache les noeuds du BVH et les sphres du prcdent
+ void renderTile(const scene &myScene, int x0, int y0, int w, int h, unsigned char *bgr, t_curve order)
+ {
+   vector<int> cells(w * h);
+   rt_curve_order(order, w, h, &cells[0]);
+   for (int k = 0; k < w * h; ++k)
+     tracePixel(myScene, x0 + cells[k] % w, y0 + cells[k] / w, bgr + 3 * cells[k]);
+ }
+
+ bool writeTGA(const char* outputName, int sizex, int sizey, const unsigned char *bgr) 
+ {
+   ofstream imageFile(outputName,ios_base::binary);
+   if (!imageFile)
+     return false; 
+   // Ajout du header TGA
+   imageFile.put(0).put(0);
+   imageFile.put(2);        /* RGB non compresse */
+
+   imageFile.put(0).put(0);
+   imageFile.put(0).put(0);
+   imageFile.put(0);
+
+   imageFile.put(0).put(0); /* origine X */ 
+   imageFile.put(0).put(0); /* origine Y */
+
+   imageFile.put((sizex & 0x00FF)).put((sizex & 0xFF00) / 256);
+   imageFile.put((sizey & 0x00FF)).put((sizey & 0xFF00) / 256);
+   imageFile.put(24);       /* 24 bit bitmap */ 
+   imageFile.put(0); 
+   // fin du header TGA
+
+   imageFile.write((const char *)bgr, sizex * sizey * 3);
+   return bool(imageFile);
+ }
+
+ // rendu en flottants pass au filtre de includes/rt_denoise.h avant l'criture
+ // du TGA. L'image est dterministe : sigma est l'cart type du bruit suppos
+ // sur la luminance de chaque pixel, seuls les carts de cet ordre sont lisss.
+ bool drawDenoised(char* outputName, scene &myScene, float sigma, t_curve order)
+ {
+   t_denoise d;
+   if (!rt_denoise_init(&d, myScene.sizex, myScene.sizey))
+     return false;
+   vector<int> cells(myScene.sizex * myScene.sizey);
+   rt_curve_order(order, myScene.sizex, myScene.sizey, &cells[0]);
+   for (unsigned int k = 0; k < cells.size(); ++k)
+   {
+     int i = cells[k], x = i % myScene.sizex, y = i / myScene.sizex;
+     float rgb[3];
+     pixelAux aux;
+     tracePixel(myScene, x, y, rgb, &aux);
+     rt_denoise_set(&d, i, RT_VEC(rgb[0], rgb[1], rgb[2]), sigma * sigma, aux.normal,
+       aux.depth, RT_VEC(aux.red, aux.green, aux.blue), aux.id);
    }
+   for (int step = 0; step < d.iterations; ++step)
+     rt_denoise_rows(&d, step, 0, myScene.sizey);
+   vector<unsigned char> image(myScene.sizex * myScene.sizey * 3);
+   for (int i = 0; i < myScene.sizex * myScene.sizey; ++i)
+   {
+     t_vec c = rt_denoise_get(&d, i);
+     image[3 * i] = (unsigned char)min(c.z*255.0f, 255.0f);
+     image[3 * i + 1] = (unsigned char)min(c.y*255.0f, 255.0f);
+     image[3 * i + 2] = (unsigned char)min(c.x*255.0f, 255.0f);
    }
-   return true;
+   rt_denoise_free(&d);
+   return writeTGA(outputName, myScene.sizex, myScene.sizey, &image[0]);
  }
 
+ bool draw(char* outputName, scene &myScene, t_curve order) 
+ {
+   vector<unsigned char> image(myScene.sizex * myScene.sizey * 3);
+   renderTile(myScene, 0, 0, myScene.sizex, myScene.sizey, &image[0], order);
+   return writeTGA(outputName, myScene.sizex, myScene.sizey, &image[0]);
+ }
+
+ // usage: a.out scene.txt image.tga
+ //        a.out -workers N scene.txt image.tga   (rendu reparti sur N processus)
+ //        a.out -denoise sigma scene.txt image.tga (filtre avant l'criture)
+ //        a.out -watch scene.txt image.tga     (re-rendu  chaque modification)
+ //        a.out -daemon socket                 (rendus  la demande, daemon.cpp)
+ //        a.out -client socket scene.txt image.tga [x y w h]
+ //                                             (un rendu demand au daemon)
+ // options en tte : -order rows|morton|hilbert (ordre de parcours des pixels
+ // et des tuiles), -perf (dfauts de cache du dernier niveau par rayon primaire,
+ // includes/rt_perf.h), -threads N et -cache N (threads de rendu et scnes
+ // gardes par le daemon), -remote (le daemon lit la scne et crit l'image)
  int main(int argc, char* argv[]) {
+   t_curve order = RT_CURVE_ROWS;
+   bool perf = false, remote = false;
+   int nbThreads = 0, nbScenes = 8;
+   int n = 1;
+   for (int i = 1; i < argc; ++i)
+   {
+     if (!strcmp(argv[i], "-order") && i + 1 < argc && rt_curve_parse(argv[i + 1]) >= 0)
+       order = (t_curve)rt_curve_parse(argv[++i]);
+     else if (!strcmp(argv[i], "-perf"))
+       perf = true;
+     else if (!strcmp(argv[i], "-remote"))
+       remote = true;
+     else if (!strcmp(argv[i], "-threads") && i + 1 < argc)
+       nbThreads = atoi(argv[++i]);
+     else if (!strcmp(argv[i], "-cache") && i + 1 < argc)
+       nbScenes = atoi(argv[++i]);
+     else
+       argv[n++] = argv[i];
+   }
+   argc = n;
+   if (argc == 2 && !strcmp(argv[1], "-worker"))
+     return runWorker(0);
+   if (argc == 5 && !strcmp(argv[1], "-workers"))
+     return runCoordinator(argv[3], argv[4], atoi(argv[2]), argv[0], order);
+   if (argc == 4 && !strcmp(argv[1], "-watch"))
+     return runWatch(argv[2], argv[3]);
+   if (argc == 3 && !strcmp(argv[1], "-daemon"))
+     return runDaemon(argv[2], nbThreads, nbScenes);
+   if ((argc == 5 || argc == 9) && !strcmp(argv[1], "-client"))
+   {
+     int window[4] = { 0, 0, 0, 0 };
+     for (int i = 0; argc == 9 && i < 4; ++i)
+       window[i] = atoi(argv[5 + i]);
+     return runClient(argv[2], argv[3], argv[4], window, remote, order);
+   }
+   if (argc == 5 && !strcmp(argv[1], "-denoise"))
+   {
+     scene myScene;
+     if (!init(argv[3], myScene))
+       return -1;
+     return drawDenoised(argv[4], myScene, atof(argv[2]), order) ? 0 : -1;
+   }
    if  (argc < 3)
      return -1;
    scene myScene;
    if (!init(argv[1], myScene))
      return -1;
-   if (!draw(argv[2], myScene))
+   t_perf counters = {{-1, -1}};
+   if (perf)
+     rt_perf_open(&counters);
+   if (!draw(argv[2], myScene, order))
      return -1;
+   if (perf)
+   {
+     rt_perf_report(&counters, "draw", double(myScene.sizex) * myScene.sizey);
+     rt_perf_close(&counters);
+   }
    return 0;
  }
@@ -1,51 +1,62 @@
-struct point {
-	float x, y, z;
+#ifndef RAYTRACE_H
+#define RAYTRACE_H
+
+#include <rt_vec.h>
+#include <rt_curve.h>
+
+// point et vecteur restent deux types distincts (le produit de deux vecteurs
+// est le produit scalaire ici) mais partagent le stockage et les calculs
+// de includes/rt_vec.h avec les autres programmes.
+struct point : t_vec {
+	using t_vec::t_vec;
+	constexpr point(const t_vec &v) : t_vec(v) {}
 };
-istream & operator >> ( istream &inputFile,  point& p ) {
+inline istream & operator >> ( istream &inputFile,  point& p ) {
 	return inputFile >> p.x >> p.y >> p.z ; 
 }
 
-struct vecteur {
-	float x, y, z;
+struct vecteur : t_vec {
+	using t_vec::t_vec;
+	constexpr vecteur(const t_vec &v) : t_vec(v) {}
 };
-istream & operator >> ( istream &inputFile,  vecteur& v ) {
+inline istream & operator >> ( istream &inputFile,  vecteur& v ) {
 	return inputFile >> v.x >> v.y >> v.z ; 
 }
 
-point operator + (const point&p, const vecteur &v){
-	point p2={p.x + v.x, p.y + v.y, p.z + v.z };
-	return p2;
+constexpr point operator + (const point&p, const vecteur &v){
+	return vec_add(p, v);
 }
 
-point operator - (const point&p, const vecteur &v){
-	point p2={p.x - v.x, p.y - v.y, p.z - v.z };
-	return p2;
+constexpr point operator - (const point&p, const vecteur &v){
+	return vec_sub(p, v);
 }
 
-vecteur operator - (const point&p1, const point &p2){
-	vecteur v={p1.x - p2.x, p1.y - p2.y, p1.z - p2.z };
-	return v;
+constexpr vecteur operator - (const point&p1, const point &p2){
+	return vec_sub(p1, p2);
 }
 
-vecteur operator * (float c, const vecteur &v)
+constexpr vecteur operator * (float c, const vecteur &v)
 {
-	vecteur v2={v.x *c, v.y * c, v.z * c };
-	return v2;
+	return vec_mult_f(v, c);
 }
 
-vecteur operator - (const vecteur&v1, const vecteur &v2){
-	vecteur v={v1.x - v2.x, v1.y - v2.y, v1.z - v2.z };
-	return v;
+constexpr vecteur operator - (const vecteur&v1, const vecteur &v2){
+	return vec_sub(v1, v2);
 }
 
-float operator * (const vecteur&v1, const vecteur &v2 ) {
-	return v1.x * v2.x + v1.y * v2.y + v1.z * v2.z;
+constexpr float operator * (const vecteur&v1, const vecteur &v2 ) {
+	return dot_product(v1, v2);
 }
 
+// Les fichiers de scene ne donnent que la couleur diffuse et la reflexion:
+// la composante speculaire prend les valeurs du tutoriel (blanc, puissance 60).
 struct material {
 	float red, green, blue, reflection;
+	float specular, power;
 };
-istream & operator >> ( istream &inputFile, material& mat ) {
+inline istream & operator >> ( istream &inputFile, material& mat ) {
+	mat.specular = 1.0f;
+	mat.power = 60.0f;
 	return inputFile >> mat.red >> mat.green >> mat.blue >> mat.reflection; 
 }
 
@@ -54,7 +65,7 @@ struct sphere {
 	float size;
 	int material;
 };
-istream & operator >> ( istream &inputFile, sphere& sph ) {
+inline istream & operator >> ( istream &inputFile, sphere& sph ) {
 	return inputFile >> sph.pos >> sph.size >> sph.material;
 }
 
@@ -62,7 +73,7 @@ struct light {
 	point pos;
 	float red, green, blue;
 };
-istream & operator >> ( istream &inputFile, light& lig ) {
+inline istream & operator >> ( istream &inputFile, light& lig ) {
 	return inputFile >> lig.pos >> lig.red >> lig.green >> lig.blue;
 }
 
@@ -71,9 +82,103 @@ struct ray {
 	vecteur dir;
 };
 
+// premier impact du rayon de vue d'un pixel, pour guider le dbruitage
+// (id = -1 si le rayon ne touche rien)
+struct pixelAux {
+	vecteur normal;
+	float depth;
+	float red, green, blue;
+	int id;
+};
+
+// BVH des sphres : un enfant est toujours rang aprs son parent, si bien
+// que refitBVH() recalcule les botes de la fin vers le dbut quand les sphres
+// bougent sans changer de nombre (mode -watch), sans refaire l'arbre.
+struct bvhNode {
+	point lo, hi;
+	int first, count;   // feuille : count sphres de bvhIndex  partir de first
+	                    // noeud interne (count == 0) : enfants first et first + 1
+};
+
+// instanciation : un prototype est un groupe de sphres dans son propre
+// repre, avec son propre BVH, et chaque instance le pose dans la scne
+// (position, chelle, rotation). C'est le rayon qui est ramen dans le repre
+// du prototype, les sphres ne sont jamais recopies : la mmoire et la
+// construction des BVH des prototypes ne dpendent que des sphres
+// distinctes, le BVH des instances que de leur nombre.
+struct prototype {
+	vector<sphere>  sphTab;
+	vector<bvhNode> bvh;
+	vector<int>     bvhIndex;
+	float           reach;    // distance de l'origine au point le plus loin
+};
+
+// un point q du prototype est en pos + scale * rot * q dans la scne (rot :
+// matrice de rotation range ligne par ligne)
+struct instance {
+	int proto;
+	point pos;
+	float scale;
+	float rot[9];
+};
+
 struct scene {
 	vector<material> matTab;
 	vector<sphere>   sphTab;
 	vector<light>    lgtTab;
 	int sizex, sizey;
+	vector<bvhNode>  bvh;
+	vector<int>      bvhIndex;
+	vector<prototype> protoTab;
+	vector<instance> instTab;
+	vector<bvhNode>  instBvh;     // BVH des instances, feuilles dans instIndex
+	vector<int>      instIndex;
+};
+
+// chemin suivi par un pixel, pour le mode -watch : les points d'impact sont
+// ajouts  points et les sphres touches  spheres, suivis du bout du
+// dernier rayon s'il ne touche rien (sphre -1). Une sphre d'une instance
+// est note -2 - indice de l'instance.
+struct pathRecord {
+	vector<point> *points;
+	vector<int> *spheres;
+	int nbHit;
+	bool escaped;
 };
+
+// messages des modes -workers et -daemon (distributed.cpp) : un entete
+// {type, taille} suivi de sa charge utile
+struct msgHeader {
+	uint32_t type, size;
+};
+
+// une tuile de l'image, et le rendu qui la suit dans un message
+struct tileJob {
+	int32_t id, x0, y0, w, h, order;
+};
+
+const int TILE_SIZE = 32;
+
+bool readScene(istream &sceneFile, scene &myScene);
+bool validScene(const scene &myScene);
+bool init(istream &sceneFile, scene &myScene);
+bool init(const char* inputName, scene &myScene);
+void buildBVH(scene &myScene);
+void refitBVH(scene &myScene);
+void buildInstances(scene &myScene);
+void tracePixel(const scene &myScene, int x, int y, float rgb[3], pixelAux *aux, pathRecord *path = 0);
+void renderTile(const scene &myScene, int x0, int y0, int w, int h, unsigned char *bgr,
+  t_curve order = RT_CURVE_ROWS);
+bool writeTGA(const char* outputName, int sizex, int sizey, const unsigned char *bgr);
+
+int runCoordinator(const char* inputName, const char* outputName, int nbWorkers, const char* self,
+  t_curve order);
+int runWorker(int fd);
+int runWatch(const char* inputName, const char* outputName);
+int runDaemon(const char* socketName, int nbThreads, int nbScenes);
+int runClient(const char* socketName, const char* inputName, const char* outputName,
+  const int window[4], bool remote, t_curve order);
+bool sendMsg(int fd, uint32_t type, const void *a, uint32_t alen, const void *b = NULL, uint32_t blen = 0);
+bool recvMsg(int fd, uint32_t &type, vector<char> &payload, uint32_t maxSize = 0xffffffffu);
+
+#endif
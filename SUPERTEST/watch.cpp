@@ -0,0 +1,334 @@
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <cerrno>
+#include <chrono>
+#include <algorithm>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/inotify.h>
+using namespace std;
+
+#include "raytrace.h"
+
+ // Mode -watch: l'image est re-rendue  chaque sauvegarde du fichier de scne.
+ // Le rpertoire du fichier est surveill par inotify (les diteurs qui
+ // crivent un fichier temporaire puis le renomment remplacent l'inode, que
+ // l'on perdrait en surveillant le fichier lui-mme).
+ // Chaque pixel garde le chemin de ses rayons (points d'impact et sphres
+ // touches, bout du dernier rayon).  chaque modification les nouvelles tables
+ // sont compares aux anciennes et seuls les pixels qui peuvent avoir chang
+ // sont relancs:
+ // - une sphre qui bouge, change de taille, apparat ou disparat: les pixels
+ //   dont un rayon, ou un rayon d'ombre, passe prs de sa position d'avant ou
+ //   d'aprs;
+ // - une sphre dont seule la matire change: les pixels dont un rayon la
+ //   touche (les ombres ne dpendent pas des matires);
+ // - une lumire: toute l'image;
+ // - un prototype ou une instance, ou une matire quand il y a des instances:
+ //   toute l'image (les chemins ne disent pas quelle sphre d'une instance
+ //   ils touchent).
+ // Le BVH est rajust (refitBVH) tant que le nombre de sphres ne change pas.
+ // Les chemins sont rcrits sur place quand ils tiennent dans leur ancienne
+ // place, et le tableau n'est recompact que quand la moiti en est perdue.
+ // L'image est crite dans un fichier temporaire puis renomme, un visualiseur
+ // ne voit jamais de TGA  moiti crit.
+
+ // au-del de MAX_MOVED sphres dplaces, tester chaque chemin cote plus que
+ // de tout relancer
+ const unsigned int MAX_MOVED = 64;
+
+ struct pixelPath {
+   int first, capacity;           // place rserve dans points et sphres
+   int nbHit;
+   bool escaped;
+ };
+
+ struct watchState {
+   scene myScene;
+   vector<unsigned char> image;   // BGR, comme dans le TGA
+   vector<point> points;          // les chemins de tous les pixels
+   vector<int> spheres;           // la sphre touche  chaque point, ou -1
+   vector<pixelPath> paths;
+   size_t reserved;               // somme des capacits, le reste est perdu
+   vector<point> tmpPoints;       // chemin du pixel en cours
+   vector<int> tmpSpheres;
+ };
+
+ static double now()
+ {
+   return chrono::duration<double>(chrono::steady_clock::now().time_since_epoch()).count();
+ }
+
+ static bool sameMaterial(const material &a, const material &b)
+ {
+   return a.red == b.red && a.green == b.green && a.blue == b.blue && a.reflection == b.reflection
+     && a.specular == b.specular && a.power == b.power;
+ }
+
+ static bool sameSphere(const sphere &a, const sphere &b)
+ {
+   return a.pos.x == b.pos.x && a.pos.y == b.pos.y && a.pos.z == b.pos.z && a.size == b.size
+     && a.material == b.material;
+ }
+
+ static bool sameLight(const light &a, const light &b)
+ {
+   return a.pos.x == b.pos.x && a.pos.y == b.pos.y && a.pos.z == b.pos.z
+     && a.red == b.red && a.green == b.green && a.blue == b.blue;
+ }
+
+ static bool sameInstances(const scene &a, const scene &b)
+ {
+   if (a.protoTab.size() != b.protoTab.size() || a.instTab.size() != b.instTab.size())
+     return false;
+   for (unsigned int p = 0; p < a.protoTab.size(); ++p)
+   {
+     const vector<sphere> &sa = a.protoTab[p].sphTab, &sb = b.protoTab[p].sphTab;
+     if (sa.size() != sb.size())
+       return false;
+     for (unsigned int i = 0; i < sa.size(); ++i)
+       if (!sameSphere(sa[i], sb[i]))
+         return false;
+   }
+   for (unsigned int i = 0; i < a.instTab.size(); ++i)
+   {
+     const instance &ia = a.instTab[i], &ib = b.instTab[i];
+     if (ia.proto != ib.proto || ia.pos.x != ib.pos.x || ia.pos.y != ib.pos.y || ia.pos.z != ib.pos.z
+       || ia.scale != ib.scale || memcmp(ia.rot, ib.rot, sizeof(ia.rot)))
+       return false;
+   }
+   return true;
+ }
+
+ // le segment [a, b] passe-t-il  porte de la sphre ? Calcul en double avec
+ // une marge: un segment fait jusqu' 20000 units, on ne doit rien rater.
+ static bool segmentTouches(const point &a, const point &b, const sphere &s)
+ {
+   double abx = b.x - a.x, aby = b.y - a.y, abz = b.z - a.z;
+   double acx = s.pos.x - a.x, acy = s.pos.y - a.y, acz = s.pos.z - a.z;
+   double len2 = abx * abx + aby * aby + abz * abz;
+   double u = len2 > 0.0 ? (acx * abx + acy * aby + acz * abz) / len2 : 0.0;
+   u = max(0.0, min(1.0, u));
+   double dx = acx - u * abx, dy = acy - u * aby, dz = acz - u * abz;
+   double r = s.size + 1e-2 * (1.0 + s.size);
+   return dx * dx + dy * dy + dz * dz <= r * r;
+ }
+
+ static bool pathTouches(const watchState &w, int x, int y, const pixelPath &p,
+   const vector<sphere> &moved, const vector<char> &shaded)
+ {
+   const point *pts = &w.points[p.first];
+   for (int k = 0; k < p.nbHit; ++k)
+     if (w.spheres[p.first + k] >= 0 && shaded[w.spheres[p.first + k]])
+       return true;
+   int n = p.nbHit + (p.escaped ? 1 : 0);
+   point from(float(x), float(y), -10000.0f);
+   for (int k = 0; k < n; from = pts[k++])
+     for (unsigned int c = 0; c < moved.size(); ++c)
+       if (segmentTouches(from, pts[k], moved[c]))
+         return true;
+   for (int k = 0; k < p.nbHit; ++k)
+     for (unsigned int j = 0; j < w.myScene.lgtTab.size(); ++j)
+       for (unsigned int c = 0; c < moved.size(); ++c)
+         if (segmentTouches(pts[k], w.myScene.lgtTab[j].pos, moved[c]))
+           return true;
+   return false;
+ }
+
+ // relance le pixel (x, y) et range son nouveau chemin,  sa place s'il y tient
+ static void retrace(watchState &w, int x, int y, pixelPath &p)
+ {
+   float rgb[3];
+   pathRecord rec = { &w.tmpPoints, &w.tmpSpheres, 0, false };
+   w.tmpPoints.clear();
+   w.tmpSpheres.clear();
+   tracePixel(w.myScene, x, y, rgb, 0, &rec);
+   int n = w.tmpPoints.size();
+   if (n > p.capacity)
+   {
+     w.reserved += n - p.capacity;
+     p.first = w.points.size();
+     p.capacity = n;
+     w.points.resize(p.first + n);
+     w.spheres.resize(p.first + n);
+   }
+   copy(w.tmpPoints.begin(), w.tmpPoints.end(), w.points.begin() + p.first);
+   copy(w.tmpSpheres.begin(), w.tmpSpheres.end(), w.spheres.begin() + p.first);
+   p.nbHit = rec.nbHit;
+   p.escaped = rec.escaped;
+   unsigned char *bgr = &w.image[3 * (y * w.myScene.sizex + x)];
+   bgr[0] = (unsigned char)min(rgb[2]*255.0f, 255.0f);
+   bgr[1] = (unsigned char)min(rgb[1]*255.0f, 255.0f);
+   bgr[2] = (unsigned char)min(rgb[0]*255.0f, 255.0f);
+ }
+
+ static void renderAll(watchState &w)
+ {
+   int size = w.myScene.sizex * w.myScene.sizey;
+   w.image.resize(size * 3);
+   w.paths.assign(size, pixelPath());
+   w.points.clear();
+   w.spheres.clear();
+   w.reserved = 0;
+   for (int y = 0, i = 0; y < w.myScene.sizey; ++y)
+   for (int x = 0; x < w.myScene.sizex; ++x, ++i)
+     retrace(w, x, y, w.paths[i]);
+ }
+
+ // regroupe les chemins au dbut des tableaux, chacun  la taille exacte
+ static void compact(watchState &w)
+ {
+   vector<point> points;
+   vector<int> spheres;
+   points.reserve(w.reserved);
+   spheres.reserve(w.reserved);
+   for (unsigned int i = 0; i < w.paths.size(); ++i)
+   {
+     pixelPath &p = w.paths[i];
+     int n = p.nbHit + (p.escaped ? 1 : 0);
+     points.insert(points.end(), w.points.begin() + p.first, w.points.begin() + p.first + n);
+     spheres.insert(spheres.end(), w.spheres.begin() + p.first, w.spheres.begin() + p.first + n);
+     p.first = points.size() - n;
+     p.capacity = n;
+   }
+   w.points.swap(points);
+   w.spheres.swap(spheres);
+   w.reserved = w.points.size();
+ }
+
+ // applique la nouvelle scne, rend le nombre de pixels relancs
+ static int update(watchState &w, scene &newScene)
+ {
+   scene &old = w.myScene;
+   bool lightsChanged = old.lgtTab.size() != newScene.lgtTab.size();
+   for (unsigned int j = 0; !lightsChanged && j < old.lgtTab.size(); ++j)
+     lightsChanged = !sameLight(old.lgtTab[j], newScene.lgtTab[j]);
+   bool materialsChanged = old.matTab.size() != newScene.matTab.size();
+   for (unsigned int j = 0; !materialsChanged && j < old.matTab.size(); ++j)
+     materialsChanged = !sameMaterial(old.matTab[j], newScene.matTab[j]);
+   bool instancesChanged = !sameInstances(old, newScene);
+   if (instancesChanged)
+     buildInstances(newScene);
+   else
+   {
+     newScene.protoTab.swap(old.protoTab);
+     newScene.instBvh.swap(old.instBvh);
+     newScene.instIndex.swap(old.instIndex);
+   }
+   // une sphre dplace y est deux fois,  sa place d'avant et d'aprs
+   vector<sphere> moved;
+   vector<char> shaded(max(old.sphTab.size(), newScene.sphTab.size()), 0);
+   for (unsigned int i = 0; i < max(old.sphTab.size(), newScene.sphTab.size()); ++i)
+   {
+     bool inOld = i < old.sphTab.size(), inNew = i < newScene.sphTab.size();
+     if (inOld && inNew && old.sphTab[i].pos.x == newScene.sphTab[i].pos.x
+       && old.sphTab[i].pos.y == newScene.sphTab[i].pos.y
+       && old.sphTab[i].pos.z == newScene.sphTab[i].pos.z
+       && old.sphTab[i].size == newScene.sphTab[i].size)
+     {
+       shaded[i] = !sameSphere(old.sphTab[i], newScene.sphTab[i])
+         || !sameMaterial(old.matTab[old.sphTab[i].material], newScene.matTab[newScene.sphTab[i].material]);
+       continue;
+     }
+     if (inOld)
+       moved.push_back(old.sphTab[i]);
+     if (inNew)
+       moved.push_back(newScene.sphTab[i]);
+   }
+   if (old.sphTab.size() == newScene.sphTab.size())
+   {
+     newScene.bvh.swap(old.bvh);
+     newScene.bvhIndex.swap(old.bvhIndex);
+     refitBVH(newScene);
+   }
+   else
+     buildBVH(newScene);
+   bool full = newScene.sizex != old.sizex || newScene.sizey != old.sizey
+     || lightsChanged || moved.size() > 2 * MAX_MOVED || instancesChanged
+     || (materialsChanged && !newScene.instTab.empty());
+   swap(w.myScene, newScene);
+   if (full)
+   {
+     renderAll(w);
+     return w.myScene.sizex * w.myScene.sizey;
+   }
+   int retraced = 0;
+   for (int y = 0, i = 0; y < w.myScene.sizey; ++y)
+   for (int x = 0; x < w.myScene.sizex; ++x, ++i)
+     if (pathTouches(w, x, y, w.paths[i], moved, shaded))
+     {
+       retrace(w, x, y, w.paths[i]);
+       retraced++;
+     }
+   if (w.points.size() > 2 * w.reserved)
+     compact(w);
+   return retraced;
+ }
+
+ static bool writeAtomic(const char* outputName, const watchState &w)
+ {
+   string tmp = string(outputName) + ".tmp";
+   if (!writeTGA(tmp.c_str(), w.myScene.sizex, w.myScene.sizey, &w.image[0]))
+     return false;
+   return rename(tmp.c_str(), outputName) == 0;
+ }
+
+ int runWatch(const char* inputName, const char* outputName)
+ {
+   watchState w;
+   if (!init(inputName, w.myScene) || !validScene(w.myScene))
+     return -1;
+   double start = now();
+   renderAll(w);
+   if (!writeAtomic(outputName, w))
+     return -1;
+   cerr << inputName << ": rendu complet en " << (now() - start) * 1000 << " ms" << endl;
+
+   string path(inputName);
+   size_t slash = path.rfind('/');
+   string dir = slash == string::npos ? "." : path.substr(0, slash + 1);
+   string name = slash == string::npos ? path : path.substr(slash + 1);
+   int fd = inotify_init1(IN_CLOEXEC);
+   if (fd < 0 || inotify_add_watch(fd, dir.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO) < 0)
+   {
+     perror("inotify");
+     return -1;
+   }
+   char buf[4096] __attribute__((aligned(__alignof__(inotify_event))));
+   for (;;)
+   {
+     ssize_t len = read(fd, buf, sizeof(buf));
+     if (len < 0 && errno == EINTR)
+       continue;
+     if (len <= 0)
+       return -1;
+     bool modified = false;
+     for (char *p = buf; p < buf + len; p += sizeof(inotify_event) + ((inotify_event *)p)->len)
+       if (((inotify_event *)p)->len && name == ((inotify_event *)p)->name)
+         modified = true;
+     if (!modified)
+       continue;
+     // une sauvegarde fait souvent plusieurs vnements de suite
+     pollfd pfd = { fd, POLLIN, 0 };
+     while (poll(&pfd, 1, 10) > 0 && read(fd, buf, sizeof(buf)) > 0)
+       ;
+     start = now();
+     scene newScene;
+     ifstream sceneFile(inputName);
+     if (!sceneFile || !readScene(sceneFile, newScene) || !validScene(newScene))
+     {
+       cerr << inputName << ": scene invalide, l'image precedente est gardee" << endl;
+       continue;
+     }
+     int retraced = update(w, newScene);
+     if (!writeAtomic(outputName, w))
+       cerr << outputName << ": ecriture impossible" << endl;
+     cerr << inputName << ": " << retraced << " pixels relances sur " << w.myScene.sizex * w.myScene.sizey
+       << " en " << (now() - start) * 1000 << " ms" << endl;
+   }
+ }
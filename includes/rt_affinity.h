@@ -0,0 +1,169 @@
+#ifndef RT_AFFINITY_H
+# define RT_AFFINITY_H
+
+/*
+** Header-only CPU placement of the render threads (Linux), shared by the
+** renderers. The topology (NUMA node, package, core and SMT sibling of every
+** cpu the process may run on) is read from /sys, then sorted by a policy:
+** - compact: fill a node before the next one, siblings of a core together;
+** - scatter: one core per node in turn, the SMT siblings after every core;
+** - nosmt:   scatter without the SMT siblings.
+** Worker i then pins itself to order[i % n] before touching any memory, so
+** what it first touches (its tiles, its stack) lands on its own node.
+** Needs _GNU_SOURCE for the cpu sets (g++ always defines it).
+*/
+
+# include <sched.h>
+# include <stdio.h>
+# include <string.h>
+# include <unistd.h>
+# include <rt_vec.h>
+
+# define RT_AFFINITY_MAX_CPUS	1024
+# define RT_AFFINITY_MAX_NODES	64
+
+typedef enum			e_affinity
+{
+	RT_AFFINITY_NONE,
+	RT_AFFINITY_COMPACT,
+	RT_AFFINITY_SCATTER,
+	RT_AFFINITY_NO_SMT
+}						t_affinity;
+
+typedef struct			s_cpu
+{
+	int					id;
+	int					node;
+	int					package;
+	int					core;
+	int					thread;
+}						t_cpu;
+
+/*
+** Policy named name, -1 if unknown
+*/
+RT_INLINE int			rt_affinity_parse(const char *name)
+{
+	if (!strcmp(name, "none"))
+		return (RT_AFFINITY_NONE);
+	if (!strcmp(name, "compact"))
+		return (RT_AFFINITY_COMPACT);
+	if (!strcmp(name, "scatter"))
+		return (RT_AFFINITY_SCATTER);
+	if (!strcmp(name, "nosmt"))
+		return (RT_AFFINITY_NO_SMT);
+	return (-1);
+}
+
+RT_INLINE int			rt_affinity_read(int cpu, const char *file, int fallback)
+{
+	char				path[128];
+	FILE				*f;
+	int					value;
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s",
+		cpu, file);
+	if (!(f = fopen(path, "r")))
+		return (fallback);
+	if (fscanf(f, "%d", &value) != 1)
+		value = fallback;
+	fclose(f);
+	return (value);
+}
+
+/*
+** The cpus this process may run on, at most max of them. A cpu lists its
+** node as a nodeN link in its /sys directory; thread is the rank of the cpu
+** among the SMT siblings of its core.
+*/
+RT_INLINE int			rt_affinity_topology(t_cpu *cpus, int max)
+{
+	cpu_set_t			allowed;
+	char				path[128];
+	int					n;
+	int					i;
+	int					k;
+
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0)
+		return (0);
+	n = 0;
+	for (i = 0; i < CPU_SETSIZE && n < max; i++)
+	{
+		if (!CPU_ISSET(i, &allowed))
+			continue ;
+		cpus[n].id = i;
+		cpus[n].package = rt_affinity_read(i, "physical_package_id", 0);
+		cpus[n].core = rt_affinity_read(i, "core_id", i);
+		cpus[n].node = 0;
+		for (k = 0; k < RT_AFFINITY_MAX_NODES; k++)
+		{
+			snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/node%d",
+				i, k);
+			if (access(path, F_OK) == 0)
+				cpus[n].node = k;
+		}
+		cpus[n].thread = 0;
+		for (k = 0; k < n; k++)
+			if (cpus[k].package == cpus[n].package
+				&& cpus[k].core == cpus[n].core)
+				cpus[n].thread++;
+		n++;
+	}
+	return (n);
+}
+
+/*
+** Sort key of a cpu: compact orders by (node, package, core, thread),
+** scatter by (thread, core, node, package)
+*/
+RT_INLINE long long		rt_affinity_key(const t_cpu *cpu, t_affinity policy)
+{
+	if (policy == RT_AFFINITY_COMPACT)
+		return (((long long)cpu->node << 48) | ((long long)cpu->package << 36)
+			| ((long long)cpu->core << 12) | cpu->thread);
+	return (((long long)cpu->thread << 48) | ((long long)cpu->core << 24)
+		| ((long long)cpu->node << 12) | cpu->package);
+}
+
+/*
+** Fill order with the cpus in the order the workers take them, returns how
+** many there are (0: leave the threads where the scheduler puts them)
+*/
+RT_INLINE int			rt_affinity_plan(t_affinity policy, int *order, int max)
+{
+	static t_cpu		cpus[RT_AFFINITY_MAX_CPUS];
+	t_cpu				tmp;
+	int					n;
+	int					i;
+	int					j;
+
+	if (policy == RT_AFFINITY_NONE)
+		return (0);
+	n = rt_affinity_topology(cpus, RT_AFFINITY_MAX_CPUS);
+	for (i = 1; i < n; i++)
+	{
+		tmp = cpus[i];
+		for (j = i; j > 0 && rt_affinity_key(&cpus[j - 1], policy)
+			> rt_affinity_key(&tmp, policy); j--)
+			cpus[j] = cpus[j - 1];
+		cpus[j] = tmp;
+	}
+	for (i = 0, j = 0; i < n && j < max; i++)
+		if (policy != RT_AFFINITY_NO_SMT || cpus[i].thread == 0)
+			order[j++] = cpus[i].id;
+	return (j);
+}
+
+/*
+** Pin the calling thread to cpu
+*/
+RT_INLINE int			rt_affinity_pin(int cpu)
+{
+	cpu_set_t			set;
+
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	return (sched_setaffinity(0, sizeof(set), &set) == 0);
+}
+
+#endif
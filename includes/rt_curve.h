@@ -0,0 +1,129 @@
+#ifndef RT_CURVE_H
+# define RT_CURVE_H
+
+/*
+** Header-only traversal orders of a grid (the pixels of a tile, the tiles of
+** an image), shared by the renderers:
+** - rows:    row after row, the order the renderers always used;
+** - morton:  Z-order, quadrant after quadrant at every scale;
+** - hilbert: the Hilbert curve, like morton but every step is to a neighbour.
+** With the two curves, consecutive rays stay close to each other on screen,
+** so they mostly meet the same spheres and BVH nodes while those are still in
+** cache, where a row jumps back across the whole tile or image at its end.
+** A w x h grid takes the points of the curve on the smallest 2^bits square
+** around it that fall inside it.
+*/
+
+# include <string.h>
+# include <stdint.h>
+# include <rt_vec.h>
+
+typedef enum			e_curve
+{
+	RT_CURVE_ROWS,
+	RT_CURVE_MORTON,
+	RT_CURVE_HILBERT
+}						t_curve;
+
+/*
+** Curve named name, -1 if unknown
+*/
+RT_INLINE int			rt_curve_parse(const char *name)
+{
+	if (!strcmp(name, "rows"))
+		return (RT_CURVE_ROWS);
+	if (!strcmp(name, "morton"))
+		return (RT_CURVE_MORTON);
+	if (!strcmp(name, "hilbert"))
+		return (RT_CURVE_HILBERT);
+	return (-1);
+}
+
+/*
+** Point d of the Morton curve: x and y are the even and odd bits of d
+*/
+RT_INLINE void			rt_curve_morton(uint32_t d, uint32_t *x, uint32_t *y)
+{
+	uint32_t			v[2];
+	int					k;
+
+	for (k = 0; k < 2; k++)
+	{
+		v[k] = (d >> k) & 0x55555555u;
+		v[k] = (v[k] | (v[k] >> 1)) & 0x33333333u;
+		v[k] = (v[k] | (v[k] >> 2)) & 0x0f0f0f0fu;
+		v[k] = (v[k] | (v[k] >> 4)) & 0x00ff00ffu;
+		v[k] = (v[k] | (v[k] >> 8)) & 0x0000ffffu;
+	}
+	*x = v[0];
+	*y = v[1];
+}
+
+/*
+** Point d of the Hilbert curve on a 2^bits square: the quadrant of every
+** level is read from two bits of d, then the point is rotated or mirrored so
+** the sub-curve joins its neighbours
+*/
+RT_INLINE void			rt_curve_hilbert(uint32_t d, int bits, uint32_t *x,
+							uint32_t *y)
+{
+	uint32_t			s;
+	uint32_t			rx;
+	uint32_t			ry;
+	uint32_t			tmp;
+
+	*x = 0;
+	*y = 0;
+	for (s = 1; s < (1u << bits); s <<= 1, d >>= 2)
+	{
+		rx = (d >> 1) & 1;
+		ry = (d ^ rx) & 1;
+		if (ry == 0)
+		{
+			if (rx == 1)
+			{
+				*x = s - 1 - *x;
+				*y = s - 1 - *y;
+			}
+			tmp = *x;
+			*x = *y;
+			*y = tmp;
+		}
+		*x += s * rx;
+		*y += s * ry;
+	}
+}
+
+/*
+** Fill order with the w * h cells of the grid (y * w + x) in the order of the
+** curve
+*/
+RT_INLINE void			rt_curve_order(t_curve curve, int w, int h, int *order)
+{
+	uint32_t			x;
+	uint32_t			y;
+	uint32_t			d;
+	int					bits;
+	int					n;
+
+	if (curve == RT_CURVE_ROWS)
+	{
+		for (n = 0; n < w * h; n++)
+			order[n] = n;
+		return ;
+	}
+	for (bits = 0; (1 << bits) < w || (1 << bits) < h; bits++)
+		;
+	n = 0;
+	for (d = 0; n < w * h; d++)
+	{
+		if (curve == RT_CURVE_MORTON)
+			rt_curve_morton(d, &x, &y);
+		else
+			rt_curve_hilbert(d, bits, &x, &y);
+		if (x < (uint32_t)w && y < (uint32_t)h)
+			order[n++] = y * w + x;
+	}
+}
+
+#endif
@@ -0,0 +1,266 @@
+#ifndef RT_DENOISE_H
+# define RT_DENOISE_H
+
+/*
+** Header-only edge-aware a-trous wavelet denoiser, shared by the renderers.
+** The caller stores, for every pixel, the noisy colour, the variance of its
+** luminance (0 if unknown) and the primary hit guides: normal, depth, albedo
+** and sphere id (-1 for the background). Each of the iterations is a 3x3
+** B3-spline blur with holes 2^step pixels apart, whose taps are weighted down
+** across normal, depth and id edges and where the luminance differs by more
+** than the noise level of the pixel (SVGF style, variance filtered along).
+** Noise-free pixels (variance 0) are only averaged with identical neighbours.
+** Colour is filtered divided by the albedo so the surface colours stay sharp.
+**
+** Everything is stored as planes of floats and every loop runs along a row,
+** so they vectorise. rt_denoise_rows() filters rows [y0, y1) of one step:
+** run every step in order, the rows of a step on as many threads as wanted:
+**
+**     for (step = 0; step < d.iterations; step++)
+**         parallel for each band of rows: rt_denoise_rows(&d, step, y0, y1);
+*/
+
+# include <stdlib.h>
+# include <rt_vec.h>
+
+typedef struct			s_denoise
+{
+	int					width;
+	int					height;
+	int					iterations;
+	float				sigma_depth;
+	float				sigma_color;
+	float				*color[2][3];
+	float				*var[2];
+	float				*normal[3];
+	float				*depth;
+	float				*albedo[3];
+	int					*id;
+	float				*planes;
+}						t_denoise;
+
+RT_INLINE int			rt_denoise_init(t_denoise *d, int width, int height)
+{
+	size_t				size;
+	int					i;
+
+	size = (size_t)width * height;
+	d->width = width;
+	d->height = height;
+	d->iterations = 5;
+	d->sigma_depth = 0.05f;
+	d->sigma_color = 4.0f;
+	d->planes = (float *)malloc(sizeof(float) * size * 15);
+	d->id = (int *)malloc(sizeof(int) * size);
+	if (!d->planes || !d->id)
+	{
+		free(d->planes);
+		free(d->id);
+		return (0);
+	}
+	for (i = 0; i < 3; i++)
+	{
+		d->color[0][i] = d->planes + size * i;
+		d->color[1][i] = d->planes + size * (3 + i);
+		d->normal[i] = d->planes + size * (6 + i);
+		d->albedo[i] = d->planes + size * (9 + i);
+	}
+	d->var[0] = d->planes + size * 12;
+	d->var[1] = d->planes + size * 13;
+	d->depth = d->planes + size * 14;
+	return (1);
+}
+
+RT_INLINE void			rt_denoise_free(t_denoise *d)
+{
+	free(d->planes);
+	free(d->id);
+}
+
+/*
+** Store pixel i. variance is that of the luminance of color, it is scaled
+** along with the colour when the albedo is divided out.
+*/
+RT_INLINE void			rt_denoise_set(t_denoise *d, int i, t_vec color,
+							float variance, t_vec normal, float depth,
+							t_vec albedo, int id)
+{
+	float				lum;
+
+	albedo.x = albedo.x > 1e-3f ? albedo.x : 1.0f;
+	albedo.y = albedo.y > 1e-3f ? albedo.y : 1.0f;
+	albedo.z = albedo.z > 1e-3f ? albedo.z : 1.0f;
+	if (id < 0)
+	{
+		normal = RT_VEC(0.0f, 0.0f, 1.0f);
+		depth = 0.0f;
+	}
+	d->color[0][0][i] = color.x / albedo.x;
+	d->color[0][1][i] = color.y / albedo.y;
+	d->color[0][2][i] = color.z / albedo.z;
+	lum = 0.2126f * albedo.x + 0.7152f * albedo.y + 0.0722f * albedo.z;
+	d->var[0][i] = variance / (lum * lum);
+	d->normal[0][i] = normal.x;
+	d->normal[1][i] = normal.y;
+	d->normal[2][i] = normal.z;
+	d->depth[i] = depth;
+	d->albedo[0][i] = albedo.x;
+	d->albedo[1][i] = albedo.y;
+	d->albedo[2][i] = albedo.z;
+	d->id[i] = id;
+}
+
+/*
+** Filtered colour of pixel i once every step has run
+*/
+RT_INLINE t_vec			rt_denoise_get(const t_denoise *d, int i)
+{
+	float *const		*c;
+
+	c = d->color[d->iterations & 1];
+	return (RT_VEC(c[0][i] * d->albedo[0][i], c[1][i] * d->albedo[1][i],
+		c[2][i] * d->albedo[2][i]));
+}
+
+/*
+** exp(-x) for x >= 0 as (1 - x / 8)^8: close enough for an edge-stopping
+** weight, and only multiplies so it vectorises
+*/
+RT_CONSTEXPR float		rt_denoise_falloff(float x)
+{
+	float				t = 1.0f - x * 0.125f;
+
+	t = t > 0.0f ? t : 0.0f;
+	t *= t;
+	t *= t;
+	return (t * t);
+}
+
+/*
+** cos^64 of the angle between two normals, as six squarings
+*/
+RT_CONSTEXPR float		rt_denoise_normal(float t)
+{
+	t = t > 0.0f ? t : 0.0f;
+	t *= t;
+	t *= t;
+	t *= t;
+	t *= t;
+	t *= t;
+	return (t * t);
+}
+
+/*
+** Filter pixels [p, end) with the 9 taps at offsets off[] and kernel
+** weights h[] (0 for a tap outside the image, whose offset is then 0). The
+** taps are unrolled and summed in registers; the planes written are distinct
+** from every plane read, which __restrict tells the compiler so it does not
+** give up on vectorising over the run-time alias checks. The variance of a
+** weighted mean is the weighted sum of variances over the squared weight sum.
+*/
+RT_INLINE void			rt_denoise_span(const t_denoise *d, int step, int p,
+							int end, const int *off, const float *h,
+							float *__restrict dr, float *__restrict dg,
+							float *__restrict db, float *__restrict dvar)
+{
+	const float			*r = d->color[step & 1][0];
+	const float			*g = d->color[step & 1][1];
+	const float			*b = d->color[step & 1][2];
+	const float			*var = d->var[step & 1];
+	const float			*nx = d->normal[0];
+	const float			*ny = d->normal[1];
+	const float			*nz = d->normal[2];
+	const float			*depth = d->depth;
+	const int			*id = d->id;
+	float				reach = (float)(1 << step) * d->sigma_depth;
+	float				sum[5];
+	float				inv_depth;
+	float				inv_lum;
+	float				lum;
+	float				w;
+	float				t;
+	int					q;
+	int					k;
+
+	for (; p < end; p++)
+	{
+		inv_depth = 1.0f / (reach * depth[p] + 1e-4f);
+		inv_lum = 1.0f / (d->sigma_color * sqrtf(var[p]) + 1e-4f);
+		lum = 0.2126f * r[p] + 0.7152f * g[p] + 0.0722f * b[p];
+		for (k = 0; k < 5; k++)
+			sum[k] = 0.0f;
+#pragma GCC unroll 9
+		for (k = 0; k < 9; k++)
+		{
+			q = p + off[k];
+			t = RT_FMA(nz[p], nz[q], RT_FMA(ny[p], ny[q], nx[p] * nx[q]));
+			w = rt_denoise_normal(t);
+			w *= rt_denoise_falloff(fabsf(depth[p] - depth[q]) * inv_depth);
+			t = 0.2126f * r[q] + 0.7152f * g[q] + 0.0722f * b[q];
+			w *= rt_denoise_falloff(fabsf(lum - t) * inv_lum);
+			w = id[p] == id[q] ? w * h[k] : 0.0f;
+			sum[0] += w * r[q];
+			sum[1] += w * g[q];
+			sum[2] += w * b[q];
+			sum[3] += w * w * var[q];
+			sum[4] += w;
+		}
+		dr[p] = sum[0] / sum[4];
+		dg[p] = sum[1] / sum[4];
+		db[p] = sum[2] / sum[4];
+		dvar[p] = sum[3] / (sum[4] * sum[4]);
+	}
+}
+
+/*
+** One step on rows [y0, y1). The columns closer than 2^step to a side lose
+** their outer taps and go one pixel at a time, the rest in a single span.
+** In an image narrower than 2^(step + 1) there is no such span, and every
+** column goes one at a time.
+*/
+RT_INLINE void			rt_denoise_rows(t_denoise *d, int step, int y0, int y1)
+{
+	static const float	kernel[3] = {0.25f, 0.5f, 0.25f};
+	float *const		*dst;
+	int					off[2][9];
+	float				h[2][9];
+	int					s;
+	int					x;
+	int					k;
+
+	s = 1 << step;
+	dst = d->color[(step + 1) & 1];
+	for (; y0 < y1; y0++)
+	{
+		for (k = 0; k < 9; k++)
+		{
+			off[0][k] = ((k / 3 - 1) * d->width + k % 3 - 1) * s;
+			h[0][k] = kernel[k / 3] * kernel[k % 3];
+			if (y0 + (k / 3 - 1) * s < 0 || y0 + (k / 3 - 1) * s >= d->height)
+			{
+				off[0][k] = 0;
+				h[0][k] = 0.0f;
+			}
+		}
+		rt_denoise_span(d, step, y0 * d->width + s, (y0 + 1) * d->width - s,
+			off[0], h[0], dst[0], dst[1], dst[2], d->var[(step + 1) & 1]);
+		for (x = 0; x < d->width; x = (x == s - 1 && d->width - s > s)
+			? d->width - s : x + 1)
+		{
+			for (k = 0; k < 9; k++)
+			{
+				off[1][k] = off[0][k];
+				h[1][k] = h[0][k];
+				if (x + (k % 3 - 1) * s < 0 || x + (k % 3 - 1) * s >= d->width)
+				{
+					off[1][k] = 0;
+					h[1][k] = 0.0f;
+				}
+			}
+			rt_denoise_span(d, step, y0 * d->width + x, y0 * d->width + x + 1,
+				off[1], h[1], dst[0], dst[1], dst[2], d->var[(step + 1) & 1]);
+		}
+	}
+}
+
+#endif
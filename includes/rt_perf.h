@@ -0,0 +1,92 @@
+#ifndef RT_PERF_H
+# define RT_PERF_H
+
+/*
+** Header-only hardware counters (Linux perf_event_open), to compare the
+** traversal orders of rt_curve.h: last level cache misses and references of
+** the calling thread and of the threads it starts after rt_perf_open(). The
+** counts of a thread are added when it exits, so read them once the render
+** threads are joined. Every count is -1 where the kernel (or the virtual
+** machine) does not give access to the counter.
+*/
+
+# include <stdio.h>
+# include <string.h>
+# include <unistd.h>
+# include <sys/syscall.h>
+# include <linux/perf_event.h>
+# include <rt_vec.h>
+
+# define RT_PERF_MISSES		0
+# define RT_PERF_REFERENCES	1
+# define RT_PERF_COUNTERS	2
+
+typedef struct			s_perf
+{
+	int					fd[RT_PERF_COUNTERS];
+}						t_perf;
+
+RT_INLINE int			rt_perf_counter(unsigned long long config)
+{
+	struct perf_event_attr	attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HARDWARE;
+	attr.config = config;
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.inherit = 1;
+	return ((int)syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+/*
+** Start counting, returns 0 if no counter is available
+*/
+RT_INLINE int			rt_perf_open(t_perf *p)
+{
+	p->fd[RT_PERF_MISSES] = rt_perf_counter(PERF_COUNT_HW_CACHE_MISSES);
+	p->fd[RT_PERF_REFERENCES] = rt_perf_counter(PERF_COUNT_HW_CACHE_REFERENCES);
+	return (p->fd[RT_PERF_MISSES] >= 0 || p->fd[RT_PERF_REFERENCES] >= 0);
+}
+
+RT_INLINE long long		rt_perf_read(t_perf *p, int counter)
+{
+	long long			value;
+
+	if (p->fd[counter] < 0
+		|| read(p->fd[counter], &value, sizeof(value)) != sizeof(value))
+		return (-1);
+	return (value);
+}
+
+RT_INLINE void			rt_perf_close(t_perf *p)
+{
+	int					i;
+
+	for (i = 0; i < RT_PERF_COUNTERS; i++)
+		if (p->fd[i] >= 0)
+			close(p->fd[i]);
+}
+
+/*
+** One line on stderr: misses and references per camera ray (rays)
+*/
+RT_INLINE void			rt_perf_report(t_perf *p, const char *what, double rays)
+{
+	long long			misses;
+	long long			refs;
+
+	misses = rt_perf_read(p, RT_PERF_MISSES);
+	refs = rt_perf_read(p, RT_PERF_REFERENCES);
+	if (misses < 0 && refs < 0)
+	{
+		fprintf(stderr, "%s: no hardware cache counters on this machine\n",
+			what);
+		return ;
+	}
+	fprintf(stderr, "%s: %lld LLC misses (%.3f per ray), %lld LLC references"
+		" (%.3f per ray)\n", what, misses, misses / rays, refs, refs / rays);
+}
+
+#endif
@@ -0,0 +1,139 @@
+#ifndef RT_RNG_H
+# define RT_RNG_H
+
+/*
+** Header-only counter-based random numbers (Philox4x32-10, Salmon et al.,
+** "Parallel Random Numbers: As Easy as 1, 2, 3"), shared by the renderers.
+** A number is a pure function of (pixel, sample, dimension, seed): there is
+** no hidden state to share between threads, so a sample comes out the same
+** whatever the number of threads or the order the tiles are rendered in.
+** pixel and seed form the key, sample and dimension / 4 the counter, and one
+** call to rt_philox() gives the four dimensions of a block.
+**
+** Samplers walk the dimensions of a sample in order through a t_rng, which
+** only buffers the current block:
+**
+**     rt_rng_init(&rng, pixel, sample, seed);
+**     u = rt_rng_float(&rng);      dimension 0
+**     v = rt_rng_float(&rng);      dimension 1, and so on
+*/
+
+# include <stdint.h>
+# include <rt_vec.h>
+
+# define RT_PHILOX_M0		0xD2511F53u
+# define RT_PHILOX_M1		0xCD9E8D57u
+# define RT_PHILOX_W0		0x9E3779B9u
+# define RT_PHILOX_W1		0xBB67AE85u
+
+typedef struct			s_rng
+{
+	uint32_t			key[2];
+	uint32_t			ctr[4];
+	uint32_t			block[4];
+	uint32_t			dim;
+}						t_rng;
+
+/*
+** The ten Philox rounds: two 32x32->64 bit multiplies and a few xors each
+*/
+RT_INLINE void			rt_philox(const uint32_t ctr[4], const uint32_t key[2],
+							uint32_t out[4])
+{
+	uint64_t			p0;
+	uint64_t			p1;
+	uint32_t			c[4];
+	uint32_t			k[2];
+	int					i;
+
+	for (i = 0; i < 4; i++)
+		c[i] = ctr[i];
+	k[0] = key[0];
+	k[1] = key[1];
+	for (i = 0; i < 10; i++)
+	{
+		p0 = (uint64_t)RT_PHILOX_M0 * c[0];
+		p1 = (uint64_t)RT_PHILOX_M1 * c[2];
+		c[0] = (uint32_t)(p1 >> 32) ^ c[1] ^ k[0];
+		c[2] = (uint32_t)(p0 >> 32) ^ c[3] ^ k[1];
+		c[1] = (uint32_t)p1;
+		c[3] = (uint32_t)p0;
+		k[0] += RT_PHILOX_W0;
+		k[1] += RT_PHILOX_W1;
+	}
+	for (i = 0; i < 4; i++)
+		out[i] = c[i];
+}
+
+/*
+** Uniform float in [0, 1) from the top 24 bits
+*/
+RT_CONSTEXPR float		rt_rng_unit(uint32_t x)
+{
+	return ((float)(x >> 8) * (1.0f / 16777216.0f));
+}
+
+RT_INLINE void			rt_rng_init(t_rng *rng, uint32_t pixel, uint32_t sample,
+							uint32_t seed)
+{
+	rng->key[0] = pixel;
+	rng->key[1] = seed;
+	rng->ctr[0] = sample;
+	rng->ctr[1] = 0;
+	rng->ctr[2] = 0;
+	rng->ctr[3] = 0;
+	rng->dim = 0;
+}
+
+/*
+** Next dimension of the sample
+*/
+RT_INLINE uint32_t		rt_rng_u32(t_rng *rng)
+{
+	if ((rng->dim & 3) == 0)
+	{
+		rng->ctr[1] = rng->dim >> 2;
+		rt_philox(rng->ctr, rng->key, rng->block);
+	}
+	return (rng->block[rng->dim++ & 3]);
+}
+
+/*
+** Continue from dimension dim
+*/
+RT_INLINE void			rt_rng_seek(t_rng *rng, uint32_t dim)
+{
+	rng->dim = dim;
+	if (dim & 3)
+	{
+		rng->ctr[1] = dim >> 2;
+		rt_philox(rng->ctr, rng->key, rng->block);
+	}
+}
+
+RT_INLINE float			rt_rng_float(t_rng *rng)
+{
+	return (rt_rng_unit(rt_rng_u32(rng)));
+}
+
+/*
+** Dimension dim of a sample without walking the ones before it
+*/
+RT_INLINE float			rt_rng_at(uint32_t pixel, uint32_t sample, uint32_t dim,
+							uint32_t seed)
+{
+	uint32_t			ctr[4];
+	uint32_t			key[2];
+	uint32_t			out[4];
+
+	ctr[0] = sample;
+	ctr[1] = dim >> 2;
+	ctr[2] = 0;
+	ctr[3] = 0;
+	key[0] = pixel;
+	key[1] = seed;
+	rt_philox(ctr, key, out);
+	return (rt_rng_unit(out[dim & 3]));
+}
+
+#endif
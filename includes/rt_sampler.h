@@ -0,0 +1,238 @@
+#ifndef RT_SAMPLER_H
+# define RT_SAMPLER_H
+
+/*
+** Header-only low-discrepancy sampler shared by the renderers: the first
+** four dimensions of the Sobol sequence, Owen scrambled with the hash of
+** Burley ("Practical Hash-based Owen Scrambling", JCGT 2020) and padded to
+** any number of dimensions with independently scrambled sets of four.
+**
+** Two ways to give the pixels their samples:
+** - rt_sampler_init(): every pixel shuffles and scrambles the sequence with
+**   its own seed. The error of a pixel is white noise, up to 65536 samples.
+** - rt_sampler_init_zorder(): the pixels take consecutive blocks of 2^log2spp
+**   samples of one sequence, in a scrambled Morton order of the screen
+**   (Ahmed and Wonka, "Screen-Space Blue-Noise Diffusion of Monte Carlo
+**   Sampling Error via Hierarchical Ordering of Pixels", 2020). Neighbouring
+**   blocks together form a well spread point set, which pushes the error of
+**   neighbouring pixels apart: blue noise, as long as a pixel takes at most
+**   2^log2spp samples and the Morton index plus log2spp fits in 32 bits.
+**
+** The dimensions of a sample are read in order with rt_sampler_float(), or
+** from a given one after rt_sampler_seek(), so that e.g. the light sampling
+** of every bounce of a path always uses the same dimensions.
+*/
+
+# include <stdint.h>
+# include <rt_vec.h>
+
+typedef struct			s_sampler
+{
+	uint32_t			index;
+	uint32_t			seed;
+	uint32_t			shuffle;
+	uint32_t			dim;
+	uint32_t			set;
+	float				point[4];
+}						t_sampler;
+
+/*
+** Direction numbers of Sobol dimensions 1 to 4 (Joe and Kuo), bit reversed:
+** the points come out reversed, which is the order the Owen scrambling works
+** in, so a coordinate is only reversed once
+*/
+static const uint32_t	g_sobol_matrix[4][32] = {
+	{0x00000001, 0x00000002, 0x00000004, 0x00000008, 0x00000010, 0x00000020,
+	0x00000040, 0x00000080, 0x00000100, 0x00000200, 0x00000400, 0x00000800,
+	0x00001000, 0x00002000, 0x00004000, 0x00008000, 0x00010000, 0x00020000,
+	0x00040000, 0x00080000, 0x00100000, 0x00200000, 0x00400000, 0x00800000,
+	0x01000000, 0x02000000, 0x04000000, 0x08000000, 0x10000000, 0x20000000,
+	0x40000000, 0x80000000},
+	{0x00000001, 0x00000003, 0x00000005, 0x0000000f, 0x00000011, 0x00000033,
+	0x00000055, 0x000000ff, 0x00000101, 0x00000303, 0x00000505, 0x00000f0f,
+	0x00001111, 0x00003333, 0x00005555, 0x0000ffff, 0x00010001, 0x00030003,
+	0x00050005, 0x000f000f, 0x00110011, 0x00330033, 0x00550055, 0x00ff00ff,
+	0x01010101, 0x03030303, 0x05050505, 0x0f0f0f0f, 0x11111111, 0x33333333,
+	0x55555555, 0xffffffff},
+	{0x00000001, 0x00000003, 0x00000006, 0x00000009, 0x00000017, 0x0000003a,
+	0x00000071, 0x000000a3, 0x00000116, 0x00000339, 0x00000677, 0x000009aa,
+	0x00001601, 0x00003903, 0x00007706, 0x0000aa09, 0x00010117, 0x0003033a,
+	0x00060671, 0x000909a3, 0x00171616, 0x003a3939, 0x00717777, 0x00a3aaaa,
+	0x01170001, 0x033a0003, 0x06710006, 0x09a30009, 0x16160017, 0x3939003a,
+	0x77770071, 0xaaaa00a3},
+	{0x00000001, 0x00000003, 0x00000004, 0x0000000a, 0x0000001f, 0x0000002e,
+	0x00000045, 0x000000c9, 0x0000011b, 0x000002a4, 0x0000079a, 0x00000b67,
+	0x0000101e, 0x0000302d, 0x00004041, 0x0000a0c3, 0x0001f104, 0x0002e28a,
+	0x000457df, 0x000c9bae, 0x0011a105, 0x002a7289, 0x0079e7db, 0x00b6dba4,
+	0x0100011a, 0x030002a7, 0x0400079e, 0x0a000b6d, 0x1f001001, 0x2e003003,
+	0x45004004, 0xc900a00a}
+};
+
+/*
+** The 24 orders of the 4 quadrants, for the Morton order scrambling
+*/
+static const unsigned char	g_sampler_quadrants[24][4] = {
+	{0, 1, 2, 3}, {0, 1, 3, 2}, {0, 2, 1, 3}, {0, 2, 3, 1}, {0, 3, 1, 2},
+	{0, 3, 2, 1}, {1, 0, 2, 3}, {1, 0, 3, 2}, {1, 2, 0, 3}, {1, 2, 3, 0},
+	{1, 3, 0, 2}, {1, 3, 2, 0}, {2, 0, 1, 3}, {2, 0, 3, 1}, {2, 1, 0, 3},
+	{2, 1, 3, 0}, {2, 3, 0, 1}, {2, 3, 1, 0}, {3, 0, 1, 2}, {3, 0, 2, 1},
+	{3, 1, 0, 2}, {3, 1, 2, 0}, {3, 2, 0, 1}, {3, 2, 1, 0}
+};
+
+/*
+** 32 bit integer hash (lowbias32, C. Wellons)
+*/
+RT_CONSTEXPR uint32_t	rt_hash(uint32_t x)
+{
+	x ^= x >> 16;
+	x *= 0x7feb352du;
+	x ^= x >> 15;
+	x *= 0x846ca68bu;
+	return (x ^ (x >> 16));
+}
+
+RT_CONSTEXPR uint32_t	rt_hash_combine(uint32_t seed, uint32_t v)
+{
+	return (seed ^ (v + 0x9e3779b9u + (seed << 6) + (seed >> 2)));
+}
+
+RT_CONSTEXPR uint32_t	rt_reverse_bits(uint32_t x)
+{
+	x = __builtin_bswap32(x);
+	x = ((x >> 4) & 0x0f0f0f0fu) | ((x & 0x0f0f0f0fu) << 4);
+	x = ((x >> 2) & 0x33333333u) | ((x & 0x33333333u) << 2);
+	return (((x >> 1) & 0x55555555u) | ((x & 0x55555555u) << 1));
+}
+
+/*
+** Laine-Karras permutation: every bit is flipped or not depending on the seed
+** and on the bits below it only. On bit reversed numbers, that is Owen
+** scrambling.
+*/
+RT_CONSTEXPR uint32_t	rt_laine_karras(uint32_t x, uint32_t seed)
+{
+	x ^= x * 0x3d20adeau;
+	x += seed;
+	x *= (seed >> 16) | 1;
+	x ^= x * 0x05526c56u;
+	return (x ^ (x * 0x53a22864u));
+}
+
+RT_CONSTEXPR uint32_t	rt_owen_scramble(uint32_t x, uint32_t seed)
+{
+	return (rt_reverse_bits(rt_laine_karras(rt_reverse_bits(x), seed)));
+}
+
+/*
+** The four dimensions of Sobol point index at once, bit reversed, without
+** branches
+*/
+RT_INLINE void			rt_sobol4(uint32_t index, uint32_t x[4])
+{
+	uint32_t			mask;
+	int					bit;
+	int					d;
+
+	for (d = 0; d < 4; d++)
+		x[d] = 0;
+	for (bit = 0; index; index >>= 1, bit++)
+	{
+		mask = 0u - (index & 1);
+		for (d = 0; d < 4; d++)
+			x[d] ^= g_sobol_matrix[d][bit] & mask;
+	}
+}
+
+/*
+** Owen scramble the low bits bits of index, the samples of a pixel
+*/
+RT_CONSTEXPR uint32_t	rt_sampler_shuffle(uint32_t index, uint32_t bits,
+							uint32_t seed)
+{
+	return (bits >= 32 ? rt_owen_scramble(index, seed) : bits == 0 ? index
+		: (index >> bits << bits)
+		| rt_owen_scramble(index << (32 - bits), seed) >> (32 - bits));
+}
+
+/*
+** Compute the set of four dimensions that dim falls in
+*/
+RT_INLINE void			rt_sampler_seek(t_sampler *s, uint32_t dim)
+{
+	uint32_t			seed;
+	uint32_t			x[4];
+	int					d;
+
+	s->dim = dim;
+	if (s->set == dim >> 2)
+		return ;
+	s->set = dim >> 2;
+	seed = rt_hash(rt_hash_combine(s->seed, s->set));
+	rt_sobol4(rt_sampler_shuffle(s->index, s->shuffle, seed), x);
+	for (d = 0; d < 4; d++)
+	{
+		x[d] = rt_reverse_bits(rt_laine_karras(x[d], rt_hash_combine(seed, d)));
+		s->point[d] = (float)(x[d] >> 8) * (1.0f / 16777216.0f);
+	}
+}
+
+RT_INLINE float			rt_sampler_float(t_sampler *s)
+{
+	rt_sampler_seek(s, s->dim);
+	return (s->point[s->dim++ & 3]);
+}
+
+/*
+** Sample number sample (< 65536) of a pixel, decorrelated from the other
+** pixels by the scrambling. Only the 16 bits a pixel can use are shuffled,
+** which keeps the Sobol loop short.
+*/
+RT_INLINE void			rt_sampler_init(t_sampler *s, uint32_t pixel,
+							uint32_t sample, uint32_t seed)
+{
+	s->seed = rt_hash(rt_hash_combine(rt_hash(pixel), seed));
+	s->index = sample;
+	s->shuffle = 16;
+	s->dim = 0;
+	s->set = ~0u;
+}
+
+/*
+** Scrambled Morton index of (x, y) on a 2^bits square, for the pixels using
+** seed: the 4 quadrants of every quadrant are visited in an order picked by
+** hashing its own index. Computed once per pixel.
+*/
+RT_INLINE uint32_t		rt_sampler_morton(uint32_t x, uint32_t y, int bits,
+							uint32_t seed)
+{
+	uint32_t			m;
+	uint32_t			digit;
+	int					level;
+
+	seed = rt_hash(~seed);
+	m = 0;
+	for (level = bits - 1; level >= 0; level--)
+	{
+		digit = ((x >> level) & 1) | ((y >> level) & 1) << 1;
+		digit = g_sampler_quadrants[rt_hash(rt_hash_combine(seed,
+			m | 1u << 2 * (bits - 1 - level))) % 24][digit];
+		m = (m << 2) | digit;
+	}
+	return (m);
+}
+
+/*
+** Sample number sample (< 2^log2spp) of the pixel of Morton index morton
+** (see above, same seed), in the blue noise order
+*/
+RT_INLINE void			rt_sampler_init_zorder(t_sampler *s, uint32_t morton,
+							uint32_t sample, int log2spp, uint32_t seed)
+{
+	s->seed = rt_hash(seed);
+	s->index = morton << log2spp | sample;
+	s->shuffle = log2spp;
+	s->dim = 0;
+	s->set = ~0u;
+}
+
+#endif
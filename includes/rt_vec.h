@@ -0,0 +1,212 @@
+#ifndef RT_VEC_H
+# define RT_VEC_H
+
+/*
+** Header-only vector maths shared by the SDL renderer (C), SCRATCHPIXEL and
+** SUPERTEST (C++). Everything is static inline so the compiler can inline it
+** into the hot loops; in C++ the pure arithmetic is also constexpr.
+** Vectors are padded to 16 bytes and aligned so an add or a mul maps to a
+** single SSE/NEON instruction once vectorised; w is kept at 0 and can be
+** ignored. Multiply-adds are written as a * b + c so that they turn into
+** FMA instructions when the target has them (-ffp-contract=fast, which is the
+** GNU default, plus -march with FMA).
+*/
+
+# if defined(__SSE__)
+#  include <xmmintrin.h>
+# elif defined(__ARM_NEON)
+#  include <arm_neon.h>
+# endif
+
+# ifdef __cplusplus
+#  include <cmath>
+#  include <ostream>
+#  define RT_INLINE			static inline
+#  define RT_CONSTEXPR		static inline constexpr
+#  define RT_VEC(x, y, z)	s_vec((x), (y), (z))
+# else
+#  include <math.h>
+#  define RT_INLINE			static inline
+#  define RT_CONSTEXPR		static inline
+#  define RT_VEC(x, y, z)	((t_vec){(x), (y), (z), 0.0f})
+# endif
+
+# define RT_FMA(a, b, c)	((a) * (b) + (c))
+
+typedef struct			__attribute__((aligned(16))) s_vec
+{
+	float				x;
+	float				y;
+	float				z;
+	float				w;
+# ifdef __cplusplus
+	constexpr s_vec() : x(0), y(0), z(0), w(0) {}
+	constexpr s_vec(float xx) : x(xx), y(xx), z(xx), w(0) {}
+	constexpr s_vec(float xx, float yy, float zz) : x(xx), y(yy), z(zz), w(0) {}
+	s_vec				&normalize();
+	constexpr s_vec		operator * (const float &f) const { return s_vec(x * f, y * f, z * f); }
+	constexpr s_vec		operator * (const s_vec &v) const { return s_vec(x * v.x, y * v.y, z * v.z); }
+	constexpr s_vec		operator - (const s_vec &v) const { return s_vec(x - v.x, y - v.y, z - v.z); }
+	constexpr s_vec		operator + (const s_vec &v) const { return s_vec(x + v.x, y + v.y, z + v.z); }
+	constexpr s_vec		operator - () const { return s_vec(-x, -y, -z); }
+	s_vec				&operator += (const s_vec &v) { x += v.x, y += v.y, z += v.z; return *this; }
+	s_vec				&operator *= (const s_vec &v) { x *= v.x, y *= v.y, z *= v.z; return *this; }
+	constexpr float		dot(const s_vec &v) const { return RT_FMA(z, v.z, RT_FMA(y, v.y, x * v.x)); }
+	constexpr s_vec		cross(const s_vec &v) const
+	{
+		return s_vec(y * v.z - z * v.y, z * v.x - x * v.z, x * v.y - y * v.x);
+	}
+	constexpr float		length2() const { return dot(*this); }
+	float				length() const { return sqrtf(length2()); }
+	friend std::ostream	&operator << (std::ostream &os, const s_vec &v)
+	{
+		return os << "[" << v.x << " " << v.y << " " << v.z << "]";
+	}
+# endif
+}						t_vec;
+
+RT_CONSTEXPR t_vec		set_vec(float x, float y, float z)
+{
+	return (RT_VEC(x, y, z));
+}
+
+RT_CONSTEXPR t_vec		vec_sub(t_vec v1, t_vec v2)
+{
+	return (RT_VEC(v1.x - v2.x, v1.y - v2.y, v1.z - v2.z));
+}
+
+RT_CONSTEXPR t_vec		vec_add(t_vec v1, t_vec v2)
+{
+	return (RT_VEC(v1.x + v2.x, v1.y + v2.y, v1.z + v2.z));
+}
+
+RT_CONSTEXPR t_vec		vec_add_f(t_vec v1, float value)
+{
+	return (RT_VEC(v1.x + value, v1.y + value, v1.z + value));
+}
+
+RT_CONSTEXPR t_vec		vec_mult_f(t_vec v, float f)
+{
+	return (RT_VEC(v.x * f, v.y * f, v.z * f));
+}
+
+RT_CONSTEXPR t_vec		vec_mult(t_vec v1, t_vec v2)
+{
+	return (RT_VEC(v1.x * v2.x, v1.y * v2.y, v1.z * v2.z));
+}
+
+/*
+** v1 * f + v2, the building block of ray marching (orig + dir * t)
+*/
+RT_CONSTEXPR t_vec		vec_fma_f(t_vec v1, float f, t_vec v2)
+{
+	return (RT_VEC(RT_FMA(v1.x, f, v2.x), RT_FMA(v1.y, f, v2.y),
+		RT_FMA(v1.z, f, v2.z)));
+}
+
+RT_CONSTEXPR float		dot_product(t_vec v1, t_vec v2)
+{
+	return (RT_FMA(v1.z, v2.z, RT_FMA(v1.y, v2.y, v1.x * v2.x)));
+}
+
+RT_CONSTEXPR t_vec		cross_product(t_vec v1, t_vec v2)
+{
+	return (RT_VEC(v1.y * v2.z - v1.z * v2.y, v1.z * v2.x - v1.x * v2.z,
+		v1.x * v2.y - v1.y * v2.x));
+}
+
+RT_CONSTEXPR float		vec_length2(t_vec vec)
+{
+	return (dot_product(vec, vec));
+}
+
+RT_INLINE float			vec_length(t_vec vec)
+{
+	return (sqrtf(vec_length2(vec)));
+}
+
+RT_INLINE t_vec			vec_normalize(t_vec vec)
+{
+	float				len2;
+
+	len2 = vec_length2(vec);
+	if (len2 <= 0.0f)
+		return (vec);
+	return (vec_mult_f(vec, 1.0f / sqrtf(len2)));
+}
+
+/*
+** Fast-math path, opt-in with -DRT_FAST_MATH. rt_rsqrt() is the hardware
+** reciprocal square root estimate (or the integer trick when there is none)
+** refined by Newton steps; rt_powi() is exponentiation by squaring, fully
+** unrolled by the compiler when n is a compile-time constant. The
+** *_shading() names pick the fast or the exact version so shading code can
+** be written once.
+*/
+RT_INLINE float			rt_rsqrt(float x)
+{
+	float				y;
+
+# if defined(__SSE__)
+	y = _mm_cvtss_f32(_mm_rsqrt_ss(_mm_set_ss(x)));
+# elif defined(__ARM_NEON)
+	y = vget_lane_f32(vrsqrte_f32(vdup_n_f32(x)), 0);
+	y = y * vget_lane_f32(vrsqrts_f32(vdup_n_f32(x * y), vdup_n_f32(y)), 0);
+# else
+	union
+	{
+		float			f;
+		unsigned int	i;
+	}					u;
+
+	u.f = x;
+	u.i = 0x5f375a86 - (u.i >> 1);
+	y = u.f;
+	y = y * (1.5f - 0.5f * x * y * y);
+	y = y * (1.5f - 0.5f * x * y * y);
+# endif
+	return (y * (1.5f - 0.5f * x * y * y));
+}
+
+RT_INLINE t_vec			vec_normalize_fast(t_vec vec)
+{
+	float				len2;
+
+	len2 = vec_length2(vec);
+	if (len2 <= 0.0f)
+		return (vec);
+	return (vec_mult_f(vec, rt_rsqrt(len2)));
+}
+
+RT_CONSTEXPR float		rt_powi(float x, unsigned int n)
+{
+	float				r = 1.0f;
+
+	while (n)
+	{
+		if (n & 1)
+			r *= x;
+		x *= x;
+		n >>= 1;
+	}
+	return (r);
+}
+
+# ifdef RT_FAST_MATH
+#  define vec_normalize_shading(v)	vec_normalize_fast(v)
+#  define rt_pow_shading(x, n)		rt_powi((x), (n))
+# else
+#  define vec_normalize_shading(v)	vec_normalize(v)
+#  define rt_pow_shading(x, n)		powf((x), (n))
+# endif
+
+# ifdef __cplusplus
+
+inline s_vec			&s_vec::normalize()
+{
+	return (*this = vec_normalize(*this));
+}
+
+# endif
+
+#endif
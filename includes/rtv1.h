@@ -3,33 +3,361 @@
 
 # include <stdlib.h>
 # include <math.h>
+# include <pthread.h>
+# include <easy_sdl.h>
+# include <rt_vec.h>
+# include <rt_curve.h>
 
-typedef struct			s_vec
+# define SUPERSAMPLING
+# define TILE_SIZE			32
+
+/*
+** Default Blinn-Phong material. The exponent is a compile-time constant so
+** that the fast-math build turns the pow into a few multiplies.
+*/
+# define SPEC_VALUE			5.0f
+# define SPEC_POWER			100
+
+/*
+** Material classes: MATERIAL(name, spec value, spec power). Each line gets its
+** own specular kernel in calculatePhong() with the exponent folded in.
+*/
+# define MATERIALS(MATERIAL) \
+	MATERIAL(MAT_PLASTIC, SPEC_VALUE, SPEC_POWER) \
+	MATERIAL(MAT_SATIN, 1.0f, 20) \
+	MATERIAL(MAT_MATTE, 0.0f, 1)
+# define MATERIAL_ENUM(name, value, power)	name,
+
+enum					e_material
+{
+	MATERIALS(MATERIAL_ENUM)
+	MAT_COUNT
+};
+
+typedef struct			s_ray
+{
+	t_vec				start;
+	t_vec				dir;
+}						t_ray;
+
+typedef struct			s_sphere
+{
+	t_vec				pos;
+	float				rad;
+	t_vec				surf_color;
+	t_vec				emis_color;
+	int					is_light;
+	int					material;
+}						t_sphere;
+
+typedef struct			s_spheres
+{
+	int					nb_spheres;
+	t_sphere			*spheres;
+}						t_spheres;
+
+/*
+** G-buffer entry: everything the shading pass needs to know about the
+** primary hit of a pixel. id is -1 where the ray escaped the scene.
+*/
+typedef struct			s_hit
+{
+	t_vec				pos;
+	t_vec				normal;
+	t_vec				view;
+	int					id;
+}						t_hit;
+
+typedef struct			s_camera
+{
+	t_vec				pos;
+	float				yaw;
+	float				pitch;
+	t_vec				forward;
+	t_vec				right;
+	t_vec				up;
+	float				fov;
+}						t_camera;
+
+/*
+** SHADE_LANES hits of the same material in SoA form: the batched shading
+** pass runs every step on whole arrays so the compiler maps the lanes to
+** SIMD registers (16 floats: one AVX-512 or two AVX registers). slot is
+** where the packed colour of each lane goes.
+*/
+# define SHADE_LANES		16
+
+typedef struct			s_hit_batch
+{
+	float				px[SHADE_LANES];
+	float				py[SHADE_LANES];
+	float				pz[SHADE_LANES];
+	float				nx[SHADE_LANES];
+	float				ny[SHADE_LANES];
+	float				nz[SHADE_LANES];
+	float				vx[SHADE_LANES];
+	float				vy[SHADE_LANES];
+	float				vz[SHADE_LANES];
+	float				cr[SHADE_LANES];
+	float				cg[SHADE_LANES];
+	float				cb[SHADE_LANES];
+	float				r[SHADE_LANES];
+	float				g[SHADE_LANES];
+	float				b[SHADE_LANES];
+	int					slot[SHADE_LANES];
+	int					count;
+}						t_hit_batch;
+
+/*
+** Old version of an edited sphere that may still be on screen, for the
+** dirty-region test of an update job (dirty.c). An update that interrupts
+** another one keeps the ghosts of the first: at most MAX_GHOSTS of them
+** before the renderer gives up and renders a whole frame.
+*/
+# define MAX_GHOSTS			32
+# define DIRTY_KEEP			0
+# define DIRTY_SHADE		1
+# define DIRTY_TRACE		2
+
+typedef struct			s_ghost
+{
+	int					id;
+	t_sphere			sphere;
+}						t_ghost;
+
+/*
+** Per-worker scratch for one tile.
+** level is the pixel stride of a tile under a frame budget (budget.c): a
+** tile at level l traces one pixel in 2^l x 2^l and fills in the others
+** (their mask is TILE_FILL) from it. seconds is how long it traced and
+** shaded. shadows is the set of shadow maps the tile is shaded with, NULL
+** without --shadow-maps.
+*/
+# define TILE_FILL			3
+
+typedef struct			s_tile
+{
+	int					pass;
+	int					level;
+	double				seconds;
+	int					relight;
+	int					update;
+	int					reshade;
+	struct s_shadows	*shadows;
+	t_ghost				ghosts[MAX_GHOSTS];
+	int					nb_ghosts;
+	Uint32				buf[TILE_SIZE * TILE_SIZE];
+	t_hit				hits[TILE_SIZE * TILE_SIZE];
+	char				mask[TILE_SIZE * TILE_SIZE];
+	char				reused[TILE_SIZE * TILE_SIZE];
+	int					todo[TILE_SIZE * TILE_SIZE];
+	int					nb_todo;
+	int					rastered;
+	float				depth[TILE_SIZE * TILE_SIZE];
+	int					ids[TILE_SIZE * TILE_SIZE];
+	t_vec				dirs[TILE_SIZE * TILE_SIZE];
+}						t_tile;
+
+/*
+** Light visibility cache (--shadow-maps, shadow.c): a cube map around every
+** light (the first MAX_SHADOW_MAPS of them), SHADOW_SIZE x SHADOW_SIZE
+** texels per face. A texel lists the spheres that the shadow ray of a point
+** seen from the light through that texel can hit, at most SHADOW_IDS of
+** them; count is SHADOW_FULL when there are more, and the point then tests
+** every sphere. built is the scene the maps were built for.
+*/
+# define SHADOW_SIZE		128
+# define SHADOW_IDS			63
+# define SHADOW_FULL		(SHADOW_IDS + 1)
+# define MAX_SHADOW_MAPS	4
+
+typedef struct			s_shadow_texel
+{
+	unsigned short		count;
+	unsigned short		ids[SHADOW_IDS];
+}						t_shadow_texel;
+
+typedef struct			s_shadow_map
+{
+	int					light;
+	t_vec				pos;
+	t_shadow_texel		*texels;
+}						t_shadow_map;
+
+typedef struct			s_shadows
+{
+	int					nb_maps;
+	t_shadow_map		maps[MAX_SHADOW_MAPS];
+	t_sphere			*built;
+	int					valid;
+}						t_shadows;
+
+/*
+** Background rendering state. Workers pull tiles from next_tile and trace
+** them into a private buffer; a tile is only copied to pixels if generation
+** did not change in the meantime, so a camera move throws stale tiles away.
+** Every frame runs two passes over the tiles: the first one reuses the
+** reprojected previous frame where it is still valid and traces the holes,
+** the second one retraces the reused pixels if the camera stays still.
+** gbuf is the G-buffer of the displayed pixels, reproj_* is the previous
+** frame seen through the current camera. Once pass 0 has covered every tile
+** (gbuf_tiles) a light edit starts a relight job instead: a single pass that
+** only shades the G-buffer again, and a sphere edit an update job: a single
+** pass that only retraces or reshades the pixels the edit can have changed
+** (dirty_pixel()), which for a small sphere is a few thousand pixels.
+** reshade makes an update shade every other pixel too, when it interrupts a
+** relight. passes is the number of passes of the current job. scene is the
+** copy of the spheres the current job renders; the workers copy it with the
+** camera and the ghosts. With shadow_maps, shadows[shadow_cur] is brought up
+** to date with scene whenever a job starts: the job updates the other set,
+** which only the workers of the job before the last one can still be shading
+** with (shadow_users counts them, shadow_idle wakes the wait for them), so no
+** worker reads a map while it changes. With a budget (seconds, budget.c),
+** pass 0 of a frame traces each tile at tile_level, chosen from tile_cost
+** (the seconds its rays took, at full resolution) and tile_fixed (what a tile
+** costs besides) so that it ends in time; frame_time is how long the last
+** frame's pass 0 took and budget_scale corrects the estimates.
+*/
+typedef struct			s_render
+{
+	pthread_t			*threads;
+	int					nb_threads;
+	pthread_mutex_t		lock;
+	pthread_cond_t		wake;
+	int					quit;
+	unsigned int		generation;
+	int					next_tile;
+	int					tiles_done;
+	int					relight;
+	int					update;
+	int					reshade;
+	int					passes;
+	t_ghost				ghosts[MAX_GHOSTS];
+	int					nb_ghosts;
+	int					gbuf_tiles;
+	int					*tile_pass;
+	int					*tile_order;
+	int					raster;
+	int					pixel_order[TILE_SIZE * TILE_SIZE];
+	t_vec				*tile_lo;
+	t_vec				*tile_hi;
+	char				*tile_reused;
+	int					shadow_maps;
+	t_shadows			shadows[2];
+	int					shadow_cur;
+	int					shadow_users[2];
+	pthread_cond_t		shadow_idle;
+	float				budget;
+	float				budget_scale;
+	double				frame_start;
+	float				frame_time;
+	float				*tile_cost;
+	float				tile_fixed;
+	char				*tile_level;
+	int					tiles_x;
+	int					tiles_y;
+	int					rx;
+	int					ry;
+	t_camera			camera;
+	t_spheres			scene;
+	Uint32				*pixels;
+	t_hit				*gbuf;
+	int					reproject;
+	Uint32				*reproj_pixels;
+	t_vec				*reproj_pos;
+	int					*reproj_id;
+	float				*reproj_depth;
+	char				*reused;
+}						t_render;
+
+typedef struct			s_data
+{
+	t_esdl				*esdl;
+	t_spheres			spheres;
+	SDL_Surface			*surf;
+	t_camera			camera;
+	int					selected;
+	t_curve				order;
+	int					raster;
+	int					shadow_maps;
+	float				budget;
+	t_render			render;
+}						t_data;
+
+static inline float	max(float a, float b)
+{
+	return (a > b ? a : b);
+}
+
+static inline float	min(float a, float b)
 {
-	float				x;
-	float				y;
-	float				z;
-}						t_vec;
+	return (a < b ? a : b);
+}
 
-t_vec				set_vec(float x, float y, float z);
+t_sphere			set_sphere(t_vec pos, float radius, t_vec surf_color);
+t_sphere			set_light(t_vec pos, float radius, t_vec emis_color);
+void				debug_sphere(t_sphere sphere);
+void				debug_spheres(t_spheres *spheres);
+int					init_spheres(const unsigned int nb_spheres, t_spheres *spheres);
+int					hitsphere(t_vec rayorig, t_vec raydir, t_sphere sphere, float *t0, float *t1);
+int					sphere_update(t_spheres *spheres, int *selected, t_input *in);
+int					sphere_changed(t_sphere *a, t_sphere *b);
+int					sphere_same_place(t_sphere *a, t_sphere *b);
+void				raster_tile(t_tile *t, t_render *r, t_spheres *scene,
+						t_camera *camera, int tile);
+int					raster_hit(t_tile *t, t_spheres *scene, t_camera *camera,
+						int j, t_hit *hit);
+int					dirty_tile(t_tile *t, t_render *r, t_spheres *scene,
+						t_camera *camera, int tile);
+int					dirty_pixel(t_tile *t, t_spheres *scene, t_camera *camera,
+						t_vec raydir, t_hit *hit);
 
-t_vec				vec_sub(t_vec v1, t_vec v2);
+float				calculateLambert(t_vec nhit, t_vec lightDirection);
+float				calculatePhong(int material, t_vec nhit, t_vec viewDirection, t_vec lightDirection);
+void				set_hit(t_hit *hit, t_spheres *spheres, int id, t_vec phit, t_vec rayorig);
+int					raytrace_hit(t_vec rayorig, t_vec raydir, t_spheres *spheres, t_hit *hit);
+int					shade(t_spheres *spheres, t_hit *hit);
+int					raytrace(t_vec rayorig, t_vec raydir, t_spheres *spheres, t_hit *hit);
+void				shade_hits(t_spheres *spheres, t_hit *hits, int *todo, int n,
+						t_shadows *shadows, Uint32 *out);
 
-t_vec				vec_add(t_vec v1, t_vec v2);
-t_vec				vec_add_f(t_vec v1, float value);
+int					shadow_init(t_shadows *s, t_spheres *scene);
+void				shadow_update(t_shadows *s, t_spheres *scene);
+t_shadow_map		*shadow_map(t_shadows *s, int light);
+int					shadow_lookup(t_shadow_map *map, t_vec p,
+						unsigned short **ids);
+void				shadow_quit(t_shadows *s);
 
-t_vec				vec_mult_f(t_vec v, float f);
+void				camera_init(t_camera *camera, t_vec pos, float yaw, float pitch);
+void				camera_update_basis(t_camera *camera);
+int					camera_update(t_camera *camera, t_input *in);
+t_vec				camera_ray(t_camera *camera, float x, float y, int rx, int ry);
 
-t_vec				vec_mult(t_vec v1, t_vec v2);
+int					light_update(t_spheres *spheres, t_input *in);
 
-float				dot_product(t_vec v1, t_vec v2);
+int					render_init(t_data *data, int rx, int ry);
+void				render_start(t_data *data);
+void				render_relight(t_data *data);
+void				render_update(t_data *data);
+int					render_progress(t_data *data);
+int					render_frame_done(t_data *data);
+void				render_quit(t_data *data);
 
-float				vec_length2(t_vec vec);
+int					fast_math_check(void);
 
-t_vec				vec_normalize(t_vec vec);
+# define BUDGET_LEVELS		6
 
-float				max(float a, float b);
-float				min(float a, float b);
+double				budget_clock(void);
+int					budget_init(t_render *r);
+void				budget_levels(t_render *r);
+void				budget_measure(t_render *r, int tile, t_tile *t, double seconds);
+void				budget_fill(t_tile *t);
+void				budget_quit(t_render *r);
 
+int					reproject_init(t_render *r);
+void				reproject_frame(t_render *r, t_camera *camera);
+int					reproject_valid(t_render *r, t_spheres *scene, t_camera *camera,
+						t_vec raydir, int i, t_hit *hit);
+void				reproject_quit(t_render *r);
 
-#endif
\ No newline at end of file
+#endif
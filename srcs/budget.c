@@ -0,0 +1,141 @@
+#include <rtv1.h>
+#include <time.h>
+
+/*
+** Frame budget (--budget ms): pass 0 of a frame has to end within
+** r->budget, whatever the scene costs. Every tile remembers how long the rays
+** of its pass 0 took, scaled to full resolution and averaged over the last
+** frames (tile_cost). The rest of the work of a tile (the pixels it fills in
+** and publishes) hardly depends on the tile nor on its level, so tile_fixed
+** is one average for all of them. The next frame gives each tile the finest
+** level that keeps the sum of the estimates under what the workers can do in
+** the budget. The same cap applies to every tile: cheap tiles stay at full
+** resolution and only the expensive ones get coarse. The filled-in pixels
+** are published as reused, so pass 1 traces them again as soon as the camera
+** stays still, like the reprojected ones. The estimates miss what happens
+** outside the tiles (reproject_frame() mostly) and do not see the scene
+** change, so budget_scale follows the ratio of the budget to the time the
+** last frame took.
+*/
+#define BUDGET_SCALE_MIN	0.25f
+#define BUDGET_SCALE_MAX	2.0f
+
+double				budget_clock(void)
+{
+	struct timespec	ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (ts.tv_sec + ts.tv_nsec * 1e-9);
+}
+
+int					budget_init(t_render *r)
+{
+	r->budget_scale = 1.0f;
+	r->frame_time = 0.0f;
+	r->tile_fixed = 0.0f;
+	r->tile_cost = (float *)calloc(r->tiles_x * r->tiles_y, sizeof(float));
+	r->tile_level = (char *)calloc(r->tiles_x * r->tiles_y, 1);
+	return (r->tile_cost && r->tile_level);
+}
+
+/*
+** Estimated time of the frame if no tile costs more than cap, levels filled
+** in if it is not NULL
+*/
+static float		budget_total(t_render *r, float cap, char *levels)
+{
+	float			total;
+	float			cost;
+	int				level;
+	int				i;
+
+	total = 0.0f;
+	for (i = 0; i < r->tiles_x * r->tiles_y; i++)
+	{
+		cost = r->tile_cost[i];
+		for (level = 0; level + 1 < BUDGET_LEVELS && cost > cap; level++)
+			cost *= 0.25f;
+		total += cost + r->tile_fixed;
+		if (levels)
+			levels[i] = level;
+	}
+	return (total);
+}
+
+/*
+** Levels of the tiles for a new frame that started at frame_start (render lock
+** held): the largest cap whose frame fits in the budget of all the workers,
+** found by bisection. Adjusts budget_scale first if the last frame went to the
+** end of pass 0.
+*/
+void				budget_levels(t_render *r)
+{
+	float			available;
+	float			lo;
+	float			hi;
+	int				i;
+
+	if (r->frame_time > 0.0f)
+		r->budget_scale = max(BUDGET_SCALE_MIN, min(BUDGET_SCALE_MAX,
+			r->budget_scale * sqrtf(r->budget / r->frame_time)));
+	r->frame_time = 0.0f;
+	available = r->budget * r->budget_scale * r->nb_threads;
+	lo = 0.0f;
+	hi = 0.0f;
+	for (i = 0; i < r->tiles_x * r->tiles_y; i++)
+		hi = max(hi, r->tile_cost[i]);
+	if (budget_total(r, hi, NULL) <= available)
+		lo = hi;
+	for (i = 0; i < 24 && lo < hi; i++)
+	{
+		if (budget_total(r, 0.5f * (lo + hi), NULL) <= available)
+			lo = 0.5f * (lo + hi);
+		else
+			hi = 0.5f * (lo + hi);
+	}
+	budget_total(r, lo, r->tile_level);
+}
+
+/*
+** Pass 0 of tile took seconds, t->seconds of them in its rays (render lock
+** held)
+*/
+void				budget_measure(t_render *r, int tile, t_tile *t,
+						double seconds)
+{
+	float			cost;
+
+	cost = (float)(t->seconds * (1 << (2 * t->level)));
+	r->tile_cost[tile] = r->tile_cost[tile] > 0.0f
+		? 0.5f * (r->tile_cost[tile] + cost) : cost;
+	r->tile_fixed += 0.05f * ((float)(seconds - t->seconds) - r->tile_fixed);
+	if (r->gbuf_tiles == r->tiles_x * r->tiles_y)
+		r->frame_time = (float)(budget_clock() - r->frame_start);
+}
+
+/*
+** Copy the pixel traced for each block of a coarse tile to the rest of it
+*/
+void				budget_fill(t_tile *t)
+{
+	int				mask;
+	int				a;
+	int				j;
+
+	mask = ~((1 << t->level) - 1);
+	for (j = 0; j < TILE_SIZE * TILE_SIZE; j++)
+	{
+		if (t->mask[j] != TILE_FILL)
+			continue ;
+		a = (j / TILE_SIZE & mask) * TILE_SIZE + (j % TILE_SIZE & mask);
+		t->buf[j] = t->buf[a];
+		t->hits[j] = t->hits[a];
+		t->reused[j] = 1;
+	}
+}
+
+void				budget_quit(t_render *r)
+{
+	free(r->tile_cost);
+	free(r->tile_level);
+}
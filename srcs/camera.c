@@ -0,0 +1,75 @@
+#include <rtv1.h>
+
+#define CAMERA_MOVE_SPEED	0.5f
+#define CAMERA_TURN_SPEED	0.03f
+
+void				camera_init(t_camera *camera, t_vec pos, float yaw, float pitch)
+{
+	camera->pos = pos;
+	camera->yaw = yaw;
+	camera->pitch = pitch;
+	camera->fov = 30.0f;
+	camera_update_basis(camera);
+}
+
+void				camera_update_basis(t_camera *camera)
+{
+	camera->forward = set_vec(sinf(camera->yaw) * cosf(camera->pitch),
+		sinf(camera->pitch), -cosf(camera->yaw) * cosf(camera->pitch));
+	camera->right = vec_normalize(cross_product(camera->forward, set_vec(0.0f, 1.0f, 0.0f)));
+	camera->up = cross_product(camera->right, camera->forward);
+}
+
+/*
+** WASD moves, Q/E goes down/up, the arrows turn the camera.
+** Returns 1 when the camera changed, so the caller can restart the render.
+*/
+int					camera_update(t_camera *camera, t_input *in)
+{
+	t_vec			move;
+	int				turned;
+
+	move = set_vec(0.0f, 0.0f, 0.0f);
+	if (in->key[SDL_SCANCODE_W])
+		move = vec_add(move, camera->forward);
+	if (in->key[SDL_SCANCODE_S])
+		move = vec_sub(move, camera->forward);
+	if (in->key[SDL_SCANCODE_D])
+		move = vec_add(move, camera->right);
+	if (in->key[SDL_SCANCODE_A])
+		move = vec_sub(move, camera->right);
+	if (in->key[SDL_SCANCODE_E])
+		move.y += 1.0f;
+	if (in->key[SDL_SCANCODE_Q])
+		move.y -= 1.0f;
+	turned = 0;
+	if (in->key[SDL_SCANCODE_LEFT] && ++turned)
+		camera->yaw -= CAMERA_TURN_SPEED;
+	if (in->key[SDL_SCANCODE_RIGHT] && ++turned)
+		camera->yaw += CAMERA_TURN_SPEED;
+	if (in->key[SDL_SCANCODE_UP] && ++turned)
+		camera->pitch = min(camera->pitch + CAMERA_TURN_SPEED, 1.5f);
+	if (in->key[SDL_SCANCODE_DOWN] && ++turned)
+		camera->pitch = max(camera->pitch - CAMERA_TURN_SPEED, -1.5f);
+	if (turned)
+		camera_update_basis(camera);
+	if (move.x == 0.0f && move.y == 0.0f && move.z == 0.0f)
+		return (turned != 0);
+	camera->pos = vec_add(camera->pos, vec_mult_f(move, CAMERA_MOVE_SPEED));
+	return (1);
+}
+
+t_vec				camera_ray(t_camera *camera, float x, float y, int rx, int ry)
+{
+	float			angle;
+	float			xx;
+	float			yy;
+	t_vec			raydir;
+
+	angle = tan(M_PI * 0.5f * camera->fov / 180.0f);
+	xx = (2.0f * ((x + 0.5f) / (float)rx) - 1.0f) * angle * (rx / (float)ry);
+	yy = (1.0f - 2.0f * ((y + 0.5f) / (float)ry)) * angle;
+	raydir = vec_add(camera->forward, vec_add(vec_mult_f(camera->right, xx),
+		vec_mult_f(camera->up, yy)));
+	return (vec_normalize(raydir));
+}
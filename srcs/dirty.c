@@ -0,0 +1,240 @@
+#include <rtv1.h>
+
+/*
+** Dirty-region test of an update job (render_update): which pixels can an
+** edit of some spheres have changed? The only secondary rays are the shadow
+** rays, so the G-buffer entry of a pixel is enough to tell:
+** - its primary ray is traced again if it hit an edited sphere that moved,
+**   or if the new sphere is now in front of what it hit;
+** - it is shaded again if it hit an edited sphere (colour, material), or if
+**   one of its shadow rays passes through an edited sphere, old or new;
+** - any other pixel keeps what is on screen.
+** The ghosts are the old versions of the edited spheres that may still be on
+** screen (several when an update interrupts another one). The tests are a
+** little wider than the renderer's, so that rounding can only make them
+** retrace a pixel too many, never one too few.
+** dirty_tile() first rejects whole tiles with cones: the primary rays of a
+** tile fit in a cone from the camera, and its shadow rays in a double cone
+** from each light around the bounding sphere of its hit points (tile_lo,
+** tile_hi, kept by render_publish). Most tiles are rejected there, without
+** looking at their pixels.
+*/
+#define DIRTY_MARGIN	1e-3f
+
+int					sphere_changed(t_sphere *a, t_sphere *b)
+{
+	return (!sphere_same_place(a, b)
+		|| a->surf_color.x != b->surf_color.x
+		|| a->surf_color.y != b->surf_color.y
+		|| a->surf_color.z != b->surf_color.z
+		|| a->emis_color.x != b->emis_color.x
+		|| a->emis_color.y != b->emis_color.y
+		|| a->emis_color.z != b->emis_color.z
+		|| a->is_light != b->is_light || a->material != b->material);
+}
+
+int					sphere_same_place(t_sphere *a, t_sphere *b)
+{
+	return (a->pos.x == b->pos.x && a->pos.y == b->pos.y
+		&& a->pos.z == b->pos.z && a->rad == b->rad);
+}
+
+/*
+** hitsphere() on a slightly larger sphere, t is the nearest hit in front
+*/
+static int			dirty_hit(t_vec orig, t_vec dir, t_sphere *s, float *t)
+{
+	t_vec			l;
+	float			tca;
+	float			d2;
+	float			rad;
+
+	rad = s->rad * (1.0f + DIRTY_MARGIN) + DIRTY_MARGIN;
+	l = vec_sub(s->pos, orig);
+	tca = dot_product(l, dir);
+	if (tca < -rad * DIRTY_MARGIN)
+		return (0);
+	d2 = dot_product(l, l) - tca * tca;
+	if (d2 > rad * rad)
+		return (0);
+	*t = tca - sqrtf(rad * rad - d2);
+	if (*t < 0.0f)
+		*t = tca + sqrtf(rad * rad - d2);
+	return (1);
+}
+
+/*
+** Shadow rays of hit: from hit->pos + hit->normal to every light
+*/
+static int			dirty_shadow(t_tile *t, t_spheres *scene, t_hit *hit)
+{
+	t_vec			orig;
+	t_vec			dir;
+	float			tt;
+	int				i;
+	int				k;
+
+	orig = vec_add(hit->pos, hit->normal);
+	for (i = 0; i < scene->nb_spheres; i++)
+	{
+		if (!scene->spheres[i].is_light)
+			continue ;
+		dir = vec_normalize(vec_sub(scene->spheres[i].pos, hit->pos));
+		for (k = 0; k < t->nb_ghosts; k++)
+			if (dirty_hit(orig, dir, &t->ghosts[k].sphere, &tt)
+				|| dirty_hit(orig, dir, &scene->spheres[t->ghosts[k].id], &tt))
+				return (1);
+	}
+	return (0);
+}
+
+/*
+** Can a sphere (grown by grow) meet the cone of apex a, unit axis u and half
+** angle cos_max / sin_max?
+*/
+static int			dirty_cone(t_vec a, t_vec u, float cos_max, float sin_max,
+						t_sphere *s, float grow)
+{
+	t_vec			v;
+	float			d;
+	float			rad;
+	float			c;
+	float			sn;
+
+	v = vec_sub(s->pos, a);
+	d = vec_length(v);
+	rad = s->rad * (1.0f + DIRTY_MARGIN) + DIRTY_MARGIN + grow;
+	if (d <= rad)
+		return (1);
+	c = dot_product(v, u) / d;
+	sn = sqrtf(max(0.0f, 1.0f - c * c));
+	if (c >= cos_max)
+		return (1);
+	return (sn * cos_max - c * sin_max <= rad / d);
+}
+
+/*
+** Do the primary rays of tile (pixel centres x0..x1, y0..y1) meet s?
+*/
+static int			dirty_primary(t_render *r, t_camera *camera, int tile,
+						t_sphere *s)
+{
+	t_vec			corner[4];
+	t_vec			axis;
+	float			c;
+	int				x[2];
+	int				y[2];
+	int				k;
+
+	x[0] = (tile % r->tiles_x) * TILE_SIZE;
+	y[0] = (tile / r->tiles_x) * TILE_SIZE;
+	x[1] = min(x[0] + TILE_SIZE, r->rx) - 1;
+	y[1] = min(y[0] + TILE_SIZE, r->ry) - 1;
+	axis = set_vec(0.0f, 0.0f, 0.0f);
+	for (k = 0; k < 4; k++)
+	{
+		corner[k] = camera_ray(camera, x[k & 1], y[k >> 1], r->rx, r->ry);
+		axis = vec_add(axis, corner[k]);
+	}
+	axis = vec_normalize(axis);
+	c = 1.0f;
+	for (k = 0; k < 4; k++)
+		c = min(c, dot_product(axis, corner[k]));
+	c -= DIRTY_MARGIN;
+	return (dirty_cone(camera->pos, axis, c, sqrtf(max(0.0f, 1.0f - c * c)),
+		s, 0.0f));
+}
+
+/*
+** Do the shadow rays of the hits of tile meet s? A shadow ray starts within
+** 1 of the line from its hit point through the light, so s is grown by 1.
+*/
+static int			dirty_shadow_tile(t_render *r, t_spheres *scene, int tile,
+						t_sphere *s)
+{
+	t_vec			centre;
+	t_vec			axis;
+	float			rad;
+	float			d;
+	float			c;
+	int				i;
+
+	centre = vec_mult_f(vec_add(r->tile_lo[tile], r->tile_hi[tile]), 0.5f);
+	rad = vec_length(vec_sub(r->tile_hi[tile], centre)) + DIRTY_MARGIN;
+	for (i = 0; i < scene->nb_spheres; i++)
+	{
+		if (!scene->spheres[i].is_light)
+			continue ;
+		axis = vec_sub(centre, scene->spheres[i].pos);
+		if ((d = vec_length(axis)) <= rad)
+			return (1);
+		axis = vec_mult_f(axis, 1.0f / d);
+		c = sqrtf(max(0.0f, 1.0f - (rad / d) * (rad / d)));
+		if (dirty_cone(scene->spheres[i].pos, axis, c, rad / d, s, 1.0f)
+			|| dirty_cone(scene->spheres[i].pos, vec_mult_f(axis, -1.0f), c,
+			rad / d, s, 1.0f))
+			return (1);
+	}
+	return (0);
+}
+
+/*
+** Can the update job t change any pixel of tile? Pixels left reused by an
+** unfinished frame always have to be retraced.
+*/
+int					dirty_tile(t_tile *t, t_render *r, t_spheres *scene,
+						t_camera *camera, int tile)
+{
+	t_sphere		*now;
+	int				hits;
+	int				k;
+
+	if (t->reshade || r->tile_reused[tile])
+		return (1);
+	hits = r->tile_lo[tile].x <= r->tile_hi[tile].x;
+	for (k = 0; k < t->nb_ghosts; k++)
+	{
+		now = &scene->spheres[t->ghosts[k].id];
+		if (dirty_primary(r, camera, tile, &t->ghosts[k].sphere)
+			|| dirty_primary(r, camera, tile, now))
+			return (1);
+		if (hits && !sphere_same_place(&t->ghosts[k].sphere, now)
+			&& (dirty_shadow_tile(r, scene, tile, &t->ghosts[k].sphere)
+			|| dirty_shadow_tile(r, scene, tile, now)))
+			return (1);
+	}
+	return (0);
+}
+
+/*
+** What the update job t must do with the pixel whose primary ray is raydir
+** and whose displayed G-buffer entry is hit
+*/
+int					dirty_pixel(t_tile *t, t_spheres *scene, t_camera *camera,
+						t_vec raydir, t_hit *hit)
+{
+	t_sphere		*now;
+	float			dist;
+	float			tt;
+	int				dirty;
+	int				k;
+
+	dirty = (t->reshade && hit->id >= 0) ? DIRTY_SHADE : DIRTY_KEEP;
+	dist = hit->id < 0 ? INFINITY : vec_length(vec_sub(hit->pos, camera->pos));
+	for (k = 0; k < t->nb_ghosts; k++)
+	{
+		now = &scene->spheres[t->ghosts[k].id];
+		if (sphere_same_place(&t->ghosts[k].sphere, now))
+		{
+			if (hit->id == t->ghosts[k].id)
+				dirty = DIRTY_SHADE;
+			continue ;
+		}
+		if (hit->id == t->ghosts[k].id || (dirty_hit(camera->pos, raydir, now,
+			&tt) && tt <= dist * (1.0f + DIRTY_MARGIN)))
+			return (DIRTY_TRACE);
+	}
+	if (dirty == DIRTY_KEEP && hit->id >= 0 && dirty_shadow(t, scene, hit))
+		dirty = DIRTY_SHADE;
+	return (dirty);
+}
@@ -0,0 +1,92 @@
+#include <rtv1.h>
+#include <stdio.h>
+
+/*
+** Accuracy harness for the fast-math path: run with --fast-math-check.
+** Every fast primitive is compared with the exact one over its input range
+** and the worst error is reported, then the whole Blinn-Phong term is
+** compared the same way.
+*/
+
+#define CHECK_SAMPLES		1000000
+
+static float		check_rand(unsigned int *seed)
+{
+	*seed = *seed * 1664525u + 1013904223u;
+	return ((*seed >> 8) / 16777216.0f);
+}
+
+static t_vec		check_rand_vec(unsigned int *seed, float scale)
+{
+	return (set_vec((check_rand(seed) * 2.0f - 1.0f) * scale,
+		(check_rand(seed) * 2.0f - 1.0f) * scale,
+		(check_rand(seed) * 2.0f - 1.0f) * scale));
+}
+
+static float		check_rel(float fast, float exact)
+{
+	if (exact == 0.0f)
+		return (fabsf(fast));
+	return (fabsf(fast - exact) / fabsf(exact));
+}
+
+static float		check_blinn(t_vec center, t_vec p, t_vec light, t_vec eye,
+						int fast)
+{
+	t_vec			n;
+	t_vec			l;
+	t_vec			v;
+	t_vec			h;
+	float			term;
+
+	n = vec_sub(p, center);
+	l = vec_sub(light, p);
+	v = vec_sub(p, eye);
+	n = fast ? vec_normalize_fast(n) : vec_normalize(n);
+	l = fast ? vec_normalize_fast(l) : vec_normalize(l);
+	v = fast ? vec_normalize_fast(v) : vec_normalize(v);
+	h = vec_sub(l, v);
+	h = fast ? vec_normalize_fast(h) : vec_normalize(h);
+	term = max(dot_product(h, n), 0.0f);
+	return (SPEC_VALUE * (fast ? rt_powi(term, SPEC_POWER)
+		: powf(term, SPEC_POWER)));
+}
+
+int					fast_math_check(void)
+{
+	unsigned int	seed;
+	float			err[5];
+	float			x;
+	t_vec			v;
+	t_vec			d;
+	int				i;
+
+	seed = 42;
+	for (i = 0; i < 5; i++)
+		err[i] = 0.0f;
+	for (i = 0; i < CHECK_SAMPLES; i++)
+	{
+		x = powf(10.0f, check_rand(&seed) * 12.0f - 6.0f);
+		err[0] = max(err[0], check_rel(rt_rsqrt(x), 1.0f / sqrtf(x)));
+		v = check_rand_vec(&seed, 100.0f);
+		d = vec_sub(vec_normalize_fast(v), vec_normalize(v));
+		err[1] = max(err[1], sqrtf(vec_length2(d)));
+		x = check_rand(&seed);
+		err[2] = max(err[2], fabsf(rt_powi(x, SPEC_POWER) - powf(x, SPEC_POWER)));
+		err[3] = max(err[3], fabsf(rt_powi(x, 3) - powf(x, 3)));
+		v = vec_add(set_vec(0.0f, 0.0f, -20.0f), check_rand_vec(&seed, 10.0f));
+		d = vec_add(v, vec_normalize(check_rand_vec(&seed, 1.0f)));
+		err[4] = max(err[4], fabsf(check_blinn(v, d, set_vec(0.0f, 20.0f, -30.0f),
+			set_vec(0.0f, 5.0f, 10.0f), 1) - check_blinn(v, d,
+			set_vec(0.0f, 20.0f, -30.0f), set_vec(0.0f, 5.0f, 10.0f), 0)));
+	}
+	printf("fast-math accuracy over %d samples (max error against the exact path)\n",
+		CHECK_SAMPLES);
+	printf("  rt_rsqrt            relative  %g\n", err[0]);
+	printf("  vec_normalize_fast  absolute  %g\n", err[1]);
+	printf("  rt_powi(x, %d)     absolute  %g\n", SPEC_POWER, err[2]);
+	printf("  rt_powi(x, 3)       absolute  %g\n", err[3]);
+	printf("  Blinn-Phong term    absolute  %g (out of %g, 1/255 = %g)\n",
+		err[4], SPEC_VALUE, 1.0f / 255.0f);
+	return (err[4] * 255.0f < 1.0f ? 0 : 1);
+}
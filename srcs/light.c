@@ -0,0 +1,47 @@
+#include <rtv1.h>
+
+#define LIGHT_MOVE_SPEED	0.5f
+#define LIGHT_FADE_SPEED	1.05f
+
+/*
+** Edit the first light of the scene: IJKL move it in the horizontal plane,
+** U/O move it down/up, P/M make it brighter/dimmer. Returns 1 if the light
+** changed, the caller then only has to relight the frame.
+*/
+int					light_update(t_spheres *spheres, t_input *in)
+{
+	t_sphere		*light;
+	t_vec			move;
+	float			fade;
+	int				i;
+
+	light = NULL;
+	for (i = 0; i < spheres->nb_spheres && !light; i++)
+		if (spheres->spheres[i].is_light)
+			light = &spheres->spheres[i];
+	if (!light)
+		return (0);
+	move = set_vec(0.0f, 0.0f, 0.0f);
+	if (in->key[SDL_SCANCODE_I])
+		move.z -= 1.0f;
+	if (in->key[SDL_SCANCODE_K])
+		move.z += 1.0f;
+	if (in->key[SDL_SCANCODE_L])
+		move.x += 1.0f;
+	if (in->key[SDL_SCANCODE_J])
+		move.x -= 1.0f;
+	if (in->key[SDL_SCANCODE_O])
+		move.y += 1.0f;
+	if (in->key[SDL_SCANCODE_U])
+		move.y -= 1.0f;
+	fade = 1.0f;
+	if (in->key[SDL_SCANCODE_P])
+		fade *= LIGHT_FADE_SPEED;
+	if (in->key[SDL_SCANCODE_M])
+		fade /= LIGHT_FADE_SPEED;
+	if (move.x == 0.0f && move.y == 0.0f && move.z == 0.0f && fade == 1.0f)
+		return (0);
+	light->pos = vec_add(light->pos, vec_mult_f(move, LIGHT_MOVE_SPEED));
+	light->emis_color = vec_mult_f(light->emis_color, fade);
+	return (1);
+}
@@ -0,0 +1,138 @@
+#include <rtv1.h>
+
+/*
+** Rasterized primary visibility (--raster). A tile no longer runs every
+** primary ray against every sphere: each sphere is projected to the screen
+** rectangle of the rays that can hit it, and only the pixels of that
+** rectangle run the hitsphere() test, keeping the nearest hit in a depth and
+** id buffer. With many small spheres most pixels see a handful of tests
+** instead of all of them. The test, the order of the spheres and the depth
+** comparison are those of raytrace_hit(), so the G-buffer comes out the same
+** bit for bit; the rectangles are a pixel wider than the exact projection.
+*/
+
+/*
+** Range [lo, hi] of x / z over the directions (x, z) that pass within
+** sqrt(r2) of the point (l, lz), when the whole circle is in front (lz > r):
+** the roots of (l - s lz)^2 = r2 (1 + s^2)
+*/
+static void			raster_range(float l, float lz, float r2, float *range)
+{
+	float			a;
+	float			disc;
+
+	a = lz * lz - r2;
+	disc = sqrtf(r2 * max(0.0f, l * l + lz * lz - r2));
+	range[0] = (l * lz - disc) / a;
+	range[1] = (l * lz + disc) / a;
+}
+
+/*
+** Pixel coordinate v clamped to [-1, size], whatever the size of v
+*/
+static int			raster_pixel(float v, int size)
+{
+	return ((int)max(-1.0f, min((float)size, v)));
+}
+
+/*
+** Pixels whose primary ray can hit s: rect is x0, y0, x1, y1 (inclusive).
+** Returns 0 if none can, spheres reaching behind the camera cover the screen.
+*/
+static int			raster_bounds(t_render *r, t_camera *camera, t_sphere *s,
+						int *rect)
+{
+	t_vec			l;
+	float			lz;
+	float			r2;
+	float			angle;
+	float			xx[2];
+	float			yy[2];
+
+	l = vec_sub(s->pos, camera->pos);
+	lz = dot_product(l, camera->forward);
+	r2 = s->rad * s->rad;
+	if (lz < -s->rad)
+		return (0);
+	rect[0] = 0;
+	rect[1] = 0;
+	rect[2] = r->rx - 1;
+	rect[3] = r->ry - 1;
+	if (lz <= s->rad || lz * lz - r2 <= 1e-3f * dot_product(l, l))
+		return (1);
+	angle = tan(M_PI * 0.5f * camera->fov / 180.0f);
+	raster_range(dot_product(l, camera->right), lz, r2, xx);
+	raster_range(dot_product(l, camera->up), lz, r2, yy);
+	rect[0] = raster_pixel(floorf((xx[0] / (angle * r->rx / (float)r->ry)
+		+ 1.0f) * r->rx * 0.5f - 0.5f) - 1.0f, r->rx);
+	rect[2] = raster_pixel(ceilf((xx[1] / (angle * r->rx / (float)r->ry)
+		+ 1.0f) * r->rx * 0.5f - 0.5f) + 1.0f, r->rx);
+	rect[1] = raster_pixel(floorf((1.0f - yy[1] / angle) * r->ry * 0.5f
+		- 0.5f) - 1.0f, r->ry);
+	rect[3] = raster_pixel(ceilf((1.0f - yy[0] / angle) * r->ry * 0.5f
+		- 0.5f) + 1.0f, r->ry);
+	return (rect[0] <= rect[2] && rect[1] <= rect[3]);
+}
+
+/*
+** Fill the depth and id buffers of tile, sphere after sphere
+*/
+void				raster_tile(t_tile *t, t_render *r, t_spheres *scene,
+						t_camera *camera, int tile)
+{
+	int				rect[4];
+	int				x0;
+	int				y0;
+	int				x;
+	int				y;
+	int				i;
+	int				j;
+	float			t0;
+	float			t1;
+
+	x0 = (tile % r->tiles_x) * TILE_SIZE;
+	y0 = (tile / r->tiles_x) * TILE_SIZE;
+	for (j = 0; j < TILE_SIZE * TILE_SIZE; j++)
+	{
+		t->depth[j] = INFINITY;
+		t->ids[j] = -1;
+		t->dirs[j] = camera_ray(camera, x0 + j % TILE_SIZE, y0 + j / TILE_SIZE,
+			r->rx, r->ry);
+	}
+	for (i = 0; i < scene->nb_spheres; i++)
+	{
+		if (!raster_bounds(r, camera, &scene->spheres[i], rect))
+			continue ;
+		for (y = max(rect[1], y0); y <= min(rect[3], y0 + TILE_SIZE - 1); y++)
+			for (x = max(rect[0], x0); x <= min(rect[2], x0 + TILE_SIZE - 1); x++)
+			{
+				j = (y - y0) * TILE_SIZE + x - x0;
+				t0 = INFINITY;
+				t1 = INFINITY;
+				if (!hitsphere(camera->pos, t->dirs[j], scene->spheres[i], &t0, &t1))
+					continue ;
+				if (t0 < 0)
+					t0 = t1;
+				if (t0 < t->depth[j])
+				{
+					t->depth[j] = t0;
+					t->ids[j] = i;
+				}
+			}
+	}
+	t->rastered = 1;
+}
+
+/*
+** raytrace_hit() for pixel j of a rasterized tile
+*/
+int					raster_hit(t_tile *t, t_spheres *scene, t_camera *camera,
+						int j, t_hit *hit)
+{
+	hit->id = -1;
+	if (t->ids[j] < 0)
+		return (0);
+	set_hit(hit, scene, t->ids[j], vec_fma_f(t->dirs[j], t->depth[j],
+		camera->pos), camera->pos);
+	return (1);
+}
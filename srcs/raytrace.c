@@ -0,0 +1,136 @@
+#include <rtv1.h>
+
+float			calculateLambert(t_vec nhit, t_vec lightDirection)
+{
+	return (max(0.0f, dot_product(lightDirection, nhit)));
+}
+
+/*
+** One case per material class, each with its own constant exponent
+*/
+#define MATERIAL_KERNEL(name, value, power) \
+	case name: return (value * rt_pow_shading(blinnTerm, power));
+
+float calculatePhong(int material, t_vec nhit, t_vec viewDirection, t_vec lightDirection)
+{
+	t_vec blinnDirection = vec_sub(lightDirection, viewDirection);
+	blinnDirection = vec_normalize_shading(blinnDirection);
+
+	float blinnTerm = max(dot_product(blinnDirection, nhit), 0.0f);
+	switch (material)
+	{
+		MATERIALS(MATERIAL_KERNEL)
+	}
+	return (0.0f);
+}
+
+void			set_hit(t_hit *hit, t_spheres *spheres, int id, t_vec phit, t_vec rayorig)
+{
+	hit->pos = phit;
+	hit->id = id;
+	hit->normal = vec_sub(phit, spheres->spheres[id].pos);
+	hit->normal = vec_normalize_shading(hit->normal);
+	hit->view = vec_sub(phit, rayorig);
+	hit->view = vec_normalize_shading(hit->view);
+}
+
+/*
+** Primary visibility: find the nearest sphere and fill the G-buffer entry
+*/
+int				raytrace_hit(t_vec rayorig, t_vec raydir, t_spheres *spheres, t_hit *hit)
+{
+	float		tnear;
+	t_sphere	*sphere = NULL;
+	float		t0;
+	float		t1;
+
+	tnear = INFINITY;
+	for (int i = 0; i < spheres->nb_spheres; i++)
+	{
+	    t0 = INFINITY;
+	    t1 = INFINITY;
+	    if (hitsphere(rayorig, raydir, spheres->spheres[i], &t0, &t1))
+	    {
+	        if (t0 < 0)
+	            t0 = t1;
+	        if (t0 < tnear)
+	        {
+	            tnear = t0;
+	            sphere = &(spheres->spheres[i]);
+	        }
+	    }
+	}
+	hit->id = -1;
+	if (!sphere)
+	    return (0);
+	set_hit(hit, spheres, sphere - spheres->spheres, vec_fma_f(raydir, tnear, rayorig), rayorig);
+	return (1);
+}
+
+/*
+** Shading pass: Lambert and Blinn-Phong for every light, with shadow rays,
+** tinted by the emis_color of the light. Only reads the G-buffer entry, so a
+** light edit never retraces primary rays.
+*/
+int				shade(t_spheres *spheres, t_hit *hit)
+{
+	t_sphere	*sphere;
+	float		t0;
+	float		t1;
+
+	if (hit->id < 0)
+		return (0);
+	sphere = &spheres->spheres[hit->id];
+	t_vec surface_color = set_vec(0.0f, 0.0f, 0.0f);
+	t_vec phit = hit->pos;
+	t_vec nhit = hit->normal;
+
+    for (int i = 0; i < spheres->nb_spheres; i++)
+    {
+    	if (spheres->spheres[i].is_light == 1)
+    	{
+			int transmission = 1;
+			t_vec lightDirection = vec_sub(spheres->spheres[i].pos, phit);
+			lightDirection = vec_normalize_shading(lightDirection);
+
+			for (int j = 0; j < spheres->nb_spheres; j++)
+			{
+				if (i != j)
+				{
+				    if (hitsphere(vec_add(phit, nhit), lightDirection, spheres->spheres[j], &t0, &t1) == 1)
+				    {
+				        transmission = 0;
+				        break;
+				    }
+				}
+			}
+
+			if (transmission == 1)
+			{
+			float lambert = calculateLambert(nhit, lightDirection);
+			float phongTerm = calculatePhong(sphere->material, nhit, hit->view, lightDirection);
+			t_vec lit_color = vec_mult(sphere->surf_color, spheres->spheres[i].emis_color);
+
+			surface_color = vec_add(surface_color, vec_mult_f(lit_color, lambert));
+			surface_color = vec_add(surface_color, vec_mult_f(lit_color, phongTerm));
+			}
+
+			//surface_color = vec_mult(vec_mult_f(vec_mult_f(sphere->surf_color, transmission), max(0.0f, dot_product(nhit, lightDirection))), data->spheres.spheres[i].emis_color);
+		}
+	}
+
+	//surface_color = vec_add(surface_color, sphere->emis_color);
+
+	float red = min(1.0f, surface_color.x) * 255;
+	float green = min(1.0f, surface_color.y) * 255;
+	float blue = min(1.0f, surface_color.z) * 255;
+
+	return ((int)(red) << 24 | (int)(green) << 16 | (int)(blue) << 8 | 255);
+}
+
+int				raytrace(t_vec rayorig, t_vec raydir, t_spheres *spheres, t_hit *hit)
+{
+	if (!raytrace_hit(rayorig, raydir, spheres, hit))
+		return (0);
+	return (shade(spheres, hit));
+}
@@ -0,0 +1,498 @@
+#include <rtv1.h>
+#include <string.h>
+#include <unistd.h>
+
+/*
+** Pass 0 reuses the reprojected previous frame where it is still valid and
+** traces everything else, pass 1 retraces only what pass 0 reused. A relight
+** job only runs the shading pass on the G-buffer, an update job only retraces
+** or reshades its dirty pixels (and the ones a frame left reused). Primary
+** rays are traced first, then the tile is shaded in batches (todo lists the
+** hits to shade). mask tells render_publish which pixels were written.
+** The pixels are visited in the order of the curve of data->order (see
+** rt_curve.h), and so are the tiles by the workers. With r->raster, the
+** primary hits come from a depth and id buffer rasterized (raster.c) the
+** first time the tile has a ray to trace. With r->shadow_maps, the shadow
+** rays only test the spheres the cube maps of the lights list (shadow.c).
+** A tile at a coarse level (budget.c) only traces (or reprojects) the first
+** pixel of each block and fills in the others once it is shaded.
+*/
+static int			render_tile(t_data *data, t_spheres *scene, t_camera *camera,
+						int tile, t_tile *t, unsigned int generation)
+{
+	t_render		*r;
+	t_vec			raydir;
+	int				x0;
+	int				y0;
+	int				x;
+	int				y;
+	int				i;
+	int				j;
+	int				k;
+
+	r = &data->render;
+	x0 = (tile % r->tiles_x) * TILE_SIZE;
+	y0 = (tile / r->tiles_x) * TILE_SIZE;
+	t->nb_todo = 0;
+	t->rastered = 0;
+	t->seconds = budget_clock();
+	if (t->update && !dirty_tile(t, r, scene, camera, tile))
+	{
+		memset(t->mask, 0, sizeof(t->mask));
+		return (1);
+	}
+	for (k = 0; k < TILE_SIZE * TILE_SIZE; k++)
+	{
+		if (k % TILE_SIZE == 0
+			&& __atomic_load_n(&r->generation, __ATOMIC_RELAXED) != generation)
+			return (0);
+		j = r->pixel_order[k];
+		x = x0 + j % TILE_SIZE;
+		y = y0 + j / TILE_SIZE;
+		if (x >= r->rx || y >= r->ry)
+			continue ;
+		i = y * r->rx + x;
+		t->mask[j] = (t->pass == 0 || r->reused[i]);
+		t->reused[j] = 0;
+		if (!t->mask[j])
+			continue ;
+		if (t->relight)
+		{
+			t->hits[j] = r->gbuf[i];
+			t->todo[t->nb_todo++] = j;
+			continue ;
+		}
+		if (((j % TILE_SIZE) | (j / TILE_SIZE)) & ((1 << t->level) - 1))
+		{
+			t->mask[j] = TILE_FILL;
+			continue ;
+		}
+		raydir = camera_ray(camera, x, y, r->rx, r->ry);
+		if (t->update && !r->reused[i] && (t->mask[j] = dirty_pixel(t,
+			scene, camera, raydir, &r->gbuf[i])) != DIRTY_TRACE)
+		{
+			if (t->mask[j] == DIRTY_SHADE)
+			{
+				t->hits[j] = r->gbuf[i];
+				t->todo[t->nb_todo++] = j;
+			}
+			continue ;
+		}
+		if (t->pass == 0 && r->reproject && !t->update
+			&& reproject_valid(r, scene, camera, raydir, i, &t->hits[j]))
+		{
+			t->buf[j] = r->reproj_pixels[i];
+			t->reused[j] = 1;
+		}
+		else
+		{
+			if (r->raster && !t->rastered)
+				raster_tile(t, r, scene, camera, tile);
+			if (r->raster)
+				raster_hit(t, scene, camera, j, &t->hits[j]);
+			else
+				raytrace_hit(camera->pos, raydir, scene, &t->hits[j]);
+			t->todo[t->nb_todo++] = j;
+		}
+	}
+	shade_hits(scene, t->hits, t->todo, t->nb_todo, t->shadows, t->buf);
+	t->seconds = budget_clock() - t->seconds;
+	if (t->level)
+		budget_fill(t);
+	return (1);
+}
+
+/*
+** tile_lo and tile_hi bound the hit points of the tile for dirty_tile(): a
+** frame starts them over, later jobs only grow them. tile_reused tells if
+** the tile still shows reprojected pixels.
+*/
+static void			render_publish(t_render *r, int tile, t_tile *t)
+{
+	t_vec			*lo;
+	t_vec			*hi;
+	int				x0;
+	int				y0;
+	int				x;
+	int				y;
+	int				j;
+
+	x0 = (tile % r->tiles_x) * TILE_SIZE;
+	y0 = (tile / r->tiles_x) * TILE_SIZE;
+	lo = &r->tile_lo[tile];
+	hi = &r->tile_hi[tile];
+	if (!t->relight && !t->update && t->pass == 0)
+	{
+		*lo = set_vec(INFINITY, INFINITY, INFINITY);
+		*hi = set_vec(-INFINITY, -INFINITY, -INFINITY);
+	}
+	if (!t->relight)
+		r->tile_reused[tile] = 0;
+	for (y = y0; y < y0 + TILE_SIZE && y < r->ry; y++)
+		for (x = x0; x < x0 + TILE_SIZE && x < r->rx; x++)
+		{
+			j = (y - y0) * TILE_SIZE + x - x0;
+			if (!t->mask[j])
+				continue ;
+			r->pixels[y * r->rx + x] = t->buf[j];
+			r->gbuf[y * r->rx + x] = t->hits[j];
+			r->reused[y * r->rx + x] = t->reused[j];
+			r->tile_reused[tile] |= t->reused[j];
+			if (t->hits[j].id < 0 || t->relight)
+				continue ;
+			*lo = set_vec(min(lo->x, t->hits[j].pos.x),
+				min(lo->y, t->hits[j].pos.y), min(lo->z, t->hits[j].pos.z));
+			*hi = set_vec(max(hi->x, t->hits[j].pos.x),
+				max(hi->y, t->hits[j].pos.y), max(hi->z, t->hits[j].pos.z));
+		}
+	r->tile_pass[tile] = t->pass + 1;
+	if (!t->relight && !t->update && t->pass == 0)
+		r->gbuf_tiles++;
+}
+
+/*
+** Each worker renders from its own copy of the camera and of the spheres,
+** taken under the lock, so the main thread can edit the scene at any time.
+** Under a budget, pass 0 of a frame is timed for the next one.
+*/
+static void			*render_worker(void *arg)
+{
+	t_data			*data;
+	t_render		*r;
+	t_tile			t;
+	t_camera		camera;
+	t_spheres		scene;
+	unsigned int	generation;
+	double			start;
+	int				ntiles;
+	int				tile;
+	int				done;
+
+	data = (t_data *)arg;
+	r = &data->render;
+	ntiles = r->tiles_x * r->tiles_y;
+	scene.nb_spheres = r->scene.nb_spheres;
+	if (!(scene.spheres = (t_sphere *)malloc(sizeof(t_sphere) * scene.nb_spheres)))
+		return (NULL);
+	pthread_mutex_lock(&r->lock);
+	while (!r->quit)
+	{
+		if (r->next_tile >= r->passes * ntiles)
+		{
+			pthread_cond_wait(&r->wake, &r->lock);
+			continue ;
+		}
+		tile = r->tile_order[r->next_tile % ntiles];
+		t.pass = r->next_tile++ / ntiles;
+		if (r->tile_pass[tile] != t.pass)
+			continue ;
+		t.relight = r->relight;
+		t.update = r->update;
+		t.reshade = r->reshade;
+		t.level = (r->budget > 0.0f && !t.relight && !t.update && t.pass == 0)
+			? r->tile_level[tile] : 0;
+		t.shadows = r->shadow_maps ? &r->shadows[r->shadow_cur] : NULL;
+		if (t.shadows)
+			r->shadow_users[r->shadow_cur]++;
+		t.nb_ghosts = r->nb_ghosts;
+		memcpy(t.ghosts, r->ghosts, sizeof(t_ghost) * r->nb_ghosts);
+		generation = r->generation;
+		camera = r->camera;
+		memcpy(scene.spheres, r->scene.spheres, sizeof(t_sphere) * scene.nb_spheres);
+		pthread_mutex_unlock(&r->lock);
+		start = budget_clock();
+		done = render_tile(data, &scene, &camera, tile, &t, generation);
+		pthread_mutex_lock(&r->lock);
+		if (t.shadows && --r->shadow_users[t.shadows - r->shadows] == 0)
+			pthread_cond_signal(&r->shadow_idle);
+		if (done && generation == r->generation && r->tile_pass[tile] == t.pass)
+		{
+			render_publish(r, tile, &t);
+			r->tiles_done++;
+			if (r->budget > 0.0f && !t.relight && !t.update && t.pass == 0)
+				budget_measure(r, tile, &t, budget_clock() - start);
+		}
+	}
+	pthread_mutex_unlock(&r->lock);
+	free(scene.spheres);
+	return (NULL);
+}
+
+int					render_init(t_data *data, int rx, int ry)
+{
+	t_render		*r;
+	int				i;
+
+	r = &data->render;
+	r->rx = rx;
+	r->ry = ry;
+	r->tiles_x = (rx + TILE_SIZE - 1) / TILE_SIZE;
+	r->tiles_y = (ry + TILE_SIZE - 1) / TILE_SIZE;
+	r->next_tile = 2 * r->tiles_x * r->tiles_y;
+	r->tiles_done = 0;
+	r->generation = 0;
+	r->quit = 0;
+	r->relight = 0;
+	r->update = 0;
+	r->reshade = 0;
+	r->passes = 2;
+	r->nb_ghosts = 0;
+	r->gbuf_tiles = 0;
+	r->raster = data->raster;
+	r->shadow_maps = data->shadow_maps;
+	r->budget = data->budget;
+	r->camera = data->camera;
+	r->scene.nb_spheres = data->spheres.nb_spheres;
+	if (!(r->scene.spheres = (t_sphere *)malloc(sizeof(t_sphere)
+		* r->scene.nb_spheres))
+		|| !(r->pixels = (Uint32 *)calloc(rx * ry, sizeof(Uint32)))
+		|| !(r->tile_pass = (int *)calloc(r->tiles_x * r->tiles_y, sizeof(int)))
+		|| !(r->tile_order = (int *)malloc(sizeof(int) * r->tiles_x
+		* r->tiles_y))
+		|| !(r->tile_lo = (t_vec *)malloc(sizeof(t_vec) * r->tiles_x
+		* r->tiles_y))
+		|| !(r->tile_hi = (t_vec *)malloc(sizeof(t_vec) * r->tiles_x
+		* r->tiles_y))
+		|| !(r->tile_reused = (char *)calloc(r->tiles_x * r->tiles_y, 1))
+		|| !budget_init(r)
+		|| !reproject_init(r))
+		return (0);
+	r->shadow_cur = 0;
+	r->shadow_users[0] = 0;
+	r->shadow_users[1] = 0;
+	if (r->shadow_maps && (!shadow_init(&r->shadows[0], &r->scene)
+		|| !shadow_init(&r->shadows[1], &r->scene)))
+	{
+		free(r->shadows[0].built);
+		r->shadow_maps = 0;
+	}
+	rt_curve_order(data->order, r->tiles_x, r->tiles_y, r->tile_order);
+	rt_curve_order(data->order, TILE_SIZE, TILE_SIZE, r->pixel_order);
+	r->nb_threads = max(1, sysconf(_SC_NPROCESSORS_ONLN));
+	if (!(r->threads = (pthread_t *)malloc(sizeof(pthread_t) * r->nb_threads)))
+		return (0);
+	pthread_mutex_init(&r->lock, NULL);
+	pthread_cond_init(&r->wake, NULL);
+	pthread_cond_init(&r->shadow_idle, NULL);
+	for (i = 0; i < r->nb_threads; i++)
+		if (pthread_create(&r->threads[i], NULL, render_worker, data) != 0)
+		{
+			r->nb_threads = i;
+			break ;
+		}
+	return (r->nb_threads > 0);
+}
+
+/*
+** The workers of the current job go on reading shadows[shadow_cur], so a new
+** job updates the other set and makes it the current one. That set can only
+** be in use by workers of the job before, which the generation change has
+** already made drop their tile: wait for them (at most the shading of one
+** tile) before anything of the new job is set up, since the lock is let go.
+*/
+static void			render_shadows_idle(t_render *r)
+{
+	if (!r->shadow_maps)
+		return ;
+	while (r->shadow_users[1 - r->shadow_cur])
+		pthread_cond_wait(&r->shadow_idle, &r->lock);
+}
+
+/*
+** Bring the shadow maps up to date with r->scene (lock held, after
+** render_shadows_idle())
+*/
+static void			render_shadows(t_render *r)
+{
+	shadow_update(&r->shadows[1 - r->shadow_cur], &r->scene);
+	r->shadow_cur = 1 - r->shadow_cur;
+}
+
+/*
+** Cancel whatever is being traced and start a new frame from data->camera.
+** Never blocks on the workers (but for the shadow maps the workers of the job
+** before the last one may still read, see render_shadows_idle()): tiles still
+** in flight notice the generation change and are dropped. The previous frame is
+** reprojected first so the workers only have to trace what it cannot provide.
+** Under a budget, the levels of the tiles are chosen for the frame.
+*/
+void				render_start(t_data *data)
+{
+	t_render		*r;
+
+	r = &data->render;
+	pthread_mutex_lock(&r->lock);
+	render_shadows_idle(r);
+	r->frame_start = budget_clock();
+	__atomic_add_fetch(&r->generation, 1, __ATOMIC_RELAXED);
+	r->camera = data->camera;
+	memcpy(r->scene.spheres, data->spheres.spheres,
+		sizeof(t_sphere) * r->scene.nb_spheres);
+	if (r->shadow_maps)
+		render_shadows(r);
+	if (r->reproject)
+		reproject_frame(r, &r->camera);
+	if (r->budget > 0.0f)
+		budget_levels(r);
+	memset(r->tile_pass, 0, sizeof(int) * r->tiles_x * r->tiles_y);
+	r->next_tile = 0;
+	r->tiles_done = 0;
+	r->relight = 0;
+	r->update = 0;
+	r->passes = 2;
+	r->gbuf_tiles = 0;
+	pthread_cond_broadcast(&r->wake);
+	pthread_mutex_unlock(&r->lock);
+}
+
+/*
+** Start a single pass job on the G-buffer with the current spheres (lock
+** held, after render_shadows_idle())
+*/
+static void			render_job(t_data *data, int relight, int update)
+{
+	t_render		*r;
+
+	r = &data->render;
+	__atomic_add_fetch(&r->generation, 1, __ATOMIC_RELAXED);
+	memcpy(r->scene.spheres, data->spheres.spheres,
+		sizeof(t_sphere) * r->scene.nb_spheres);
+	if (r->shadow_maps)
+		render_shadows(r);
+	memset(r->tile_pass, 0, sizeof(int) * r->tiles_x * r->tiles_y);
+	r->next_tile = 0;
+	r->tiles_done = 0;
+	r->relight = relight;
+	r->update = update;
+	r->passes = 1;
+	pthread_cond_broadcast(&r->wake);
+}
+
+/*
+** Start a relight job after a light edit: the camera did not move, so the
+** G-buffer is still right and only the shading pass runs again. Falls back
+** to a full frame while the G-buffer is not complete yet. An unfinished
+** update job is restarted instead, shading every pixel it does not retrace,
+** and so is a frame whose pass 1 did not retrace every reused pixel yet: the
+** G-buffer only has a borrowed hit for those (the anchor of a coarse block,
+** a reprojected one), and a relight would publish them as final.
+*/
+void				render_relight(t_data *data)
+{
+	t_render		*r;
+	int				ntiles;
+	int				busy;
+	int				i;
+
+	r = &data->render;
+	pthread_mutex_lock(&r->lock);
+	render_shadows_idle(r);
+	ntiles = r->tiles_x * r->tiles_y;
+	if (r->gbuf_tiles < ntiles)
+	{
+		pthread_mutex_unlock(&r->lock);
+		render_start(data);
+		return ;
+	}
+	busy = r->update && r->tiles_done < ntiles;
+	for (i = 0; i < ntiles && !r->tile_reused[i]; i++)
+		;
+	if (busy || i < ntiles)
+	{
+		if (!busy)
+			r->nb_ghosts = 0;
+		r->reshade = 1;
+		render_job(data, 0, 1);
+	}
+	else
+		render_job(data, 1, 0);
+	pthread_mutex_unlock(&r->lock);
+}
+
+/*
+** Start an update job after a sphere edit: the spheres that differ from the
+** ones on screen become ghosts, and only the pixels they can have changed are
+** traced or shaded again. The ghosts of an unfinished update are kept since
+** its tiles may still show them. Lights, an incomplete G-buffer or too many
+** ghosts fall back to a full frame.
+*/
+void				render_update(t_data *data)
+{
+	t_render		*r;
+	int				busy;
+	int				i;
+
+	r = &data->render;
+	pthread_mutex_lock(&r->lock);
+	render_shadows_idle(r);
+	busy = r->tiles_done < r->passes * r->tiles_x * r->tiles_y;
+	if (!r->update || !busy)
+	{
+		r->nb_ghosts = 0;
+		r->reshade = r->relight && busy;
+	}
+	for (i = 0; i < r->scene.nb_spheres; i++)
+	{
+		if (!sphere_changed(&r->scene.spheres[i], &data->spheres.spheres[i]))
+			continue ;
+		if (r->scene.spheres[i].is_light || data->spheres.spheres[i].is_light
+			|| r->nb_ghosts == MAX_GHOSTS
+			|| r->gbuf_tiles < r->tiles_x * r->tiles_y)
+		{
+			pthread_mutex_unlock(&r->lock);
+			render_start(data);
+			return ;
+		}
+		r->ghosts[r->nb_ghosts].id = i;
+		r->ghosts[r->nb_ghosts++].sphere = r->scene.spheres[i];
+	}
+	render_job(data, 0, 1);
+	pthread_mutex_unlock(&r->lock);
+}
+
+int					render_progress(t_data *data)
+{
+	return (__atomic_load_n(&data->render.tiles_done, __ATOMIC_RELAXED));
+}
+
+/*
+** Whether pass 0 of the last frame covered every tile
+*/
+int					render_frame_done(t_data *data)
+{
+	return (__atomic_load_n(&data->render.gbuf_tiles, __ATOMIC_RELAXED)
+		== data->render.tiles_x * data->render.tiles_y);
+}
+
+void				render_quit(t_data *data)
+{
+	t_render		*r;
+	int				i;
+
+	r = &data->render;
+	pthread_mutex_lock(&r->lock);
+	r->quit = 1;
+	__atomic_add_fetch(&r->generation, 1, __ATOMIC_RELAXED);
+	pthread_cond_broadcast(&r->wake);
+	pthread_mutex_unlock(&r->lock);
+	for (i = 0; i < r->nb_threads; i++)
+		pthread_join(r->threads[i], NULL);
+	pthread_mutex_destroy(&r->lock);
+	pthread_cond_destroy(&r->wake);
+	pthread_cond_destroy(&r->shadow_idle);
+	free(r->threads);
+	free(r->pixels);
+	free(r->tile_pass);
+	free(r->tile_order);
+	free(r->tile_lo);
+	free(r->tile_hi);
+	free(r->tile_reused);
+	budget_quit(r);
+	free(r->scene.spheres);
+	if (r->shadow_maps)
+	{
+		shadow_quit(&r->shadows[0]);
+		shadow_quit(&r->shadows[1]);
+	}
+	reproject_quit(r);
+}
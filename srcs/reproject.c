@@ -0,0 +1,118 @@
+#include <rtv1.h>
+
+/*
+** Accept a reprojected sample if the ray of the new pixel still hits the
+** same sphere close to where the previous frame hit it.
+*/
+#define REPROJ_TOLERANCE	0.01f
+
+int					reproject_init(t_render *r)
+{
+	int				size;
+
+	size = r->rx * r->ry;
+	r->reproject = 1;
+	r->gbuf = (t_hit *)malloc(sizeof(t_hit) * size);
+	r->reproj_pixels = (Uint32 *)malloc(sizeof(Uint32) * size);
+	r->reproj_pos = (t_vec *)malloc(sizeof(t_vec) * size);
+	r->reproj_id = (int *)malloc(sizeof(int) * size);
+	r->reproj_depth = (float *)malloc(sizeof(float) * size);
+	r->reused = (char *)calloc(size, sizeof(char));
+	if (!r->gbuf || !r->reproj_pixels || !r->reproj_pos
+		|| !r->reproj_id || !r->reproj_depth || !r->reused)
+		return (0);
+	while (size--)
+	{
+		r->gbuf[size].id = -1;
+		r->reproj_id[size] = -1;
+	}
+	return (1);
+}
+
+/*
+** Forward-project every displayed hit point through the new camera and keep
+** the nearest one per pixel. The result is copied to the screen right away so
+** the view follows the camera before any ray is traced; the workers then
+** validate it and fill the holes.
+*/
+void				reproject_frame(t_render *r, t_camera *camera)
+{
+	float			angle;
+	float			aspect;
+	t_vec			v;
+	float			z;
+	int				i;
+	int				x;
+	int				y;
+
+	angle = tan(M_PI * 0.5f * camera->fov / 180.0f);
+	aspect = r->rx / (float)r->ry;
+	for (i = 0; i < r->rx * r->ry; i++)
+	{
+		r->reproj_id[i] = -1;
+		r->reproj_depth[i] = INFINITY;
+	}
+	for (i = 0; i < r->rx * r->ry; i++)
+	{
+		if (r->gbuf[i].id < 0)
+			continue ;
+		v = vec_sub(r->gbuf[i].pos, camera->pos);
+		if ((z = dot_product(v, camera->forward)) <= 0.0f)
+			continue ;
+		x = (int)floorf((dot_product(v, camera->right) / (z * angle * aspect)
+			+ 1.0f) * 0.5f * r->rx);
+		y = (int)floorf((1.0f - dot_product(v, camera->up) / (z * angle))
+			* 0.5f * r->ry);
+		if (x < 0 || y < 0 || x >= r->rx || y >= r->ry
+			|| z >= r->reproj_depth[y * r->rx + x])
+			continue ;
+		r->reproj_depth[y * r->rx + x] = z;
+		r->reproj_pixels[y * r->rx + x] = r->pixels[i];
+		r->reproj_pos[y * r->rx + x] = r->gbuf[i].pos;
+		r->reproj_id[y * r->rx + x] = r->gbuf[i].id;
+	}
+	for (i = 0; i < r->rx * r->ry; i++)
+	{
+		r->gbuf[i].id = r->reproj_id[i];
+		if (r->reproj_id[i] < 0)
+			continue ;
+		r->pixels[i] = r->reproj_pixels[i];
+		r->gbuf[i].pos = r->reproj_pos[i];
+	}
+}
+
+/*
+** On success hit is a complete G-buffer entry for the pixel, as if it had
+** been traced.
+*/
+int					reproject_valid(t_render *r, t_spheres *scene, t_camera *camera,
+						t_vec raydir, int i, t_hit *hit)
+{
+	t_vec			phit;
+	t_vec			d;
+	float			t0;
+	float			t1;
+
+	if (r->reproj_id[i] < 0 || r->reproj_id[i] >= scene->nb_spheres
+		|| !hitsphere(camera->pos, raydir, scene->spheres[r->reproj_id[i]],
+		&t0, &t1))
+		return (0);
+	if (t0 < 0)
+		t0 = t1;
+	phit = vec_fma_f(raydir, t0, camera->pos);
+	d = vec_sub(phit, r->reproj_pos[i]);
+	if (dot_product(d, d) > REPROJ_TOLERANCE * REPROJ_TOLERANCE * t0 * t0)
+		return (0);
+	set_hit(hit, scene, r->reproj_id[i], phit, camera->pos);
+	return (1);
+}
+
+void				reproject_quit(t_render *r)
+{
+	free(r->gbuf);
+	free(r->reproj_pixels);
+	free(r->reproj_pos);
+	free(r->reproj_id);
+	free(r->reproj_depth);
+	free(r->reused);
+}
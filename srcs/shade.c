@@ -0,0 +1,304 @@
+#include <rtv1.h>
+
+/*
+** Batched shading pass: the maths of shade() on SoA batches of SHADE_LANES
+** hits of a single material. Every loop runs over whole batches with no
+** per-hit branch (the shadow test is a mask) so the compiler vectorises
+** them. normalize_lanes() stays out of line: once inlined, gcc turns the
+** len2 > 0 select back into a branch and the loop no longer vectorises.
+*/
+
+static __attribute__((noinline))
+void				normalize_lanes(float *x, float *y, float *z)
+{
+	float			len2;
+	float			inv;
+	int				k;
+
+	for (k = 0; k < SHADE_LANES; k++)
+	{
+		len2 = RT_FMA(z[k], z[k], RT_FMA(y[k], y[k], x[k] * x[k]));
+		inv = 1.0f / sqrtf(len2 > 0.0f ? len2 : 1.0f);
+		x[k] *= inv;
+		y[k] *= inv;
+		z[k] *= inv;
+	}
+}
+
+/*
+** lit[k] is cleared if the shadow ray of lane k hits a sphere other than
+** the light (same test as hitsphere(), from phit + nhit). ids lists the
+** spheres to test, all of them if it is NULL.
+*/
+static void			shadow_lanes(t_hit_batch *b, t_spheres *spheres, int light,
+						unsigned short *ids, int n, float *lx, float *ly,
+						float *lz, int *lit)
+{
+	t_sphere		*s;
+	float			ox;
+	float			oy;
+	float			oz;
+	float			tca;
+	float			d2;
+	int				j;
+	int				k;
+
+	for (j = 0; j < (ids ? n : spheres->nb_spheres); j++)
+	{
+		if (!ids && j == light)
+			continue ;
+		s = &spheres->spheres[ids ? ids[j] : j];
+		for (k = 0; k < SHADE_LANES; k++)
+		{
+			ox = s->pos.x - (b->px[k] + b->nx[k]);
+			oy = s->pos.y - (b->py[k] + b->ny[k]);
+			oz = s->pos.z - (b->pz[k] + b->nz[k]);
+			tca = RT_FMA(oz, lz[k], RT_FMA(oy, ly[k], ox * lx[k]));
+			d2 = RT_FMA(oz, oz, RT_FMA(oy, oy, ox * ox)) - tca * tca;
+			lit[k] &= (tca < 0) | (d2 > (s->rad * s->rad));
+		}
+	}
+}
+
+/*
+** shadow_lanes() with the cube map of the light (shadow.c): the batch only
+** tests the spheres listed in the texels of its lanes. A sphere listed for
+** one lane cannot shadow the others, so they get the same result as with
+** every sphere. A full texel, or too many spheres, and they are all tested.
+*/
+#define SHADOW_BATCH_IDS	(4 * SHADE_LANES)
+
+static void			shadow_lanes_map(t_hit_batch *b, t_spheres *spheres,
+						t_shadow_map *map, float *lx, float *ly, float *lz,
+						int *lit)
+{
+	unsigned short	all[SHADOW_BATCH_IDS];
+	unsigned short	*ids;
+	unsigned short	*last;
+	int				total;
+	int				n;
+	int				i;
+	int				j;
+	int				k;
+
+	total = 0;
+	last = NULL;
+	for (k = 0; k < SHADE_LANES; k++)
+	{
+		if ((n = shadow_lookup(map, set_vec(b->px[k], b->py[k], b->pz[k]),
+			&ids)) < 0)
+			break ;
+		for (i = 0; ids != last && i < n && total <= SHADOW_BATCH_IDS; i++)
+		{
+			for (j = 0; j < total && all[j] != ids[i]; j++)
+				;
+			if (j == total && total < SHADOW_BATCH_IDS)
+				all[total] = ids[i];
+			total += (j == total);
+		}
+		if (total > SHADOW_BATCH_IDS)
+			break ;
+		last = ids;
+	}
+	if (k < SHADE_LANES)
+		shadow_lanes(b, spheres, map->light, NULL, 0, lx, ly, lz, lit);
+	else
+		shadow_lanes(b, spheres, map->light, all, total, lx, ly, lz, lit);
+}
+
+/*
+** x[k] = x[k]^n, rt_pow_shading() on whole batches: the fast path squares
+** all the lanes once per bit of n, as rt_powi() does for one value.
+*/
+static void			pow_lanes(float *x, unsigned int n)
+{
+	int				k;
+#ifdef RT_FAST_MATH
+	float			r[SHADE_LANES];
+
+	for (k = 0; k < SHADE_LANES; k++)
+		r[k] = 1.0f;
+	while (n)
+	{
+		if (n & 1)
+			for (k = 0; k < SHADE_LANES; k++)
+				r[k] *= x[k];
+		for (k = 0; k < SHADE_LANES; k++)
+			x[k] *= x[k];
+		n >>= 1;
+	}
+	for (k = 0; k < SHADE_LANES; k++)
+		x[k] = r[k];
+#else
+	for (k = 0; k < SHADE_LANES; k++)
+		x[k] = powf(x[k], n);
+#endif
+}
+
+static void			shade_lanes(t_hit_batch *b, t_spheres *spheres,
+						t_shadows *shadows, float spec_value,
+						unsigned int spec_power)
+{
+	float			lx[SHADE_LANES];
+	float			ly[SHADE_LANES];
+	float			lz[SHADE_LANES];
+	float			hx[SHADE_LANES];
+	float			hy[SHADE_LANES];
+	float			hz[SHADE_LANES];
+	int				lit[SHADE_LANES];
+	float			lambert[SHADE_LANES];
+	float			spec[SHADE_LANES];
+	float			cr;
+	float			cg;
+	float			cb;
+	t_sphere		*light;
+	t_shadow_map	*map;
+	int				i;
+	int				k;
+
+	for (k = 0; k < SHADE_LANES; k++)
+	{
+		b->r[k] = 0.0f;
+		b->g[k] = 0.0f;
+		b->b[k] = 0.0f;
+	}
+	for (i = 0; i < spheres->nb_spheres; i++)
+	{
+		light = &spheres->spheres[i];
+		if (light->is_light != 1)
+			continue ;
+		for (k = 0; k < SHADE_LANES; k++)
+		{
+			lx[k] = light->pos.x - b->px[k];
+			ly[k] = light->pos.y - b->py[k];
+			lz[k] = light->pos.z - b->pz[k];
+			lit[k] = 1;
+		}
+		normalize_lanes(lx, ly, lz);
+		if (shadows && (map = shadow_map(shadows, i)))
+			shadow_lanes_map(b, spheres, map, lx, ly, lz, lit);
+		else
+			shadow_lanes(b, spheres, i, NULL, 0, lx, ly, lz, lit);
+		for (k = 0; k < SHADE_LANES; k++)
+		{
+			hx[k] = lx[k] - b->vx[k];
+			hy[k] = ly[k] - b->vy[k];
+			hz[k] = lz[k] - b->vz[k];
+		}
+		normalize_lanes(hx, hy, hz);
+		for (k = 0; k < SHADE_LANES; k++)
+		{
+			lambert[k] = max(0.0f, RT_FMA(lz[k], b->nz[k],
+				RT_FMA(ly[k], b->ny[k], lx[k] * b->nx[k])));
+			spec[k] = max(RT_FMA(hz[k], b->nz[k],
+				RT_FMA(hy[k], b->ny[k], hx[k] * b->nx[k])), 0.0f);
+		}
+		pow_lanes(spec, spec_power);
+		for (k = 0; k < SHADE_LANES; k++)
+		{
+			spec[k] *= spec_value;
+			cr = b->cr[k] * light->emis_color.x;
+			cg = b->cg[k] * light->emis_color.y;
+			cb = b->cb[k] * light->emis_color.z;
+			b->r[k] = lit[k] ? b->r[k] + cr * lambert[k] + cr * spec[k] : b->r[k];
+			b->g[k] = lit[k] ? b->g[k] + cg * lambert[k] + cg * spec[k] : b->g[k];
+			b->b[k] = lit[k] ? b->b[k] + cb * lambert[k] + cb * spec[k] : b->b[k];
+		}
+	}
+}
+
+/*
+** One batch per material class, so the exponent is the same for all lanes
+*/
+#define MATERIAL_BATCH(name, value, power) \
+	case name: shade_lanes(b, spheres, shadows, value, power); break;
+
+static void			shade_batch(t_hit_batch *b, t_spheres *spheres,
+						t_shadows *shadows, int material, Uint32 *out)
+{
+	Uint32			packed[SHADE_LANES];
+	int				k;
+
+	for (k = b->count; k < SHADE_LANES; k++)
+	{
+		b->px[k] = b->px[0];
+		b->py[k] = b->py[0];
+		b->pz[k] = b->pz[0];
+		b->nx[k] = b->nx[0];
+		b->ny[k] = b->ny[0];
+		b->nz[k] = b->nz[0];
+		b->vx[k] = b->vx[0];
+		b->vy[k] = b->vy[0];
+		b->vz[k] = b->vz[0];
+		b->cr[k] = b->cr[0];
+		b->cg[k] = b->cg[0];
+		b->cb[k] = b->cb[0];
+	}
+	switch (material)
+	{
+		MATERIALS(MATERIAL_BATCH)
+	}
+	for (k = 0; k < SHADE_LANES; k++)
+		packed[k] = (Uint32)(int)(min(1.0f, b->r[k]) * 255) << 24
+			| (Uint32)(int)(min(1.0f, b->g[k]) * 255) << 16
+			| (Uint32)(int)(min(1.0f, b->b[k]) * 255) << 8 | 255;
+	for (k = 0; k < b->count; k++)
+		out[b->slot[k]] = packed[k];
+	b->count = 0;
+}
+
+static void			batch_add(t_hit_batch *b, t_hit *hit, t_sphere *sphere, int slot)
+{
+	int				k;
+
+	k = b->count++;
+	b->px[k] = hit->pos.x;
+	b->py[k] = hit->pos.y;
+	b->pz[k] = hit->pos.z;
+	b->nx[k] = hit->normal.x;
+	b->ny[k] = hit->normal.y;
+	b->nz[k] = hit->normal.z;
+	b->vx[k] = hit->view.x;
+	b->vy[k] = hit->view.y;
+	b->vz[k] = hit->view.z;
+	b->cr[k] = sphere->surf_color.x;
+	b->cg[k] = sphere->surf_color.y;
+	b->cb[k] = sphere->surf_color.z;
+	b->slot[k] = slot;
+}
+
+/*
+** Shade hits[todo[0..n - 1]] into out[todo[0..n - 1]]. Hits are packed into
+** batches one material at a time; misses are black, as in raytrace().
+** shadows is the light visibility cache of spheres, or NULL.
+*/
+void				shade_hits(t_spheres *spheres, t_hit *hits, int *todo, int n,
+						t_shadows *shadows, Uint32 *out)
+{
+	t_hit_batch		b;
+	t_hit			*hit;
+	int				material;
+	int				i;
+
+	for (material = 0; material < MAT_COUNT; material++)
+	{
+		b.count = 0;
+		for (i = 0; i < n; i++)
+		{
+			hit = &hits[todo[i]];
+			if (hit->id < 0)
+			{
+				if (material == 0)
+					out[todo[i]] = 0;
+				continue ;
+			}
+			if (spheres->spheres[hit->id].material != material)
+				continue ;
+			batch_add(&b, hit, &spheres->spheres[hit->id], todo[i]);
+			if (b.count == SHADE_LANES)
+				shade_batch(&b, spheres, shadows, material, out);
+		}
+		if (b.count)
+			shade_batch(&b, spheres, shadows, material, out);
+	}
+}
@@ -0,0 +1,276 @@
+#include <rtv1.h>
+#include <string.h>
+
+/*
+** Light visibility cache (--shadow-maps). The shadow ray of a hit point p
+** starts at p + n (|n| = 1) towards the light L, and hitsphere() tests the
+** whole line ahead of it: the line through L, shifted by n, in the
+** direction of p seen from L. A sphere that this line can meet, grown by 1,
+** meets the line through L itself, so it is seen from L in that direction
+** or in the opposite one. Each sphere is therefore listed in the texels of
+** the cube map covered by its grown disc as seen from L and by the mirror
+** image of that disc, and a point only has to test the spheres of its own
+** texel: there are none wherever nothing can cast a shadow, a few around the
+** silhouettes and inside the shadows. The lists are conservative (the
+** bounding rectangle of each disc on each face, a texel wider), so the
+** shadows come out the same bit for bit as with every sphere tested.
+** A sphere edit only moves its id out of the texels of its old disc and
+** into those of the new one; a light that moves rebuilds its own map.
+** The lookup only pays off with a few hundred spheres or more: with a
+** handful, testing them all is cheaper.
+*/
+#define SHADOW_MARGIN	1e-3f
+
+/*
+** Texel column of the face coordinate v (in [-1, 1]), clamped to the texels
+** around the face whatever the size of v
+*/
+static int			shadow_coord(float v)
+{
+	return ((int)max(-2.0f, min((float)SHADOW_SIZE + 1.0f,
+		floorf((v + 1.0f) * 0.5f * SHADOW_SIZE))));
+}
+
+/*
+** Range [lo, hi] of x / z over the directions (x, z), z > 0, that pass within
+** rad of the point (x, z): the directions of the disc lie between the angles
+** phi - half and phi + half, and x / z = cot(angle) decreases from 0 to pi.
+** Returns 0 if none of them has z > 0. Values beyond the face are +-2.
+*/
+static int			shadow_range(float x, float z, float rad, float *range)
+{
+	float			rho;
+	float			half;
+	float			lo;
+	float			hi;
+
+	range[0] = -2.0f;
+	range[1] = 2.0f;
+	if ((rho = sqrtf(x * x + z * z)) <= rad)
+		return (1);
+	half = asinf(rad / rho);
+	lo = atan2f(z, x) - half;
+	hi = atan2f(z, x) + half;
+	if (lo < -M_PI)
+	{
+		lo += 2.0f * M_PI;
+		hi = M_PI;
+	}
+	lo = max(lo, 0.0f);
+	hi = min(hi, M_PI);
+	if (lo >= hi)
+		return (0);
+	if (hi < M_PI)
+		range[0] = max(-2.0f, cosf(hi) / sinf(hi));
+	if (lo > 0.0f)
+		range[1] = min(2.0f, cosf(lo) / sinf(lo));
+	return (1);
+}
+
+/*
+** Texels of face f (axis f / 2, towards + or - for even or odd f) whose
+** directions can pass within rad of c (seen from the light): rect is x0, y0,
+** x1, y1 (inclusive), the bounds of the directions of the disc on each axis
+** of the face. Returns 0 if there are none.
+*/
+static int			shadow_rect(float *c, float rad, int f, int *rect)
+{
+	float			lz;
+	float			xx[2];
+	float			yy[2];
+
+	lz = (f & 1) ? -c[f >> 1] : c[f >> 1];
+	if (!shadow_range(c[((f >> 1) + 1) % 3], lz, rad, xx)
+		|| !shadow_range(c[((f >> 1) + 2) % 3], lz, rad, yy))
+		return (0);
+	rect[0] = max(0, shadow_coord(xx[0]) - 1);
+	rect[1] = max(0, shadow_coord(yy[0]) - 1);
+	rect[2] = min(SHADOW_SIZE - 1, shadow_coord(xx[1]) + 1);
+	rect[3] = min(SHADOW_SIZE - 1, shadow_coord(yy[1]) + 1);
+	return (rect[0] <= rect[2] && rect[1] <= rect[3]);
+}
+
+static void			shadow_texel(t_shadow_texel *t, int id, int add)
+{
+	int				k;
+
+	if (t->count == SHADOW_FULL)
+		return ;
+	for (k = 0; k < t->count && t->ids[k] != id; k++)
+		;
+	if (!add && k < t->count)
+		t->ids[k] = t->ids[--t->count];
+	else if (add && k == t->count && t->count == SHADOW_IDS)
+		t->count = SHADOW_FULL;
+	else if (add && k == t->count)
+		t->ids[t->count++] = id;
+}
+
+/*
+** Add (or remove) id to (from) every texel whose directions pass within rad
+** of c, on all six faces
+*/
+static void			shadow_mark(t_shadow_map *map, int id, float *c, float rad,
+						int add)
+{
+	int				rect[4];
+	int				f;
+	int				x;
+	int				y;
+
+	for (f = 0; f < 6; f++)
+	{
+		if (!shadow_rect(c, rad, f, rect))
+			continue ;
+		for (y = rect[1]; y <= rect[3]; y++)
+			for (x = rect[0]; x <= rect[2]; x++)
+				shadow_texel(&map->texels[(f * SHADOW_SIZE + y) * SHADOW_SIZE
+					+ x], id, add);
+	}
+}
+
+/*
+** List (or unlist) sphere id, as s, in the texels of its grown disc and of
+** the mirror image of that disc. A grown sphere around the light is in
+** every texel.
+*/
+static void			shadow_sphere(t_shadow_map *map, int id, t_sphere *s,
+						int add)
+{
+	float			c[3];
+	float			rad;
+
+	c[0] = s->pos.x - map->pos.x;
+	c[1] = s->pos.y - map->pos.y;
+	c[2] = s->pos.z - map->pos.z;
+	rad = s->rad * (1.0f + SHADOW_MARGIN) + 1.0f + 2.0f * SHADOW_MARGIN;
+	if (c[0] * c[0] + c[1] * c[1] + c[2] * c[2] <= rad * rad)
+		c[0] = c[1] = c[2] = 0.0f;
+	shadow_mark(map, id, c, rad, add);
+	c[0] = -c[0];
+	c[1] = -c[1];
+	c[2] = -c[2];
+	shadow_mark(map, id, c, rad, add);
+}
+
+static void			shadow_build(t_shadow_map *map, t_spheres *scene, int light)
+{
+	int				i;
+
+	map->light = -1;
+	if (!map->texels && !(map->texels = (t_shadow_texel *)malloc(
+		sizeof(t_shadow_texel) * 6 * SHADOW_SIZE * SHADOW_SIZE)))
+		return ;
+	for (i = 0; i < 6 * SHADOW_SIZE * SHADOW_SIZE; i++)
+		map->texels[i].count = 0;
+	map->pos = scene->spheres[light].pos;
+	for (i = 0; i < scene->nb_spheres; i++)
+		if (i != light)
+			shadow_sphere(map, i, &scene->spheres[i], 1);
+	map->light = light;
+}
+
+/*
+** The ids are unsigned shorts: no cache for larger scenes
+*/
+int					shadow_init(t_shadows *s, t_spheres *scene)
+{
+	memset(s, 0, sizeof(*s));
+	if (scene->nb_spheres > 65535)
+		return (0);
+	s->built = (t_sphere *)malloc(sizeof(t_sphere) * scene->nb_spheres);
+	return (s->built != NULL);
+}
+
+/*
+** Bring the maps up to date with scene (render lock held, before the
+** workers see the new job). A map only changes in the texels of the
+** spheres that moved, unless its light moved or is a different sphere.
+*/
+void				shadow_update(t_shadows *s, t_spheres *scene)
+{
+	t_shadow_map	*map;
+	int				lights[MAX_SHADOW_MAPS];
+	int				n;
+	int				i;
+	int				k;
+
+	n = 0;
+	for (i = 0; i < scene->nb_spheres && n < MAX_SHADOW_MAPS; i++)
+		if (scene->spheres[i].is_light == 1)
+			lights[n++] = i;
+	for (k = 0; k < n; k++)
+	{
+		map = &s->maps[k];
+		if (!s->valid || map->light != lights[k]
+			|| !sphere_same_place(&s->built[lights[k]],
+			&scene->spheres[lights[k]]))
+		{
+			shadow_build(map, scene, lights[k]);
+			continue ;
+		}
+		for (i = 0; i < scene->nb_spheres; i++)
+			if (i != map->light
+				&& !sphere_same_place(&s->built[i], &scene->spheres[i]))
+			{
+				shadow_sphere(map, i, &s->built[i], 0);
+				shadow_sphere(map, i, &scene->spheres[i], 1);
+			}
+	}
+	for (k = n; k < s->nb_maps; k++)
+		s->maps[k].light = -1;
+	s->nb_maps = n;
+	memcpy(s->built, scene->spheres, sizeof(t_sphere) * scene->nb_spheres);
+	s->valid = 1;
+}
+
+/*
+** Map of the sphere light, NULL if it has none
+*/
+t_shadow_map		*shadow_map(t_shadows *s, int light)
+{
+	int				k;
+
+	for (k = 0; k < s->nb_maps; k++)
+		if (s->maps[k].light == light)
+			return (&s->maps[k]);
+	return (NULL);
+}
+
+/*
+** Spheres the shadow ray of the hit point p can meet: sets ids and returns
+** their number, or -1 if every sphere has to be tested
+*/
+int					shadow_lookup(t_shadow_map *map, t_vec p,
+						unsigned short **ids)
+{
+	t_shadow_texel	*t;
+	float			w[3];
+	float			z;
+	int				a;
+	int				x;
+	int				y;
+
+	w[0] = p.x - map->pos.x;
+	w[1] = p.y - map->pos.y;
+	w[2] = p.z - map->pos.z;
+	a = fabsf(w[1]) > fabsf(w[0]) ? 1 : 0;
+	a = fabsf(w[2]) > fabsf(w[a]) ? 2 : a;
+	if ((z = fabsf(w[a])) == 0.0f)
+		return (-1);
+	x = min(SHADOW_SIZE - 1, max(0, shadow_coord(w[(a + 1) % 3] / z)));
+	y = min(SHADOW_SIZE - 1, max(0, shadow_coord(w[(a + 2) % 3] / z)));
+	t = &map->texels[((2 * a + (w[a] < 0.0f)) * SHADOW_SIZE + y) * SHADOW_SIZE
+		+ x];
+	*ids = t->ids;
+	return (t->count == SHADOW_FULL ? -1 : t->count);
+}
+
+void				shadow_quit(t_shadows *s)
+{
+	int				k;
+
+	for (k = 0; k < MAX_SHADOW_MAPS; k++)
+		free(s->maps[k].texels);
+	free(s->built);
+}
@@ -0,0 +1,119 @@
+#include <rtv1.h>
+
+t_sphere		set_sphere(t_vec pos, float radius, t_vec surf_color)
+{
+	t_sphere	sphere;
+
+	sphere.pos = pos;
+	sphere.rad = radius;
+	sphere.surf_color = surf_color;
+	sphere.is_light = 0;
+	sphere.material = MAT_PLASTIC;
+	sphere.emis_color = set_vec(0.0f, 0.0f, 0.0f);
+	return (sphere);
+}
+
+t_sphere		set_light(t_vec pos, float radius, t_vec emis_color)
+{
+	t_sphere	light;
+
+	light.pos = pos;
+	light.rad = radius;
+	light.surf_color = set_vec(0.0f, 0.0f, 0.0f);
+	light.emis_color = emis_color;
+	light.is_light = 1;
+	light.material = MAT_MATTE;
+	return (light);
+}
+
+void			debug_sphere(t_sphere sphere)
+{
+	printf("x = %f y = %f z = %f rad = %f\n", sphere.pos.x, sphere.pos.y, sphere.pos.z, sphere.rad);
+	printf("surf_color red = %f green = %f blue = %f\n", sphere.surf_color.x, sphere.surf_color.y, sphere.surf_color.z);
+	printf("emis_color red = %f green = %f blue = %f\n", sphere.emis_color.x, sphere.emis_color.y, sphere.emis_color.z);
+	printf("\n");
+}
+
+void			debug_spheres(t_spheres *spheres)
+{
+	t_sphere	sphere;
+
+	for (int i = 0; i < spheres->nb_spheres; i++)
+	{
+		if (spheres->spheres == NULL)
+			break ;
+		debug_sphere(spheres->spheres[i]);
+	}
+	printf("\n\n\n");
+}
+
+int				init_spheres(const unsigned int nb_spheres, t_spheres *spheres)
+{
+	spheres->nb_spheres = nb_spheres;
+	spheres->spheres = NULL;
+	if (!(spheres->spheres = (t_sphere *)malloc(sizeof(t_sphere) * nb_spheres)))
+		return (0);
+	return (1);
+}
+
+int					hitsphere(t_vec rayorig, t_vec raydir, t_sphere sphere, float *t0, float *t1)
+{
+	t_vec l = vec_sub(sphere.pos, rayorig);
+	float tca = dot_product(l, raydir);
+	if (tca < 0)
+	    return 0;
+	float d2 = dot_product(l, l) - tca * tca;
+	if (d2 > (sphere.rad * sphere.rad))
+	    return 0;
+	float thc = sqrtf((sphere.rad * sphere.rad) - d2);
+	*t0 = tca - thc;
+	*t1 = tca + thc;
+	return (1);
+}
+
+#define SPHERE_MOVE_SPEED	0.25f
+
+/*
+** Edit a sphere of the scene: 1 to 9 select it, TFGH move it in the
+** horizontal plane, R/Y move it down/up and C gives it the next colour
+** (once per key press). Returns 1 if the sphere changed, the caller then
+** only has to update the pixels it touches.
+*/
+int				sphere_update(t_spheres *spheres, int *selected, t_input *in)
+{
+	static int	color_held;
+	t_sphere	*sphere;
+	t_vec		move;
+	int			recolor;
+	int			i;
+
+	for (i = 0; i < 9 && i < spheres->nb_spheres; i++)
+		if (in->key[SDL_SCANCODE_1 + i])
+			*selected = i;
+	if (*selected < 0 || *selected >= spheres->nb_spheres
+		|| spheres->spheres[*selected].is_light)
+		return (0);
+	sphere = &spheres->spheres[*selected];
+	move = set_vec(0.0f, 0.0f, 0.0f);
+	if (in->key[SDL_SCANCODE_T])
+		move.z -= 1.0f;
+	if (in->key[SDL_SCANCODE_G])
+		move.z += 1.0f;
+	if (in->key[SDL_SCANCODE_H])
+		move.x += 1.0f;
+	if (in->key[SDL_SCANCODE_F])
+		move.x -= 1.0f;
+	if (in->key[SDL_SCANCODE_Y])
+		move.y += 1.0f;
+	if (in->key[SDL_SCANCODE_R])
+		move.y -= 1.0f;
+	recolor = in->key[SDL_SCANCODE_C] && !color_held;
+	color_held = in->key[SDL_SCANCODE_C];
+	if (move.x == 0.0f && move.y == 0.0f && move.z == 0.0f && !recolor)
+		return (0);
+	sphere->pos = vec_add(sphere->pos, vec_mult_f(move, SPHERE_MOVE_SPEED));
+	if (recolor)
+		sphere->surf_color = set_vec(sphere->surf_color.y, sphere->surf_color.z,
+			sphere->surf_color.x);
+	return (1);
+}
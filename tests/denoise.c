@@ -0,0 +1,59 @@
+#include <rt_denoise.h>
+#include <stdio.h>
+#include <unistd.h>
+
+/*
+** rt_denoise.h on every image size up to 2^iterations + a few pixels, the
+** sizes where the border columns of a step meet or overlap. Each step must
+** end (alarm() turns a hang into a failure) and write every pixel of its
+** output, which starts as NaN, and a flat image must come out unchanged.
+*/
+#define MAX_SIZE			40
+
+static int			check(int width, int height)
+{
+	t_denoise		d;
+	int				step;
+	int				i;
+	int				k;
+
+	if (!rt_denoise_init(&d, width, height))
+		return (0);
+	for (i = 0; i < width * height; i++)
+		rt_denoise_set(&d, i, RT_VEC(0.5f, 0.25f, 0.125f), 0.01f,
+			RT_VEC(0.0f, 0.0f, 1.0f), 10.0f, RT_VEC(1.0f, 1.0f, 1.0f), 0);
+	for (step = 0; step < d.iterations; step++)
+	{
+		for (k = 0; k < 3; k++)
+			for (i = 0; i < width * height; i++)
+				d.color[(step + 1) & 1][k][i] = NAN;
+		rt_denoise_rows(&d, step, 0, height);
+		for (k = 0; k < 3; k++)
+			for (i = 0; i < width * height; i++)
+				if (!(fabsf(d.color[(step + 1) & 1][k][i]
+					- d.color[step & 1][k][i]) < 1e-5f))
+				{
+					printf("%dx%d: step %d, pixel %d, %g\n", width, height,
+						step, i, d.color[(step + 1) & 1][k][i]);
+					rt_denoise_free(&d);
+					return (0);
+				}
+	}
+	rt_denoise_free(&d);
+	return (1);
+}
+
+int					main(void)
+{
+	int				width;
+	int				height;
+	int				failed;
+
+	failed = 0;
+	alarm(10);
+	for (width = 1; width <= MAX_SIZE; width++)
+		for (height = 1; height <= MAX_SIZE; height += 3)
+			failed += !check(width, height);
+	printf(failed ? "denoise: %d sizes failed\n" : "denoise: ok\n", failed);
+	return (failed != 0);
+}